@@ -160,6 +160,11 @@ p_mode_start:
     mov ebx, KERNEL_BIN_BASE_ADDR ; kernel.bin 零时存放地址
     mov ecx, 200                  ; 读入的扇区数
     call rd_disk_m_32 
+    ; rd_disk_m_32一次最多读255个扇区,内核后面的部分再读一次,ebx已经指向上次读完的位置
+    ; 共360个扇区,读到0x9d000为止,不会碰到0x9fc00处的扩展BIOS数据区
+    mov eax, KERNEL_START_SECTOR + 200
+    mov ecx, 160
+    call rd_disk_m_32
 
     call setup_page ; 创建页目录及页表并初始化页内存位图
 
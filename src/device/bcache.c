@@ -0,0 +1,516 @@
+#include "bcache.h"
+#include "ide.h"
+#include "sync.h"
+#include "list.h"
+#include "memory.h"
+#include "string.h"
+#include "assert.h"
+#include "stdio.h"
+#include "interrupt.h"
+
+/* 全部缓存块 */
+static struct buffer_head buffers[BCACHE_BUF_CNT];
+/* 以(hd, lba)为键的哈希桶 */
+static struct list hash_table[BCACHE_HASH_CNT];
+/* lru链表,队首是最近使用的缓存块,队尾是最久未使用的缓存块 */
+static struct list lru_list;
+/* 缓存锁,读写缓存时互斥,等待硬盘时释放,让别的线程的请求也能排进队列 */
+static struct lock bcache_lock;
+/* 统计信息 */
+static struct bcache_stat stat;
+
+/* 计算(hd, lba)所在的哈希桶 */
+static struct list* bcache_bucket(struct disk* hd, uint32_t lba) {
+    return &hash_table[(lba ^ ((uint32_t)hd >> 4)) % BCACHE_HASH_CNT];
+}
+
+/* 在缓存中查找扇区,找不到返回NULL */
+static struct buffer_head* bcache_lookup(struct disk* hd, uint32_t lba) {
+    struct list* bucket = bcache_bucket(hd, lba);
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct buffer_head* bh = elem2entry(struct buffer_head, hash_tag, elem);
+        if (bh->hd == hd && bh->lba == lba) return bh;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 将缓存块移到lru链表的队首 */
+static void bcache_touch(struct buffer_head* bh) {
+    list_remove(&bh->lru_tag);
+    list_push(&lru_list, &bh->lru_tag);
+}
+
+/* 缓存块上的读写完成,唤醒所有等待者,不需要持有缓存锁 */
+static void bcache_io_finish(struct buffer_head* bh) {
+    enum intr_status old_status = intr_disable();
+    bh->io_pending = false;
+    while (bh->io_waiters > 0) {
+        bh->io_waiters--;
+        sema_up(&bh->io_done);
+    }
+    intr_set_status(old_status);
+}
+
+/* 预读请求完成的回调,在硬盘通道的工作线程中执行,不能获取缓存锁 */
+static void bcache_io_done(struct ide_request* req, void* arg) {
+    struct buffer_head* bh = arg;
+    bh->valid = (req->status == 0);
+    bcache_io_finish(bh);
+}
+
+/* 等缓存块上正在进行的读写完成,调用者持有缓存锁,等待时释放.回来后缓存块可能已经换了扇区,调用者要重新查找 */
+static void bcache_wait_io(struct buffer_head* bh) {
+    enum intr_status old_status = intr_disable();
+    if (!bh->io_pending) {
+        intr_set_status(old_status);
+        return;
+    }
+    bh->io_waiters++;
+    intr_set_status(old_status);
+    lock_release(&bcache_lock);
+    sema_down(&bh->io_done);
+    lock_acquire(&bcache_lock);
+}
+
+/* 查找扇区的缓存块,正在读写的等它完成后重新查找,返回的缓存块不在读写中 */
+static struct buffer_head* bcache_get(struct disk* hd, uint32_t lba) {
+    struct buffer_head* bh = bcache_lookup(hd, lba);
+    while (bh != NULL && bh->io_pending) {
+        bcache_wait_io(bh);
+        bh = bcache_lookup(hd, lba);
+    }
+    return bh;
+}
+
+/* 将脏缓存块写回硬盘,写的时候释放缓存锁,缓存块标记为正在读写,别人要等写完 */
+static void bcache_writeback(struct buffer_head* bh) {
+    if (!bh->valid || !bh->dirty || bh->io_pending) return;
+    bh->io_pending = true;
+    lock_release(&bcache_lock);
+    int32_t ret = ide_write(bh->hd, bh->lba, bh->data, 1);
+    lock_acquire(&bcache_lock);
+    // 写回失败的缓存块保持为脏,下次再试
+    if (ret == 0) {
+        bh->dirty = false;
+        stat.writebacks++;
+    }
+    bcache_io_finish(bh);
+}
+
+/**
+ * @description: 找到(hd, lba)的缓存块,不在缓存中时淘汰最久未使用的缓存块重新绑定,新绑定的缓存块数据无效.
+ *               找到的缓存块可能正在读写,这里不等,免得持有别的正在读写的缓存块的调用者互相等待
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 扇区号
+ * @return {*} 缓存块,没有能淘汰的缓存块时返回NULL
+ */
+static struct buffer_head* bcache_getblk(struct disk* hd, uint32_t lba) {
+    uint32_t writebacks = 0;
+    while (1) {
+        struct buffer_head* bh = bcache_lookup(hd, lba);
+        if (bh != NULL) return bh;
+        // 正在读写的和被日志钉住的缓存块不能淘汰,从队尾往前找
+        struct list_elem* elem = lru_list.tail.prev;
+        while (elem != &lru_list.head) {
+            struct buffer_head* cand = elem2entry(struct buffer_head, lru_tag, elem);
+            elem = elem->prev;
+            if (!cand->io_pending && !cand->pinned) {
+                bh = cand;
+                break;
+            }
+        }
+        if (bh == NULL) return NULL;
+        if (bh->valid && bh->dirty) {
+            // 淘汰之前先写回脏数据,期间别人可能绑定了同一个扇区,写完重新找.
+            // 写回失败的缓存块中是唯一的一份数据,不能淘汰,挪到队首换下一个
+            if (writebacks++ == BCACHE_BUF_CNT) return NULL;
+            bcache_writeback(bh);
+            if (bh->dirty) bcache_touch(bh);
+            continue;
+        }
+        if (bh->hd != NULL) {
+            list_remove(&bh->hash_tag);
+            if (bh->valid) stat.evictions++;
+        }
+        bh->hd = hd;
+        bh->lba = lba;
+        bh->valid = false;
+        bh->dirty = false;
+        list_push(bcache_bucket(hd, lba), &bh->hash_tag);
+        bcache_touch(bh);
+        return bh;
+    }
+}
+
+/* 同bcache_getblk,缓存块正在读写时等它完成,调用者不能持有别的正在读写的缓存块 */
+static struct buffer_head* bcache_getblk_wait(struct disk* hd, uint32_t lba) {
+    struct buffer_head* bh = bcache_getblk(hd, lba);
+    while (bh != NULL && bh->io_pending) {
+        bcache_wait_io(bh);
+        bh = bcache_getblk(hd, lba);
+    }
+    return bh;
+}
+
+/* 从缓存中读取sec_cnt个扇区,连续未命中的扇区合并成一次硬盘读取,成功返回0,失败返回-1 */
+static int32_t bcache_read_cached(struct disk* hd, uint32_t lba, uint8_t* buf, uint32_t sec_cnt) {
+    struct buffer_head* run[BCACHE_BYPASS_SECTS];
+    uint32_t sec_idx = 0;
+    while (sec_idx < sec_cnt) {
+        struct buffer_head* bh = bcache_get(hd, lba + sec_idx);
+        if (bh != NULL && bh->valid) {
+            memcpy(buf + sec_idx * SEC_BIT, bh->data, SEC_BIT);
+            bcache_touch(bh);
+            stat.hits++;
+            sec_idx++;
+            continue;
+        }
+        // 连续未命中的扇区先绑定好缓存块并标记为正在读入,别人读写这些扇区时会等读完
+        uint32_t miss_cnt = 0;
+        while (sec_idx + miss_cnt < sec_cnt && miss_cnt < BCACHE_BYPASS_SECTS) {
+            bh = bcache_getblk(hd, lba + sec_idx + miss_cnt);
+            // 分配时可能释放过缓存锁,期间被别人读入或者正在读写的扇区到此为止
+            if (bh == NULL || bh->valid || bh->io_pending) break;
+            bh->io_pending = true;
+            run[miss_cnt++] = bh;
+        }
+        if (miss_cnt == 0) {
+            if (bh != NULL) continue;
+            // 缓存块都用不了,这个扇区不经过缓存直接读
+            stat.misses++;
+            lock_release(&bcache_lock);
+            int32_t ret = ide_read(hd, lba + sec_idx, buf + sec_idx * SEC_BIT, 1);
+            lock_acquire(&bcache_lock);
+            if (ret != 0) return -1;
+            sec_idx++;
+            continue;
+        }
+        stat.misses += miss_cnt;
+        // 释放缓存锁后一次读入调用者的缓冲区,再装入缓存,读取失败的扇区不装入
+        lock_release(&bcache_lock);
+        int32_t ret = ide_read(hd, lba + sec_idx, buf + sec_idx * SEC_BIT, miss_cnt);
+        lock_acquire(&bcache_lock);
+        for (uint32_t idx = 0; idx < miss_cnt; idx++) {
+            if (ret == 0) {
+                memcpy(run[idx]->data, buf + (sec_idx + idx) * SEC_BIT, SEC_BIT);
+                run[idx]->valid = true;
+                bcache_touch(run[idx]);
+            }
+            bcache_io_finish(run[idx]);
+        }
+        if (ret != 0) return -1;
+        sec_idx += miss_cnt;
+    }
+    return 0;
+}
+
+/* 绕过缓存直接从硬盘读入buf,读的时候释放缓存锁,读完再把缓存中的有效扇区覆盖上去,它们不会比硬盘上的旧 */
+static int32_t bcache_read_bypass(struct disk* hd, uint32_t lba, uint8_t* buf, uint32_t sec_cnt) {
+    lock_release(&bcache_lock);
+    int32_t ret = ide_read(hd, lba, buf, sec_cnt);
+    lock_acquire(&bcache_lock);
+    for (uint32_t sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+        struct buffer_head* bh = bcache_lookup(hd, lba + sec_idx);
+        if (bh != NULL && bh->valid) {
+            memcpy(buf + sec_idx * SEC_BIT, bh->data, SEC_BIT);
+        }
+    }
+    return ret;
+}
+
+/**
+ * @description: 从硬盘hd的lba扇区起读取sec_cnt个扇区到buf,命中缓存的扇区不再访问硬盘
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 起始扇区
+ * @param {void*} buf 缓冲区
+ * @param {uint32_t} sec_cnt 扇区数
+ * @return {*} 成功返回0,失败返回-1
+ */
+int32_t bcache_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    ASSERT(sec_cnt > 0);
+    int32_t ret;
+    lock_acquire(&bcache_lock);
+    if (sec_cnt > BCACHE_BYPASS_SECTS) {
+        // 大块读取直接访问硬盘,避免冲掉缓存
+        ret = bcache_read_bypass(hd, lba, buf, sec_cnt);
+    }
+    else {
+        ret = bcache_read_cached(hd, lba, buf, sec_cnt);
+    }
+    lock_release(&bcache_lock);
+    return ret;
+}
+
+/**
+ * @description: 从硬盘hd的lba扇区起读取sec_cnt个扇区直接读入buf,不装入缓存.全部命中时从缓存拷贝,
+ *               否则整段由硬盘直接读入buf(dma时写入buf所在的物理页),只把缓存中的脏扇区覆盖上去
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 起始扇区
+ * @param {void*} buf 缓冲区,可以是用户进程的缓冲区
+ * @param {uint32_t} sec_cnt 扇区数
+ * @return {*} 成功返回0,失败返回-1
+ */
+int32_t bcache_read_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    ASSERT(sec_cnt > 0);
+    lock_acquire(&bcache_lock);
+    // 预读过的扇区等它读完,全部在缓存中就不必再访问硬盘
+    bool all_cached = true;
+    for (uint32_t sec_idx = 0; sec_idx < sec_cnt && all_cached; sec_idx++) {
+        struct buffer_head* bh = bcache_get(hd, lba + sec_idx);
+        all_cached = bh != NULL && bh->valid;
+    }
+    int32_t ret;
+    if (all_cached) {
+        ret = bcache_read_cached(hd, lba, buf, sec_cnt);
+    }
+    else {
+        stat.direct_reads += sec_cnt;
+        ret = bcache_read_bypass(hd, lba, buf, sec_cnt);
+    }
+    lock_release(&bcache_lock);
+    return ret;
+}
+
+/**
+ * @description: 从硬盘hd的lba扇区的offset字节处起读取len个字节到buf,直接从缓存块中拷贝,调用者不用准备整扇区的缓冲区
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 起始扇区
+ * @param {uint32_t} offset 扇区内的字节偏移
+ * @param {void*} buf 缓冲区
+ * @param {uint32_t} len 字节数
+ * @return {*} 成功返回0,失败返回-1
+ */
+int32_t bcache_read_bytes(struct disk* hd, uint32_t lba, uint32_t offset, void* buf, uint32_t len) {
+    lba += offset / SEC_BIT;
+    offset %= SEC_BIT;
+    uint8_t* dst = buf;
+    lock_acquire(&bcache_lock);
+    while (len > 0) {
+        struct buffer_head* bh = bcache_getblk_wait(hd, lba);
+        if (bh == NULL) {
+            lock_release(&bcache_lock);
+            return -1;
+        }
+        if (bh->valid) {
+            stat.hits++;
+        }
+        else {
+            // 未命中的扇区直接读进缓存块,读的时候释放缓存锁
+            stat.misses++;
+            bh->io_pending = true;
+            lock_release(&bcache_lock);
+            int32_t ret = ide_read(hd, lba, bh->data, 1);
+            lock_acquire(&bcache_lock);
+            bh->valid = (ret == 0);
+            bcache_io_finish(bh);
+            if (ret != 0) {
+                lock_release(&bcache_lock);
+                return -1;
+            }
+        }
+        uint32_t chunk = SEC_BIT - offset < len ? SEC_BIT - offset : len;
+        memcpy(dst, bh->data + offset, chunk);
+        bcache_touch(bh);
+        dst += chunk;
+        len -= chunk;
+        offset = 0;
+        lba++;
+    }
+    lock_release(&bcache_lock);
+    return 0;
+}
+
+/**
+ * @description: 将buf中的sec_cnt个扇区写入硬盘hd的lba扇区起,数据先写入缓存并标记为脏,淘汰或刷新时才写回硬盘
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 起始扇区
+ * @param {void*} buf 缓冲区
+ * @param {uint32_t} sec_cnt 扇区数
+ * @return {*} 成功返回0,失败返回-1
+ */
+int32_t bcache_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    ASSERT(sec_cnt > 0);
+    int32_t ret = 0;
+    lock_acquire(&bcache_lock);
+    if (sec_cnt > BCACHE_BYPASS_SECTS) {
+        // 大块写入直接写硬盘,写的时候释放缓存锁.先作废已缓存的扇区,免得刷新时用旧数据盖掉新写的
+        for (uint32_t sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+            struct buffer_head* bh = bcache_get(hd, lba + sec_idx);
+            if (bh != NULL) {
+                bh->valid = false;
+                bh->dirty = false;
+            }
+        }
+        lock_release(&bcache_lock);
+        ret = ide_write(hd, lba, buf, sec_cnt);
+        lock_acquire(&bcache_lock);
+        // 写的期间又读入缓存的扇区可能是旧数据,成功时换成新写的,失败时硬盘上是什么不知道了,作废.
+        // 期间又被写脏的扇区比这次写的新,保持不动
+        for (uint32_t sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+            struct buffer_head* bh = bcache_get(hd, lba + sec_idx);
+            if (bh == NULL || !bh->valid || bh->dirty) continue;
+            if (ret == 0) {
+                memcpy(bh->data, (uint8_t*)buf + sec_idx * SEC_BIT, SEC_BIT);
+            }
+            else {
+                bh->valid = false;
+            }
+        }
+    }
+    else {
+        for (uint32_t sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+            // 等正在进行的读写完成,否则读入的旧数据会覆盖新写的数据
+            struct buffer_head* bh = bcache_getblk_wait(hd, lba + sec_idx);
+            if (bh == NULL) {
+                ret = -1;
+                break;
+            }
+            memcpy(bh->data, (uint8_t*)buf + sec_idx * SEC_BIT, SEC_BIT);
+            bh->valid = true;
+            bh->dirty = true;
+            bcache_touch(bh);
+        }
+    }
+    lock_release(&bcache_lock);
+    return ret;
+}
+
+/**
+ * @description: 把buf中的1个扇区写入缓存并钉住,钉住的缓存块不会被淘汰也不会被刷新写回,由日志在事务提交后解除
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 扇区号
+ * @param {void*} buf 缓冲区
+ * @return {*}
+ */
+void bcache_write_pinned(struct disk* hd, uint32_t lba, void* buf) {
+    lock_acquire(&bcache_lock);
+    struct buffer_head* bh = bcache_getblk_wait(hd, lba);
+    // 日志的扇区只能放在缓存中,放不下就没法保证一致性了
+    if (bh == NULL) PANIC("bcache_write_pinned: no buffer can be evicted");
+    memcpy(bh->data, buf, SEC_BIT);
+    bh->valid = true;
+    bh->dirty = true;
+    bh->pinned = true;
+    bcache_touch(bh);
+    lock_release(&bcache_lock);
+}
+
+/**
+ * @description: 解除扇区的钉住,之后按普通的脏缓存块写回
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 扇区号
+ * @return {*}
+ */
+void bcache_unpin(struct disk* hd, uint32_t lba) {
+    lock_acquire(&bcache_lock);
+    struct buffer_head* bh = bcache_lookup(hd, lba);
+    if (bh != NULL) bh->pinned = false;
+    lock_release(&bcache_lock);
+}
+
+/**
+ * @description: 为一组扇区分配缓存块并提交读请求,请求在塞住的队列中提交,相邻的扇区会被合并成一条命令
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t*} lbas 扇区号数组,为0的表示空洞,跳过
+ * @param {uint32_t} cnt 扇区数,超过BCACHE_PREFETCH_MAX的部分不读
+ * @param {list*} pending 新提交的缓存块放入此队列
+ * @return {*}
+ */
+static void bcache_start_reads(struct disk* hd, uint32_t* lbas, uint32_t cnt, struct list* pending) {
+    if (cnt > BCACHE_PREFETCH_MAX) cnt = BCACHE_PREFETCH_MAX;
+    // 1 先分配好缓存块,淘汰时的写回会等待硬盘,不能放在塞住队列的时候做
+    for (uint32_t idx = 0; idx < cnt; idx++) {
+        if (lbas[idx] == 0) continue;
+        struct buffer_head* bh = bcache_getblk(hd, lbas[idx]);
+        // 缓存块都用不了就少预读一些
+        if (bh == NULL) break;
+        // 已经在缓存中或者正在读写的不用再读
+        if (bh->valid || bh->io_pending) continue;
+        bh->io_pending = true;
+        list_append(pending, &bh->io_tag);
+    }
+    // 2 塞住队列,一次性提交所有的读请求
+    ide_plug(hd);
+    struct list_elem* elem = pending->head.next;
+    while (elem != &pending->tail) {
+        struct buffer_head* bh = elem2entry(struct buffer_head, io_tag, elem);
+        ide_request_init(&bh->io_req, hd, bh->lba, bh->data, 1, false);
+        bh->io_req.callback = bcache_io_done;
+        bh->io_req.cb_arg = bh;
+        ide_submit(&bh->io_req);
+        stat.misses++;
+        elem = elem->next;
+    }
+    ide_unplug(hd);
+}
+
+/**
+ * @description: 把一组扇区异步读入缓存,只提交请求不等待,之后读到这些扇区时再等
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t*} lbas 扇区号数组,为0的表示空洞,跳过
+ * @param {uint32_t} cnt 扇区数,超过BCACHE_PREFETCH_MAX的部分不预读
+ * @return {*}
+ */
+void bcache_readahead(struct disk* hd, uint32_t* lbas, uint32_t cnt) {
+    struct list pending;
+    list_init(&pending);
+    lock_acquire(&bcache_lock);
+    bcache_start_reads(hd, lbas, cnt, &pending);
+    lock_release(&bcache_lock);
+}
+
+/**
+ * @description: 将硬盘hd上所有的脏缓存块写回硬盘,被日志钉住的缓存块等事务提交后再写
+ * @param {disk*} hd 硬盘,为NULL时写回所有硬盘的脏缓存块
+ * @return {*}
+ */
+void bcache_flush(struct disk* hd) {
+    lock_acquire(&bcache_lock);
+    for (uint32_t buf_idx = 0; buf_idx < BCACHE_BUF_CNT; buf_idx++) {
+        struct buffer_head* bh = &buffers[buf_idx];
+        if ((hd == NULL || bh->hd == hd) && !bh->pinned) {
+            bcache_writeback(bh);
+        }
+    }
+    lock_release(&bcache_lock);
+}
+
+/* 获取缓存统计信息 */
+void bcache_get_stat(struct bcache_stat* st) {
+    lock_acquire(&bcache_lock);
+    memcpy(st, &stat, sizeof(struct bcache_stat));
+    lock_release(&bcache_lock);
+}
+
+/* 块缓存初始化 */
+void bcache_init(void) {
+    printk("bcache_init start!\n");
+    // 缓存数据区直接按页申请,位于内核空间,所有线程共享
+    uint8_t* data = get_kernel_pages(DIV_ROUND_UP(BCACHE_BUF_CNT * SEC_BIT, PG_SIZE));
+    if (data == NULL) {
+        PANIC("bcache_init: alloc memory failed!");
+    }
+    lock_init(&bcache_lock);
+    list_init(&lru_list);
+    for (uint32_t bucket_idx = 0; bucket_idx < BCACHE_HASH_CNT; bucket_idx++) {
+        list_init(&hash_table[bucket_idx]);
+    }
+    for (uint32_t buf_idx = 0; buf_idx < BCACHE_BUF_CNT; buf_idx++) {
+        struct buffer_head* bh = &buffers[buf_idx];
+        bh->hd = NULL;
+        bh->lba = 0;
+        bh->valid = false;
+        bh->dirty = false;
+        bh->pinned = false;
+        bh->io_pending = false;
+        bh->io_waiters = 0;
+        sema_init(&bh->io_done, 0);
+        bh->data = data + buf_idx * SEC_BIT;
+        // 无效的缓存块放到队尾,优先被使用
+        list_append(&lru_list, &bh->lru_tag);
+    }
+    memset(&stat, 0, sizeof(struct bcache_stat));
+    printk("bcache_init done!\n");
+}
@@ -0,0 +1,60 @@
+#ifndef __DEVICE_BCACHE_H
+#define __DEVICE_BCACHE_H
+
+#include "stdin.h"
+#include "list.h"
+#include "ide.h"
+
+#define BCACHE_BUF_CNT       256    // 缓存的扇区数,共128KB
+#define BCACHE_HASH_CNT      64     // 哈希桶的数量
+#define BCACHE_BYPASS_SECTS  32     // 超过这个扇区数的读写不进入缓存,直接访问硬盘
+#define BCACHE_PREFETCH_MAX  128    // 一次预读的最多扇区数,不超过缓存的一半,以免预读的扇区互相淘汰
+
+/* 缓存块,每个缓存块缓存硬盘上的一个扇区 */
+struct buffer_head {
+    struct disk* hd;              // 扇区所属的硬盘
+    uint32_t lba;                 // 扇区号
+    bool valid;                   // 缓存中的数据是否有效
+    bool dirty;                   // 数据被修改过,淘汰或刷新时需要写回硬盘
+    bool pinned;                  // 被日志钉住,事务提交之前不能写回也不能淘汰
+    uint8_t* data;                // 扇区数据
+    bool io_pending;              // 正在读入或者写回,期间不能读写也不能淘汰
+    struct ide_request io_req;    // 预读本缓存块用的请求
+    uint32_t io_waiters;          // 等待读写完成的线程数
+    struct semaphore io_done;     // 读写完成时给每个等待者up一次
+    struct list_elem io_tag;      // 在等待读入的缓存块队列中的节点
+    struct list_elem hash_tag;    // 在哈希桶中的节点
+    struct list_elem lru_tag;     // 在lru链表中的节点,越靠近队首越是最近使用的
+};
+
+/* 缓存统计信息 */
+struct bcache_stat {
+    uint32_t hits;                // 命中的扇区数
+    uint32_t misses;              // 未命中的扇区数
+    uint32_t evictions;           // 被淘汰的缓存块数
+    uint32_t writebacks;          // 写回硬盘的扇区数
+    uint32_t direct_reads;        // 不经过缓存直接读入调用者缓冲区的扇区数
+};
+
+/* 块缓存初始化 */
+void bcache_init(void);
+/* 经过缓存从硬盘hd的lba扇区起读取sec_cnt个扇区到buf,成功返回0,失败返回-1 */
+int32_t bcache_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+/* 从硬盘hd的lba扇区起读取sec_cnt个扇区直接读入buf,读到的扇区不装入缓存,成功返回0,失败返回-1 */
+int32_t bcache_read_direct(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+/* 经过缓存从硬盘hd的lba扇区offset字节处起读取len个字节到buf,成功返回0,失败返回-1 */
+int32_t bcache_read_bytes(struct disk* hd, uint32_t lba, uint32_t offset, void* buf, uint32_t len);
+/* 经过缓存将buf中sec_cnt个扇区写入硬盘hd的lba扇区起,数据先留在缓存中,成功返回0 */
+int32_t bcache_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+/* 把硬盘hd上lbas数组中的cnt个扇区异步读入缓存,不等待完成 */
+void bcache_readahead(struct disk* hd, uint32_t* lbas, uint32_t cnt);
+/* 把buf中的1个扇区写入缓存并钉住,解除钉住之前不会写回硬盘 */
+void bcache_write_pinned(struct disk* hd, uint32_t lba, void* buf);
+/* 解除扇区的钉住,之后按普通的脏缓存块写回 */
+void bcache_unpin(struct disk* hd, uint32_t lba);
+/* 将硬盘hd上所有的脏缓存块写回硬盘,hd为NULL时写回全部硬盘,钉住的缓存块除外 */
+void bcache_flush(struct disk* hd);
+/* 获取缓存统计信息 */
+void bcache_get_stat(struct bcache_stat* stat);
+
+#endif
@@ -7,6 +7,8 @@
 #include "assert.h"
 #include "io.h"
 #include "timer.h"
+#include "pci.h"
+#include "process.h"
 
 /* 通道数量 */
 uint8_t channel_cnt;
@@ -92,100 +94,405 @@ static void write2sector(struct disk* hd, void* buf, uint8_t sec_cnt) {
     outsw(reg_data(hd->my_channel), buf, size_in_byte / 2);
 }
 
-/* 最多等待30秒 */
-static bool busy_wait(struct disk* hd) {
+/**
+ * @description: 等待硬盘退出忙状态,先在状态寄存器上紧凑地轮询,仍未就绪再隔一段时间睡眠后查看,直到超时
+ * @param {disk*} hd 硬盘
+ * @return {*} 硬盘不忙后的状态寄存器值,超时返回BIT_STAT_BSY
+ */
+static uint8_t busy_wait(struct disk* hd) {
     struct ide_channel* channel = hd->my_channel;
-    uint16_t time_limit = 30 * 1000;	     // 可以等待30000毫秒
-    while (time_limit -= 10 >= 0) {
-        // 如果硬盘不忙
-        if (!(inb(reg_status(channel)) & BIT_STAT_BSY)) {
-            // 数据传输准备好了
-            return (inb(reg_status(channel)) & BIT_STAT_DRQ);
-        }
-        else {
-            mtime_sleep(10);		     // 睡眠10毫秒
-        }
+    // 读备用状态寄存器不会清除硬盘的中断请求
+    for (uint32_t spin = 0; spin < IDE_SPIN_CNT; spin++) {
+        uint8_t status = inb(reg_alt_status(channel));
+        if (!(status & BIT_STAT_BSY)) return status;
     }
+    // 硬盘一时半会好不了,按时钟嘀嗒计算超时,期间睡眠而不是反复让出cpu
+    uint64_t deadline = ticks + IDE_TIMEOUT_TICKS;
+    while (ticks < deadline) {
+        uint8_t status = inb(reg_alt_status(channel));
+        if (!(status & BIT_STAT_BSY)) return status;
+        utime_sleep(IDE_POLL_US);
+    }
+    return BIT_STAT_BSY;
+}
+
+/* 等待硬盘中断,超时返回false,超时后迟到的中断不会再唤醒下一次的等待 */
+static bool wait_intr(struct ide_channel* channel) {
+    if (sema_down_timeout(&channel->disk_done, IDE_TIMEOUT_TICKS)) return true;
+    enum intr_status old_status = intr_disable();
+    channel->expecting_intr = false;
+    channel->disk_done.value = 0;
+    intr_set_status(old_status);
     return false;
 }
 
-/* 从硬盘读取sec_cnt个扇区到buf */
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
+/* 命令出错时根据状态寄存器和错误寄存器输出错误信息 */
+static void report_error(struct disk* hd, const char* op, uint32_t lba, uint8_t status) {
+    struct ide_channel* channel = hd->my_channel;
+    if (status & BIT_STAT_BSY) {
+        printk("%s %s sector %d timeout, status 0x%x\n", hd->name, op, lba, status);
+    }
+    else {
+        printk("%s %s sector %d failed, status 0x%x error 0x%x\n", \
+            hd->name, op, lba, status, inb(reg_error(channel)));
+    }
+}
 
-    // 1 先选择操作的硬盘
-    select_disk(hd);
-    uint32_t secs_op;		 // 每次操作的扇区数
-    uint32_t secs_done = 0;	 // 已完成的扇区数
-    while (secs_done < sec_cnt) {
-        // 每次读入的扇区数，最大256
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
+/* 检查命令完成后的状态,硬盘不忙、没有出错并且满足need_drq时返回true */
+static bool check_status(struct disk* hd, const char* op, uint32_t lba, bool need_drq) {
+    uint8_t status = busy_wait(hd);
+    if (!(status & (BIT_STAT_BSY | BIT_STAT_ERR | BIT_STAT_DF)) && (!need_drq || (status & BIT_STAT_DRQ))) {
+        return true;
+    }
+    report_error(hd, op, lba, status);
+    return false;
+}
+
+/* 关中断并切换到请求提交者的页表,用户进程的缓冲区只在它自己的页表中可见 */
+static enum intr_status owner_space_enter(struct ide_request* req) {
+    enum intr_status old_status = intr_disable();
+    if (req->owner != NULL && req->owner->pgdir != NULL) page_dir_activate(req->owner);
+    return old_status;
+}
+
+/* 切换回工作线程自己的页表并恢复中断 */
+static void owner_space_leave(enum intr_status old_status) {
+    page_dir_activate(running_thread());
+    intr_set_status(old_status);
+}
+
+/* 用pio方式读取一批连续的请求,共sec_cnt个扇区,成功返回0,失败返回-1 */
+static int32_t pio_read(struct disk* hd, uint32_t lba, uint32_t sec_cnt, struct list* batch) {
+    // 1 写入待读入的扇区数和起始扇区号
+    select_sector(hd, lba, sec_cnt);
+    // 2 执行的命令写入reg_cmd寄存器
+    cmd_out(hd->my_channel, CMD_READ_SECTOR);
+    // 3 阻塞自己，等待硬盘中断程序唤醒自己
+    if (!wait_intr(hd->my_channel)) {
+        report_error(hd, "read", lba, inb(reg_alt_status(hd->my_channel)) | BIT_STAT_BSY);
+        return -1;
+    }
+    // 4 醒来后，检测硬盘状态是否可读
+    if (!check_status(hd, "read", lba, true)) return -1;
+    // 5 把数据从硬盘的缓冲区中依次读到每个请求的缓冲区
+    struct list_elem* elem = batch->head.next;
+    while (elem != &batch->tail) {
+        struct ide_request* req = elem2entry(struct ide_request, sort_tag, elem);
+        enum intr_status old_status = owner_space_enter(req);
+        read_from_sector(hd, req->buf, req->sec_cnt);
+        owner_space_leave(old_status);
+        elem = elem->next;
+    }
+    return 0;
+}
+
+/* 用pio方式写入一批连续的请求,共sec_cnt个扇区,成功返回0,失败返回-1 */
+static int32_t pio_write(struct disk* hd, uint32_t lba, uint32_t sec_cnt, struct list* batch) {
+    // 1 写入待写入的扇区数和起始扇区号
+    select_sector(hd, lba, sec_cnt);
+    // 2 执行的命令写入reg_cmd寄存器
+    cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
+    // 3 检测硬盘是否准备好接收数据,硬盘通常几微秒就会置位DRQ,在轮询阶段就能等到
+    if (!check_status(hd, "write", lba, true)) return -1;
+    // 4 依次将每个请求的数据写入硬盘
+    struct list_elem* elem = batch->head.next;
+    while (elem != &batch->tail) {
+        struct ide_request* req = elem2entry(struct ide_request, sort_tag, elem);
+        enum intr_status old_status = owner_space_enter(req);
+        write2sector(hd, req->buf, req->sec_cnt);
+        owner_space_leave(old_status);
+        elem = elem->next;
+    }
+    // 5 在硬盘响应期间阻塞自己
+    if (!wait_intr(hd->my_channel)) {
+        report_error(hd, "write", lba, inb(reg_alt_status(hd->my_channel)) | BIT_STAT_BSY);
+        return -1;
+    }
+    return check_status(hd, "write", lba, false) ? 0 : -1;
+}
+
+/**
+ * @description: 根据一批请求的缓冲区所在的物理页构建通道的prd表,物理上连续的页合并成一项,每项不跨越64KB边界
+ * @param {ide_channel*} channel 通道
+ * @param {list*} batch 按扇区顺序排列的请求
+ * @return {*} 成功返回true,缓冲区不是2字节对齐或prd表放不下时返回false
+ */
+static bool prdt_build(struct ide_channel* channel, struct list* batch) {
+    struct prd_entry* prd = NULL;
+    uint32_t prd_idx = 0;
+    uint32_t prd_len = 0;		 // 当前表项的实际字节数,64KB时byte_cnt字段为0
+    struct list_elem* elem = batch->head.next;
+    while (elem != &batch->tail) {
+        struct ide_request* req = elem2entry(struct ide_request, sort_tag, elem);
+        uint32_t vaddr = (uint32_t)req->buf;
+        uint32_t byte_cnt = req->sec_cnt * SEC_BIT;
+        if (vaddr & 1) return false;
+        // 用户进程的缓冲区要在它的页表中才能查到物理地址
+        enum intr_status old_status = owner_space_enter(req);
+        while (byte_cnt > 0) {
+            uint32_t phy_addr = addr_v2p(vaddr);
+            // 每次最多处理到页尾,一页之内物理地址一定连续
+            uint32_t len = PG_SIZE - (vaddr & 0xfff);
+            if (len > byte_cnt) len = byte_cnt;
+            if (prd != NULL && prd->phy_addr + prd_len == phy_addr && \
+                (prd->phy_addr & 0xffff0000) == ((phy_addr + len - 1) & 0xffff0000)) {
+                // 与上一项物理连续且在同一个64KB区域内,直接合并
+                prd_len += len;
+            }
+            else {
+                if (prd_idx == PRD_CNT) {
+                    owner_space_leave(old_status);
+                    return false;
+                }
+                prd = &channel->prdt[prd_idx++];
+                prd->phy_addr = phy_addr;
+                prd->flag = 0;
+                prd_len = len;
+            }
+            prd->byte_cnt = prd_len & 0xffff;
+            vaddr += len;
+            byte_cnt -= len;
+        }
+        owner_space_leave(old_status);
+        elem = elem->next;
+    }
+    prd->flag = PRD_EOT;
+    return true;
+}
+
+/**
+ * @description: 用总线主控dma方式读写一批连续的请求,硬盘直接读写缓冲区所在的物理内存,完成后由硬盘中断唤醒
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 起始扇区
+ * @param {uint32_t} sec_cnt 扇区数,最大256
+ * @param {bool} is_write 为true时写硬盘,否则读硬盘
+ * @param {list*} batch 按扇区顺序排列的请求
+ * @return {*} 成功返回true,不支持dma或出错时返回false,由调用者退回pio方式
+ */
+static bool dma_transfer(struct disk* hd, uint32_t lba, uint32_t sec_cnt, bool is_write, struct list* batch) {
+    struct ide_channel* channel = hd->my_channel;
+    if (channel->bmide_base == 0) return false;
+    if (!prdt_build(channel, batch)) return false;
+    // 1 停止上一次的传输,设置prd表地址,清除上次的错误和中断标志
+    uint8_t bm_cmd = is_write ? 0 : BIT_BM_CMD_READ;
+    outb(reg_bm_cmd(channel), bm_cmd);
+    outl(reg_bm_prdt(channel), channel->prdt_phy);
+    outb(reg_bm_status(channel), inb(reg_bm_status(channel)) | BIT_BM_STAT_ERR | BIT_BM_STAT_INTR);
+    // 2 写入扇区数和起始扇区号,发出dma读写命令
+    select_sector(hd, lba, sec_cnt);
+    cmd_out(channel, is_write ? CMD_WRITE_DMA : CMD_READ_DMA);
+    // 3 启动总线主控,之后数据搬运不再需要cpu参与
+    outb(reg_bm_cmd(channel), bm_cmd | BIT_BM_CMD_START);
+    // 4 阻塞自己,传输完成后硬盘中断程序唤醒自己
+    bool intr_ok = wait_intr(channel);
+    // 5 停止总线主控并检查传输结果
+    outb(reg_bm_cmd(channel), bm_cmd);
+    uint8_t bm_status = inb(reg_bm_status(channel));
+    uint8_t status = intr_ok ? busy_wait(hd) : BIT_STAT_BSY;
+    if ((bm_status & BIT_BM_STAT_ERR) || (status & (BIT_STAT_BSY | BIT_STAT_ERR | BIT_STAT_DF))) {
+        outb(reg_bm_status(channel), bm_status | BIT_BM_STAT_ERR | BIT_BM_STAT_INTR);
+        // 出错后本通道不再使用dma,以后都走pio
+        channel->bmide_base = 0;
+        report_error(hd, is_write ? "dma write" : "dma read", lba, status);
+        printk("%s fall back to pio\n", channel->name);
+        return false;
+    }
+    return true;
+}
+
+/* 比较请求req与位置(dev_no, lba)的先后,用于电梯调度 */
+static int32_t req_cmp(struct ide_request* req, uint8_t dev_no, uint32_t lba) {
+    if (req->hd->dev_no != dev_no) return req->hd->dev_no < dev_no ? -1 : 1;
+    if (req->lba != lba) return req->lba < lba ? -1 : 1;
+    return 0;
+}
+
+/* 选出下一个要服务的请求,最早的请求超过期限时先服务它,否则按C-LOOK从磁头位置向后找 */
+static struct ide_request* pick_request(struct ide_channel* channel) {
+    struct ide_request* oldest = elem2entry(struct ide_request, fifo_tag, channel->req_fifo.head.next);
+    if (oldest->deadline <= ticks) return oldest;
+    struct list_elem* elem = channel->req_sorted.head.next;
+    while (elem != &channel->req_sorted.tail) {
+        struct ide_request* req = elem2entry(struct ide_request, sort_tag, elem);
+        if (req_cmp(req, channel->head_dev, channel->head_lba) >= 0) return req;
+        elem = elem->next;
+    }
+    // 磁头之后没有请求了,折回到最小的扇区
+    return elem2entry(struct ide_request, sort_tag, channel->req_sorted.head.next);
+}
+
+/**
+ * @description: 从队列中取出first以及紧随其后、方向相同且扇区连续的请求,合并成一条命令
+ * @param {ide_channel*} channel 通道
+ * @param {ide_request*} first 第一个请求
+ * @param {list*} batch 取出的请求按扇区顺序放入batch
+ * @return {*} 合并后的扇区数
+ */
+static uint32_t collect_batch(struct ide_channel* channel, struct ide_request* first, struct list* batch) {
+    uint32_t sec_cnt = 0;
+    struct ide_request* req = first;
+    while (true) {
+        struct list_elem* next = req->sort_tag.next;
+        list_remove(&req->sort_tag);
+        list_remove(&req->fifo_tag);
+        list_append(batch, &req->sort_tag);
+        sec_cnt += req->sec_cnt;
+        if (next == &channel->req_sorted.tail) break;
+        req = elem2entry(struct ide_request, sort_tag, next);
+        if (req->hd != first->hd || req->is_write != first->is_write || \
+            req->lba != first->lba + sec_cnt || sec_cnt + req->sec_cnt > IDE_MAX_SECTS) {
+            break;
+        }
+    }
+    return sec_cnt;
+}
+
+/* 完成一批请求,有回调函数的调用回调函数,否则唤醒等待者 */
+static void complete_batch(struct list* batch, int32_t status) {
+    while (!list_empty(batch)) {
+        struct ide_request* req = elem2entry(struct ide_request, sort_tag, list_pop(batch));
+        req->status = status;
+        if (req->callback != NULL) {
+            // 回调函数可能会释放请求,之后不能再访问req
+            req->callback(req, req->cb_arg);
         }
         else {
-            secs_op = sec_cnt - secs_done;
+            sema_up(&req->done);
         }
-        // 2 写入待读入的扇区数和起始扇区号
-        select_sector(hd, lba + secs_done, secs_op);
-        // 3 执行的命令写入reg_cmd寄存器
-        cmd_out(hd->my_channel, CMD_READ_SECTOR);
-        // 4 阻塞自己，等待硬盘中断程序唤醒自己
-        sema_down(&hd->my_channel->disk_done);
-        // 5 醒来后，检测硬盘状态是否可读，不可读的话在此输出错误信息
-        if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s read sector %d failed!!!!!!\n", hd->name, lba);
-            PANIC(error);
+    }
+}
+
+/* 通道的工作线程,不断地从队列中取出请求,合并后发给硬盘 */
+static void ide_worker(void* arg) {
+    struct ide_channel* channel = arg;
+    struct list batch;
+    list_init(&batch);
+    while (1) {
+        enum intr_status old_status = intr_disable();
+        // 没有请求或者通道被塞住时阻塞自己,由ide_submit或ide_unplug唤醒
+        while (list_empty(&channel->req_fifo) || channel->plug_cnt > 0) {
+            channel->worker_idle = true;
+            thread_block(TASK_BLOCKED);
         }
-        // 6 把数据从硬盘的缓冲区中读出
-        read_from_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-        secs_done += secs_op;
+        struct ide_request* first = pick_request(channel);
+        uint32_t sec_cnt = collect_batch(channel, first, &batch);
+        intr_set_status(old_status);
+
+        struct disk* hd = first->hd;
+        uint32_t lba = first->lba;
+        bool is_write = first->is_write;
+        // 优先用dma,不支持或失败时用pio
+        int32_t status = 0;
+        select_disk(hd);
+        if (!dma_transfer(hd, lba, sec_cnt, is_write, &batch)) {
+            status = is_write ? pio_write(hd, lba, sec_cnt, &batch) : pio_read(hd, lba, sec_cnt, &batch);
+        }
+        channel->head_dev = hd->dev_no;
+        channel->head_lba = lba + sec_cnt;
+        complete_batch(&batch, status);
     }
+}
+
+/* 唤醒阻塞的工作线程,需要在关中断的情况下调用 */
+static void worker_wakeup(struct ide_channel* channel) {
+    if (channel->worker_idle && channel->plug_cnt == 0) {
+        channel->worker_idle = false;
+        thread_unblock(channel->worker);
+    }
+}
 
-    lock_release(&hd->my_channel->lock);
+/**
+ * @description: 初始化一个读写请求,默认没有回调函数,需要回调时在提交前设置callback和cb_arg
+ * @param {ide_request*} req 请求
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 起始扇区
+ * @param {void*} buf 缓冲区,在请求完成之前必须有效
+ * @param {uint32_t} sec_cnt 扇区数,最多IDE_MAX_SECTS个
+ * @param {bool} is_write 为true时写硬盘
+ * @return {*}
+ */
+void ide_request_init(struct ide_request* req, struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+    req->hd = hd;
+    req->lba = lba;
+    req->sec_cnt = sec_cnt;
+    req->buf = buf;
+    req->is_write = is_write;
+    // 内核空间在所有页表中都一样,只有用户空间的缓冲区需要记下所属的任务
+    req->owner = (uint32_t)buf >= KERNEL_SPACE_START ? NULL : running_thread();
+    req->status = 0;
+    sema_init(&req->done, 0);
+    req->callback = NULL;
+    req->cb_arg = NULL;
 }
 
+/* 将请求放入通道的队列,按(硬盘,扇区)插入排序队列,并追加到提交顺序队列的队尾 */
+void ide_submit(struct ide_request* req) {
+    ASSERT(req->sec_cnt > 0 && req->sec_cnt <= IDE_MAX_SECTS);
+    ASSERT(req->lba + req->sec_cnt - 1 <= max_lba);
+    struct ide_channel* channel = req->hd->my_channel;
+    enum intr_status old_status = intr_disable();
+    req->deadline = ticks + (req->is_write ? IDE_WRITE_EXPIRE : IDE_READ_EXPIRE);
+    struct list_elem* elem = channel->req_sorted.head.next;
+    while (elem != &channel->req_sorted.tail) {
+        struct ide_request* queued = elem2entry(struct ide_request, sort_tag, elem);
+        if (req_cmp(queued, req->hd->dev_no, req->lba) > 0) break;
+        elem = elem->next;
+    }
+    list_insert_before(elem, &req->sort_tag);
+    list_append(&channel->req_fifo, &req->fifo_tag);
+    worker_wakeup(channel);
+    intr_set_status(old_status);
+}
 
-/* 将buf中sec_cnt扇区数据写入硬盘 */
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+/* 等待没有回调函数的请求完成,返回请求的结果 */
+int32_t ide_wait(struct ide_request* req) {
+    ASSERT(req->callback == NULL);
+    sema_down(&req->done);
+    return req->status;
+}
+
+/* 暂停硬盘hd所在通道的请求处理,在ide_unplug之前不能等待请求完成,否则会死锁 */
+void ide_plug(struct disk* hd) {
+    enum intr_status old_status = intr_disable();
+    hd->my_channel->plug_cnt++;
+    intr_set_status(old_status);
+}
+
+/* 恢复请求处理,把攒下的请求一起交给工作线程 */
+void ide_unplug(struct disk* hd) {
+    struct ide_channel* channel = hd->my_channel;
+    enum intr_status old_status = intr_disable();
+    ASSERT(channel->plug_cnt > 0);
+    channel->plug_cnt--;
+    if (!list_empty(&channel->req_fifo)) worker_wakeup(channel);
+    intr_set_status(old_status);
+}
+
+/* 同步读写,超过256个扇区时拆成多个请求 */
+static int32_t ide_rw(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
     ASSERT(lba <= max_lba);
     ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
-
-    // 1 先选择操作的硬盘
-    select_disk(hd);
+    struct ide_request req;
     uint32_t secs_op;		 // 每次操作的扇区数
     uint32_t secs_done = 0;	 // 已完成的扇区数
     while (secs_done < sec_cnt) {
-        // 每次写入的扇区数，最大256
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
-        }
-        else {
-            secs_op = sec_cnt - secs_done;
-        }
-
-        // 2 写入待写入的扇区数和起始扇区号
-        select_sector(hd, lba + secs_done, secs_op);
-        // 3 执行的命令写入reg_cmd寄存器
-        cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
-        // 4 检测硬盘状态是否可读 
-        if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s write sector %d failed!!!!!!\n", hd->name, lba);
-            PANIC(error);
-        }
-
-        // 5 将数据写入硬盘
-        write2sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-        // 6 在硬盘响应期间阻塞自己
-        sema_down(&hd->my_channel->disk_done);
-        // 7 醒来后执行下一次的写入，或者结束，释放锁
+        secs_op = sec_cnt - secs_done < IDE_MAX_SECTS ? sec_cnt - secs_done : IDE_MAX_SECTS;
+        ide_request_init(&req, hd, lba + secs_done, (void*)((uint32_t)buf + secs_done * SEC_BIT), secs_op, is_write);
+        ide_submit(&req);
+        if (ide_wait(&req) != 0) return -1;
         secs_done += secs_op;
     }
-    lock_release(&hd->my_channel->lock);
+    return 0;
+}
+
+/* 从硬盘读取sec_cnt个扇区到buf,成功返回0,失败返回-1 */
+int32_t ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    return ide_rw(hd, lba, buf, sec_cnt, false);
+}
+
+/* 将buf中sec_cnt扇区数据写入硬盘,成功返回0,失败返回-1 */
+int32_t ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    return ide_rw(hd, lba, buf, sec_cnt, true);
 }
 
 /* 硬盘中断处理程序 */
@@ -204,6 +511,11 @@ static void intr_hd_handler(uint8_t irq_no) {
         sema_up(&channel->disk_done);
         // 读取状态寄存器使硬盘控制器认为此次的中断已被处理,从而硬盘可以继续执行新的读写
         inb(reg_status(channel));
+        // 支持dma时还要清除总线主控的中断标志,错误标志留给dma_transfer检查
+        if (channel->bmide_base != 0) {
+            uint8_t bm_status = inb(reg_bm_status(channel));
+            outb(reg_bm_status(channel), (bm_status & ~BIT_BM_STAT_ERR) | BIT_BM_STAT_INTR);
+        }
     }
 }
 
@@ -219,20 +531,19 @@ static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
     buf[idx] = '\0';
 }
 
-/* 获得硬盘参数信息 */
-static void identify_disk(struct disk* hd) {
+/* 获得硬盘参数信息,硬盘不存在或出错返回false */
+static bool identify_disk(struct disk* hd) {
     char id_info[512];
     select_disk(hd);
     cmd_out(hd->my_channel, CMD_IDENTIFY);
     // 向硬盘发送指令后便通过信号量阻塞自己,待硬盘处理完成后,通过中断处理程序将自己唤醒
-    sema_down(&hd->my_channel->disk_done);
+    if (!wait_intr(hd->my_channel)) {
+        report_error(hd, "identify", 0, inb(reg_alt_status(hd->my_channel)) | BIT_STAT_BSY);
+        return false;
+    }
 
     // 醒来后开始执行下面代码
-    if (!busy_wait(hd)) {
-        char error[64];
-        sprintf(error, "%s identify failed!!!!!!\n", hd->name);
-        PANIC(error);
-    }
+    if (!check_status(hd, "identify", 0, true)) return false;
     read_from_sector(hd, id_info, 1);
 
     char buf[64];
@@ -249,6 +560,7 @@ static void identify_disk(struct disk* hd) {
     uint32_t sectors = *(uint32_t*)&id_info[60 * 2];
     printk("      SECTORS: %d\n", sectors);
     printk("      CAPACITY: %dMB\n", sectors / 2 / 1024);
+    return true;
 }
 
 /* 扫描硬盘hd中地址为ext_lba的扇区中的所有分区 */
@@ -256,7 +568,10 @@ static void partition_scan(struct disk* hd, uint32_t ext_lba) {
     // 引导扇区结构
     struct boot_sector* bs = sys_malloc(sizeof(struct boot_sector));
     // 读入引导扇区
-    ide_read(hd, ext_lba, bs, 1);
+    if (ide_read(hd, ext_lba, bs, 1) != 0) {
+        sys_free(bs);
+        return;
+    }
     // 指向四个主分区
     struct partition_table_entry* p = bs->partition_table;
     // 遍历分区表4个分区表项
@@ -312,6 +627,22 @@ static bool partition_info(struct list_elem* pelem, int arg UNUSED) {
     return false;
 }
 
+/* 查找pci总线上的ide控制器,返回总线主控寄存器的起始端口号,不支持dma时返回0 */
+static uint16_t bmide_probe(void) {
+    struct pci_device pdev;
+    // 类别0x01是大容量存储控制器,子类别0x01是ide控制器
+    if (!pci_find_class(0x01, 0x01, &pdev)) return 0;
+    // 编程接口第7位为1表示支持总线主控
+    if (!((pci_read(&pdev, PCI_CLASS) >> 8) & 0x80)) return 0;
+    // bar4是总线主控寄存器的基址,最低位为1表示在io空间
+    uint32_t bar4 = pci_read(&pdev, PCI_BAR4);
+    if (!(bar4 & 0x1)) return 0;
+    // 允许控制器访问io空间并成为总线主控
+    uint32_t cmd = pci_read(&pdev, PCI_COMMAND);
+    pci_write(&pdev, PCI_COMMAND, cmd | PCI_CMD_IO | PCI_CMD_MASTER);
+    return bar4 & 0xfffc;
+}
+
 /* 硬盘数据结构初始化 */
 void ide_init() {
     printk("ide_init begin!\n");
@@ -323,6 +654,8 @@ void ide_init() {
     list_init(&partition_list);
     // 一个ide通道上有两个硬盘,根据硬盘数量反推有几个ide通道
     channel_cnt = DIV_ROUND_UP(hd_cnt, 2);
+    // 探测总线主控dma,两个通道的寄存器各占8个端口
+    uint16_t bmide_base = bmide_probe();
     // 分别处理每个通道上的硬盘
     for (uint8_t channel_no = 0; channel_no < channel_cnt; channel_no++) {
         // 指针指向不同的通道
@@ -339,12 +672,28 @@ void ide_init() {
             channel->irq_no = 0x20 + 15;  // 从8259A上的最后一个中断引脚,我们用来响应ide1通道上的硬盘中断
         }
         channel->expecting_intr = false;  // 未向硬盘写入指令时不期待硬盘的中断
-        // 初始化通道锁
-        lock_init(&channel->lock);
+        // 初始化请求队列,工作线程在下面识别硬盘之前启动,分区扫描就要经过它
+        list_init(&channel->req_sorted);
+        list_init(&channel->req_fifo);
+        channel->plug_cnt = 0;
+        channel->head_dev = 0;
+        channel->head_lba = 0;
+        channel->worker_idle = false;
         // 信号量初始化为0，目的是向硬盘发送控制字后就阻塞当前线程
         sema_init(&channel->disk_done, 0);
+        // 每个通道一页prd表,申请不到就只用pio
+        channel->bmide_base = 0;
+        if (bmide_base != 0) {
+            channel->prdt = get_kernel_pages(1);
+            if (channel->prdt != NULL) {
+                channel->prdt_phy = addr_v2p((uint32_t)channel->prdt);
+                channel->bmide_base = bmide_base + channel_no * 8;
+                printk("   %s dma enabled, bus master port 0x%x\n", channel->name, channel->bmide_base);
+            }
+        }
         // 注册硬盘中断
         register_handler(channel->irq_no, intr_hd_handler);
+        channel->worker = thread_start(channel->name, ide_worker, channel);
         // 分别获得两个硬盘的参数及分区信息
         for (uint8_t dev_no = 0; dev_no < 2; dev_no++) {
             // 拿到硬盘指针
@@ -355,10 +704,10 @@ void ide_init() {
             hd->dev_no = dev_no;
             // 硬盘名字
             sprintf(hd->name, "sd%c", 'a' + channel_no * 2 + dev_no);
-            // 获取硬盘参数
-            identify_disk(hd);
+            // 获取硬盘参数,获取失败的硬盘不再扫描分区
+            bool present = identify_disk(hd);
             // 扫描分区表，跳过我们存放内核的硬盘
-            if (dev_no != 0) {
+            if (dev_no != 0 && present) {
                 memset(hd->prim_parts, 0, 4 * sizeof(struct partition));
                 memset(hd->logic_parts, 0, 8 * sizeof(struct partition));
                 partition_scan(hd, 0);
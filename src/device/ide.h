@@ -18,10 +18,26 @@
 #define reg_alt_status(channel) (channel->port_base + 0x206)
 #define reg_ctl(channel)	    (reg_alt_status(channel))
 
+/* 总线主控dma寄存器的端口号,每个通道8个端口 */
+#define reg_bm_cmd(channel)     (channel->bmide_base + 0)
+#define reg_bm_status(channel)  (channel->bmide_base + 2)
+#define reg_bm_prdt(channel)    (channel->bmide_base + 4)
+
 /* reg_alt_status寄存器的一些关键位 */
 #define BIT_STAT_BSY	 0x80	      // 硬盘忙
 #define BIT_STAT_DRDY	 0x40	      // 驱动器准备好	 
+#define BIT_STAT_DF	 0x20	      // 驱动器故障
 #define BIT_STAT_DRQ	 0x8	      // 数据传输准备好了
+#define BIT_STAT_ERR	 0x1	      // 上一条命令出错
+
+/* 总线主控命令寄存器的关键位 */
+#define BIT_BM_CMD_START 0x1          // 开始dma传输
+#define BIT_BM_CMD_READ  0x8          // 为1时dma方向是硬盘到内存,即读硬盘
+
+/* 总线主控状态寄存器的关键位 */
+#define BIT_BM_STAT_ACTIVE 0x1        // dma传输进行中
+#define BIT_BM_STAT_ERR    0x2        // dma传输出错,写1清零
+#define BIT_BM_STAT_INTR   0x4        // 硬盘发出了中断,写1清零
 
 /* device寄存器的一些关键位 */
 #define BIT_DEV_MBS	0xa0	          // 第7位和第5位固定为1
@@ -33,13 +49,39 @@
 #define CMD_IDENTIFY	   0xec	      // identify指令
 #define CMD_READ_SECTOR	   0x20       // 读扇区指令
 #define CMD_WRITE_SECTOR   0x30	      // 写扇区指令
+#define CMD_READ_DMA       0xc8       // dma读扇区指令
+#define CMD_WRITE_DMA      0xca       // dma写扇区指令
 
 /* 定义可读写的最大扇区数,调试用的 */
 #define max_lba ((100*1024*1024/512) - 1)
 
+/* 等待硬盘时先紧凑轮询状态寄存器的次数,每次读端口约1微秒 */
+#define IDE_SPIN_CNT 1000
+/* 紧凑轮询后硬盘仍然忙时,每次睡眠的微秒数 */
+#define IDE_POLL_US 1000
+/* 等待硬盘的超时时间,100Hz时钟下为3秒 */
+#define IDE_TIMEOUT_TICKS 300
+
+/* 一条命令最多读写的扇区数 */
+#define IDE_MAX_SECTS 256
+/* 读请求和写请求的最长等待时间,超过后优先服务,读请求有进程在等,期限短一些 */
+#define IDE_READ_EXPIRE  50
+#define IDE_WRITE_EXPIRE 500
+
 /* 一个扇区多少字节 */
 #define SEC_BIT 512
 
+/* prd表项,描述一段物理内存,不能跨越64KB边界 */
+struct prd_entry {
+    uint32_t phy_addr;          // 物理地址,必须2字节对齐
+    uint16_t byte_cnt;          // 字节数,为0表示64KB
+    uint16_t flag;              // 最高位为1表示这是最后一项
+} __attribute__((packed));
+
+#define PRD_EOT       0x8000    // prd表的最后一项
+#define PRD_MAX_BYTES 0x10000   // 每项最多64KB
+#define PRD_CNT       (4096 / sizeof(struct prd_entry))   // 一页能放的prd表项数
+
 /* 分区结构 */
 struct partition {
     uint32_t start_lba;		    // 起始扇区
@@ -50,7 +92,12 @@ struct partition {
     struct super_block* sb;	    // 本分区的超级块
     struct bitmap block_bitmap;	// 块位图
     struct bitmap inode_bitmap;	// i结点位图
-    struct list open_inodes;	// 本分区打开的i结点队列
+    struct bitmap block_bitmap_dirty;  // 块位图中待写回硬盘的扇区,每位对应位图的一个扇区
+    struct bitmap inode_bitmap_dirty;  // i结点位图中待写回硬盘的扇区
+    uint32_t bitmap_dirty_sects;       // 两个位图中待写回硬盘的扇区数
+    struct inode_table* itable; // 本分区在内存中的inode表
+    struct journal* journal;    // 本分区的元数据日志
+    struct lock meta_lock;      // 修改元数据的操作之间、操作与后台刷新之间互斥
 };
 
 /* 硬盘结构 */
@@ -62,14 +109,44 @@ struct disk {
     struct partition logic_parts[8]; // 逻辑分区数量无限,但总得有个支持的上限,那就支持8个
 };
 
+struct ide_request;
+/* 请求完成后的回调函数,在通道的工作线程中调用 */
+typedef void ide_callback(struct ide_request* req, void* arg);
+
+/* 硬盘读写请求,由提交者分配,完成之前不能释放 */
+struct ide_request {
+    struct disk* hd;                // 读写的硬盘
+    uint32_t lba;                   // 起始扇区
+    uint32_t sec_cnt;               // 扇区数,最多IDE_MAX_SECTS个
+    void* buf;                      // 缓冲区
+    bool is_write;                  // 为true时写硬盘
+    struct task_struct* owner;      // 缓冲区在用户空间时为提交请求的任务,在内核空间时为NULL
+    int32_t status;                 // 完成后的结果,成功为0,失败为-1
+    struct semaphore done;          // 没有回调函数时,完成后up此信号量
+    ide_callback* callback;         // 完成后的回调函数,为NULL时用ide_wait等待
+    void* cb_arg;                   // 回调函数的参数
+    uint64_t deadline;              // 最晚开始服务的时刻
+    struct list_elem sort_tag;      // 在按扇区排序的队列中的节点
+    struct list_elem fifo_tag;      // 在按提交顺序排列的队列中的节点
+};
+
 /* ata通道结构 */
 struct ide_channel {
     char name[8];	    	    // 本ata通道名称 
     uint16_t port_base;		    // 本通道的起始端口号
     uint8_t irq_no;		        // 本通道所用的中断号
-    struct lock lock;		    // 通道锁
     bool expecting_intr;		// 表示等待硬盘的中断
     struct semaphore disk_done;	// 用于阻塞、唤醒驱动程序
+    uint16_t bmide_base;        // 总线主控寄存器起始端口号,为0表示不支持dma
+    struct prd_entry* prdt;     // 本通道的prd表,占一页
+    uint32_t prdt_phy;          // prd表的物理地址
+    struct list req_sorted;     // 待处理的请求,按(硬盘,扇区)升序排列
+    struct list req_fifo;       // 待处理的请求,按提交顺序排列
+    struct task_struct* worker; // 处理本通道请求的内核线程
+    bool worker_idle;           // 工作线程因为没有请求而阻塞
+    uint32_t plug_cnt;          // 大于0时暂不处理请求,让请求攒起来合并
+    uint8_t head_dev;           // 上一次读写结束的位置,电梯调度从这里继续
+    uint32_t head_lba;
     struct disk devices[2];	    // 一个通道上连接两个硬盘，一主一从
 };
 
@@ -80,9 +157,19 @@ extern struct list partition_list;
 
 /* ide硬盘初始化 */
 void ide_init(void);
-/* 硬盘hd的lba起始扇区，读取sec_cnt个扇区到buf */
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
-/* 将buf中sec_cnt扇区数据写入硬盘 */
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+/* 硬盘hd的lba起始扇区，读取sec_cnt个扇区到buf,成功返回0,失败返回-1 */
+int32_t ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+/* 将buf中sec_cnt扇区数据写入硬盘,成功返回0,失败返回-1 */
+int32_t ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+/* 初始化一个读写请求 */
+void ide_request_init(struct ide_request* req, struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write);
+/* 提交请求,不等待完成 */
+void ide_submit(struct ide_request* req);
+/* 等待没有回调函数的请求完成,返回请求的结果 */
+int32_t ide_wait(struct ide_request* req);
+/* 暂停硬盘hd所在通道的请求处理,让后续提交的请求攒起来 */
+void ide_plug(struct disk* hd);
+/* 恢复请求处理 */
+void ide_unplug(struct disk* hd);
 
 #endif
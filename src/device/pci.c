@@ -0,0 +1,54 @@
+#include "pci.h"
+#include "io.h"
+#include "stdin.h"
+
+/* 向地址端口写入的配置空间地址,第31位为使能位 */
+static uint32_t pci_config_addr(struct pci_device* pdev, uint8_t offset) {
+    return 0x80000000 | ((uint32_t)pdev->bus << 16) | ((uint32_t)pdev->dev << 11) | \
+        ((uint32_t)pdev->func << 8) | (offset & 0xfc);
+}
+
+/* 读取pci设备配置空间offset处的双字 */
+uint32_t pci_read(struct pci_device* pdev, uint8_t offset) {
+    outl(PCI_CONFIG_ADDR, pci_config_addr(pdev, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+/* 向pci设备配置空间offset处写入双字 */
+void pci_write(struct pci_device* pdev, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDR, pci_config_addr(pdev, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+/**
+ * @description: 暴力枚举所有总线上的设备,查找类别为class,子类别为subclass的第一个设备
+ * @param {uint8_t} class 类别,如0x01为大容量存储控制器
+ * @param {uint8_t} subclass 子类别,如0x01为ide控制器
+ * @param {pci_device*} pdev 找到的设备位置存入pdev
+ * @return {*} 找到返回true,否则返回false
+ */
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_device* pdev) {
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t dev = 0; dev < 32; dev++) {
+            for (uint8_t func = 0; func < 8; func++) {
+                pdev->bus = bus;
+                pdev->dev = dev;
+                pdev->func = func;
+                uint32_t id = pci_read(pdev, PCI_VENDOR_ID);
+                // 厂商号为0xffff表示设备不存在
+                if ((id & 0xffff) == 0xffff) {
+                    // 功能0都不存在时,其它功能也不会存在
+                    if (func == 0) break;
+                    continue;
+                }
+                uint32_t class_reg = pci_read(pdev, PCI_CLASS);
+                if ((class_reg >> 24) == class && ((class_reg >> 16) & 0xff) == subclass) {
+                    return true;
+                }
+                // 不是多功能设备就不用再查其它功能了
+                if (func == 0 && !((pci_read(pdev, PCI_HEADER_TYPE) >> 16) & 0x80)) break;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,35 @@
+#ifndef __DEVICE_PCI_H
+#define __DEVICE_PCI_H
+
+#include "stdin.h"
+
+#define PCI_CONFIG_ADDR   0xcf8     // 配置空间地址端口
+#define PCI_CONFIG_DATA   0xcfc     // 配置空间数据端口
+
+/* 配置空间中常用寄存器的偏移 */
+#define PCI_VENDOR_ID     0x00      // 厂商号,低16位,高16位是设备号
+#define PCI_COMMAND       0x04      // 命令寄存器,低16位,高16位是状态寄存器
+#define PCI_CLASS         0x08      // 最高字节是类别,次高字节是子类别,再次是编程接口
+#define PCI_HEADER_TYPE   0x0c      // 第2字节是头类型
+#define PCI_BAR0          0x10      // 第0个基址寄存器,共6个,每个4字节
+#define PCI_BAR4          0x20      // 第4个基址寄存器
+
+/* 命令寄存器的一些关键位 */
+#define PCI_CMD_IO        0x1       // 允许访问io空间
+#define PCI_CMD_MASTER    0x4       // 允许设备成为总线主控,DMA需要
+
+/* 一个pci设备的位置 */
+struct pci_device {
+    uint8_t bus;                    // 总线号
+    uint8_t dev;                    // 设备号
+    uint8_t func;                   // 功能号
+};
+
+/* 读取pci设备配置空间offset处的双字 */
+uint32_t pci_read(struct pci_device* pdev, uint8_t offset);
+/* 向pci设备配置空间offset处写入双字 */
+void pci_write(struct pci_device* pdev, uint8_t offset, uint32_t value);
+/* 查找类别为class,子类别为subclass的第一个设备,找到返回true */
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_device* pdev);
+
+#endif
@@ -6,18 +6,36 @@
 #include "stdin.h"
 #include "print.h"
 #include "interrupt.h"
+#include "list.h"
+#include "math.h"
 
-#define IRQ0_FREQUENCY     100               // IR0需要的频率
 #define INPUT_FREQUENCY    1193180           // 8253的输入频率
-#define COUNTER0_VALUE     INPUT_FREQUENCY / IRQ0_FREQUENCY 
+#define COUNTER0_VALUE     (INPUT_FREQUENCY / IRQ0_FREQUENCY)
 #define CONTRER0_PORT      0x40              // 计数器0的端口
 #define CONTRER0_NO        0                 // 选择计数器0
 #define CONTRER0_MODE      2                 // 选择工作模式2,比率发生器，即分频
+#define CONTRER0_ONESHOT   0                 // 工作模式0,计数到0时中断一次
 #define CONTRER0_RWL       3                 // 读写方式位先读写低字节再读写高字节
 #define COUNTER0_BCD       0                 // 采用二进制方式
 #define PIT_CONTROL_PORT   0x43              // 控制端口
+#define PIT_READ_BACK      0xc2              // 回读命令,锁存计数器0的状态和计数值
+#define PIT_STATUS_OUT     0x80              // 状态字节中的输出引脚电平
+#define PIT_STATUS_NULL    0x40              // 状态字节中的计数值还没装入计数器
+#define PIC_M_CTRL         0x20              // 8259A主片的控制端口
+#define PIC_READ_IRR       0x0a              // OCW3,接下来从控制端口读出中断请求寄存器
+#define PIT_RELOAD_SLACK   64                // 回读后再看中断请求期间计数器最多走过的计数
 
-#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
+// 一个计数约838纳秒,换算时只用32位乘除
+#define PIT_COUNTS_MAX     0xffff
+#define pit_counts_to_us(counts) ((counts) * 838 / 1000)
+#define pit_us_to_counts(us)     ((us) * 1193 / 1000)
+
+// 分层时间轮,每层64个槽,第0层一个槽一个嘀嗒,上一层一个槽是下一层转一圈,5层共2^30个嘀嗒
+#define WHEEL_BITS         6
+#define WHEEL_SIZE         (1 << WHEEL_BITS)
+#define WHEEL_MASK         (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS       5
+#define WHEEL_RANGE        (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
 
 /**********************
 @author: liyajun
@@ -26,13 +44,282 @@
 ***********************/
 uint64_t ticks;
 
+/* 分层时间轮,定时器按到期的嘀嗒挂在槽中,加入和取消都是O(1) */
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_tick;       // 时间轮下一个要处理的嘀嗒
+/* 用utime_sleep睡眠的任务,只是给general_tag一个去处,由超时定时器唤醒 */
+static struct list sleep_list;
+
+static uint64_t clock_us;         // 到上一次时钟中断或者上一次切换定时方式为止的微秒数
+static uint32_t tick_frac_us;     // clock_us中还不够一个嘀嗒的部分
+static bool nohz_active;          // idle停掉了周期中断
+static bool oneshot_active;       // 时钟中断源处在单次定时方式,idle期间或者两个嘀嗒之间有定时器到期时
+static uint64_t next_tick_us;     // 下一个嘀嗒的时刻,到了才计时间片
+static uint64_t next_event_us;    // 下一次时钟中断的时刻
+static bool timer_in_irq;         // 时钟中断正在处理时间轮,返回前会统一重设中断源
+static uint64_t last_now_us;      // timer_now_us上一次返回的值
+
+/* 控制字写到控制端口,计数值写到计数器端口 */
 static void frequency_set(uint8_t counter_port, uint8_t counter_no, uint8_t counter_rwl, \
     uint8_t counter_mode, uint8_t counter_bcd, uint16_t counter_value) {
-    outb(counter_port, (uint8_t)(counter_no << 6 | counter_rwl << 4 | counter_mode << 1 | counter_bcd));
+    outb(PIT_CONTROL_PORT, (uint8_t)(counter_no << 6 | counter_rwl << 4 | counter_mode << 1 | counter_bcd));
     outb(counter_port, (uint8_t)counter_value);
     outb(counter_port, (uint8_t)(counter_value >> 8));
 }
 
+static uint32_t pit_oneshot_counts;   // 单次定时设定的计数值,0表示处在周期方式
+
+/* 8253计数器0按IRQ0_FREQUENCY周期中断 */
+static void pit_set_periodic(void) {
+    frequency_set(CONTRER0_PORT, CONTRER0_NO, CONTRER0_RWL, CONTRER0_MODE, COUNTER0_BCD, COUNTER0_VALUE);
+    pit_oneshot_counts = 0;
+}
+
+/* 8253计数器0在delta_us微秒后中断一次 */
+static void pit_set_oneshot(uint32_t delta_us) {
+    uint32_t counts = pit_us_to_counts(delta_us);
+    if (counts == 0) counts = 1;
+    if (counts > PIT_COUNTS_MAX) counts = PIT_COUNTS_MAX;
+    frequency_set(CONTRER0_PORT, CONTRER0_NO, CONTRER0_RWL, CONTRER0_ONESHOT, COUNTER0_BCD, counts);
+    pit_oneshot_counts = counts;
+}
+
+/* 回读计数器0,算出从上一次周期中断或者设定单次定时起过去的微秒数 */
+static uint32_t pit_elapsed_us(void) {
+    outb(PIT_CONTROL_PORT, PIT_READ_BACK);
+    uint8_t status = inb(CONTRER0_PORT);
+    uint32_t count = inb(CONTRER0_PORT);
+    count |= (uint32_t)inb(CONTRER0_PORT) << 8;
+    if (pit_oneshot_counts == 0) {
+        uint32_t us = count > COUNTER0_VALUE ? 0 : pit_counts_to_us(COUNTER0_VALUE - count);
+        // 关中断期间计数器已经重新装入,这个嘀嗒的中断还挂着没处理,clock_us少算了一个嘀嗒.
+        // 计数值还很小说明是回读之后才装入的,回读到的还是上一个周期
+        outb(PIC_M_CTRL, PIC_READ_IRR);
+        if ((inb(PIC_M_CTRL) & 0x1) && count > PIT_RELOAD_SLACK) us += TICK_US;
+        return us;
+    }
+    if (status & PIT_STATUS_NULL) return 0;
+    // 输出已经变高说明已经到时,之后计数器从0回绕到0xffff接着减,不到一圈时还能算出超过了多少
+    if ((status & PIT_STATUS_OUT) || count > pit_oneshot_counts) {
+        return pit_counts_to_us(pit_oneshot_counts + ((0x10000 - count) & PIT_COUNTS_MAX));
+    }
+    return pit_counts_to_us(pit_oneshot_counts - count);
+}
+
+static struct clock_event_device pit_clockevent = {
+    .name = "pit",
+    .max_delta_us = pit_counts_to_us(PIT_COUNTS_MAX),
+    .set_periodic = pit_set_periodic,
+    .set_oneshot = pit_set_oneshot,
+    .elapsed_us = pit_elapsed_us,
+};
+
+/* 当前使用的时钟中断源,以后有了local apic或者hpet换掉这里就行 */
+static struct clock_event_device* clockevent = &pit_clockevent;
+
+/* 时钟前进us微秒,满一个嘀嗒ticks加1 */
+static void timer_advance(uint32_t us) {
+    clock_us += us;
+    tick_frac_us += us;
+    while (tick_frac_us >= TICK_US) {
+        tick_frac_us -= TICK_US;
+        ticks++;
+    }
+}
+
+/**
+ * @description: 开机以来的微秒数,精度取决于时钟中断源,8253约为1微秒
+ * @return {*}
+ */
+uint64_t timer_now_us(void) {
+    enum intr_status old_status = intr_disable();
+    uint64_t now = clock_us + clockevent->elapsed_us();
+    // 回读和中断请求之间的竞争只会让某一次多算或者少算,不能让时间倒退
+    if (now < last_now_us) now = last_now_us;
+    last_now_us = now;
+    intr_set_status(old_status);
+    return now;
+}
+
+/* 把定时器挂到时间轮上,到期的嘀嗒向上取整,离得越远挂的层越高,超出范围的先挂在最远处 */
+static void timer_enqueue(struct timer* timer) {
+    uint32_t rem;
+    uint64_t tick = div_u64_rem(timer->expires + TICK_US - 1, TICK_US, &rem);
+    if (tick < wheel_tick) tick = wheel_tick;
+    if (tick - wheel_tick >= WHEEL_RANGE) tick = wheel_tick + WHEEL_RANGE - 1;
+    uint64_t delta = tick - wheel_tick;
+    uint32_t level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1)))) level++;
+    uint32_t idx = (uint32_t)(tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    list_append(&wheel[level][idx], &timer->timer_tag);
+    timer->pending = true;
+}
+
+/* 第0层转完一圈时,把上面各层当前槽中的定时器按剩下的时间重新挂到下面的层 */
+static void timer_cascade(void) {
+    for (uint32_t level = 1; level < WHEEL_LEVELS; level++) {
+        uint32_t idx = (uint32_t)(wheel_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        struct list* slot = &wheel[level][idx];
+        while (!list_empty(slot)) {
+            timer_enqueue(elem2entry(struct timer, timer_tag, list_pop(slot)));
+        }
+        // 这一层还没转完一圈,更上面的层不用动
+        if (idx != 0) break;
+    }
+}
+
+/* 处理第0层的一个槽,先整个摘下来,到期的调用回调函数,还没到的重新挂上 */
+static void timer_slot_expire(struct list* slot) {
+    struct list expired;
+    list_init(&expired);
+    while (!list_empty(slot)) {
+        list_append(&expired, list_pop(slot));
+    }
+    // 回调函数可能加入或取消别的定时器,每次只摘一个
+    while (!list_empty(&expired)) {
+        struct timer* timer = elem2entry(struct timer, timer_tag, list_pop(&expired));
+        if (timer->expires > clock_us) {
+            timer_enqueue(timer);
+            continue;
+        }
+        timer->pending = false;
+        timer->func(timer->arg);
+    }
+}
+
+/* 在时钟中断中推进时间轮,处理到当前嘀嗒为止的槽 */
+static void timer_wheel_run(void) {
+    while (wheel_tick <= ticks) {
+        if ((wheel_tick & WHEEL_MASK) == 0) timer_cascade();
+        timer_slot_expire(&wheel[0][wheel_tick & WHEEL_MASK]);
+        wheel_tick++;
+    }
+    // 单次定时是按微秒定的,下一个嘀嗒的槽中可能已经有到期的
+    timer_slot_expire(&wheel[0][wheel_tick & WHEEL_MASK]);
+}
+
+/* 时间轮上在limit之前最早的到期时刻,没有返回limit.上层的定时器要等第0层转完一圈才迁移下来,最晚在那时就要处理 */
+static uint64_t timer_wheel_next(uint64_t limit) {
+    uint64_t cascade_tick = (wheel_tick | WHEEL_MASK) + 1;
+    if (cascade_tick * TICK_US < limit) limit = cascade_tick * TICK_US;
+    for (uint64_t tick = wheel_tick; tick < cascade_tick && tick * TICK_US < limit + TICK_US; tick++) {
+        struct list* slot = &wheel[0][tick & WHEEL_MASK];
+        struct list_elem* elem = slot->head.next;
+        while (elem != &slot->tail) {
+            struct timer* timer = elem2entry(struct timer, timer_tag, elem);
+            if (timer->expires < limit) limit = timer->expires;
+            elem = elem->next;
+        }
+    }
+    return limit;
+}
+
+/* 回到周期方式,从现在起每个嘀嗒中断一次,需要关中断 */
+static void timer_set_periodic(void) {
+    clockevent->set_periodic();
+    oneshot_active = false;
+    next_tick_us = clock_us + TICK_US;
+    next_event_us = next_tick_us;
+}
+
+/**
+ * @description: 按时间轮上最近的到期时刻设定下一次时钟中断,需要关中断.调用前clock_us要已经补到现在,
+ *               单次定时方式下补完要马上调用,否则重设之前过去的时间会被再算一次.idle期间只看定时器,
+ *               否则下一次中断不晚于下一个嘀嗒,两个嘀嗒之间有定时器到期时改用单次定时,到嘀嗒时再由时钟中断切回周期方式
+ * @return {*}
+ */
+static void timer_program(void) {
+    uint64_t limit = nohz_active ? clock_us + clockevent->max_delta_us : next_tick_us;
+    uint64_t next = timer_wheel_next(limit);
+    // 嘀嗒之前没有要到期的,周期方式下什么都不用做.单次定时方式就定到嘀嗒,时间片照常按嘀嗒计
+    if (!nohz_active && !oneshot_active && next >= next_tick_us) {
+        next_event_us = next_tick_us;
+        return;
+    }
+    clockevent->set_oneshot(next <= clock_us ? 0 : (uint32_t)(next - clock_us));
+    oneshot_active = true;
+    next_event_us = next;
+}
+
+/**
+ * @description: 设置定时器到期时调用的函数,定时器使用前要先调用一次
+ * @param {timer*} timer 定时器
+ * @param {void*} func 到期时在时钟中断中调用的函数,不能阻塞
+ * @param {void*} arg 传给func的参数
+ * @return {*}
+ */
+void timer_setup(struct timer* timer, void (*func)(void*), void* arg) {
+    timer->func = func;
+    timer->arg = arg;
+    timer->pending = false;
+}
+
+/**
+ * @description: 让定时器在expires时刻到期,已经在等待的先摘下来再按新的时刻挂上.比下一次时钟中断还早的,
+ *               马上改成在expires时刻单次定时,忙的时候也能按微秒到期
+ * @param {timer*} timer 定时器
+ * @param {uint64_t} expires 到期时刻,开机以来的微秒数,已经过去的在下一次时钟中断时到期
+ * @return {*}
+ */
+void timer_add(struct timer* timer, uint64_t expires) {
+    enum intr_status old_status = intr_disable();
+    if (timer->pending) list_remove(&timer->timer_tag);
+    timer->expires = expires;
+    timer_enqueue(timer);
+    // 时钟中断里加的定时器等中断返回前一起设定
+    if (!timer_in_irq && expires < next_event_us) {
+        timer_advance(clockevent->elapsed_us());
+        timer_program();
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @description: 取消定时器,回调函数不会再被调用
+ * @param {timer*} timer 定时器
+ * @return {*} 取消时还在等待返回true,已经到期或者没有加入返回false
+ */
+bool timer_cancel(struct timer* timer) {
+    enum intr_status old_status = intr_disable();
+    bool pending = timer->pending;
+    if (pending) {
+        list_remove(&timer->timer_tag);
+        timer->pending = false;
+    }
+    intr_set_status(old_status);
+    return pending;
+}
+
+/* 超时定时器到期,唤醒还在阻塞的任务,将它从原来的等待队列中摘下 */
+static void timer_timeout_fn(void* arg) {
+    struct task_struct* task = arg;
+    // 已经被正常唤醒的任务不用再管
+    if (task->status == TASK_BLOCKED) {
+        list_remove(&task->general_tag);
+        task->timed_out = true;
+        thread_unblock(task);
+    }
+}
+
+/**
+ * @description: 给即将阻塞的任务设好超时定时器,需要在关中断的情况下调用
+ * @param {task_struct*} pthread 即将阻塞的任务,它的general_tag在某个等待队列中
+ * @param {uint64_t} wakeup_us 最晚唤醒时刻,开机以来的微秒数
+ * @return {*}
+ */
+void timer_timeout_add(struct task_struct* pthread, uint64_t wakeup_us) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    pthread->timed_out = false;
+    timer_setup(&pthread->timeout_timer, timer_timeout_fn, pthread);
+    timer_add(&pthread->timeout_timer, wakeup_us);
+}
+
+/* 取消任务的超时定时器,需要在关中断的情况下调用 */
+void timer_timeout_del(struct task_struct* pthread) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    timer_cancel(&pthread->timeout_timer);
+}
+
 /**********************
 @author: liyajun
 @data: 2024.3.21 20：20
@@ -43,10 +330,30 @@ static void intr_timer_handler(void) {
     struct task_struct* cur_thread = running_thread();
     // 检查栈是否溢出
     ASSERT(cur_thread->stack_magic == PCB_MAGIC);
+    // 单次定时方式下补上从设定起过去的时间,周期方式下正好过去一个嘀嗒
+    timer_advance(oneshot_active ? clockevent->elapsed_us() : TICK_US);
+    // 处理到期的定时器
+    timer_in_irq = true;
+    timer_wheel_run();
+    timer_in_irq = false;
+    // idle设定的单次定时到了,恢复周期中断,不计时间片,idle醒来后自己去调度
+    if (nohz_active) {
+        nohz_active = false;
+        timer_set_periodic();
+        timer_program();
+        return;
+    }
+    // 只是嘀嗒之间的定时器到期,还没到嘀嗒不计时间片
+    bool tick = clock_us >= next_tick_us;
+    if (tick) {
+        // 单次定时方式下到了嘀嗒先回到周期方式,从现在起对齐嘀嗒,接下来还有嘀嗒之间的定时器再切过去
+        if (oneshot_active) timer_set_periodic();
+        else next_tick_us += TICK_US;
+    }
+    timer_program();
+    if (!tick) return;
     // 记录此线程占用的cpu时间嘀
     cur_thread->elapsed_ticks++;
-    // 从内核第一次处理时间中断后开始至今的滴哒数,内核态和用户态总共的嘀哒数
-    ticks++;
 
     // 当前任务的时间片用完就开始调度
     if (cur_thread->ticks == 0) {
@@ -57,18 +364,51 @@ static void intr_timer_handler(void) {
     }
 }
 
-/**********************
-@author: liyajun
-@data: 2024.3.30 20：04
-@description: 以tick为单位的sleep
-***********************/
-static void ticks_to_sleep(uint32_t sleep_ticks) {
-    uint32_t start_tick = ticks;
+/**
+ * @description: idle准备hlt前调用,需要关中断.把周期中断停掉,改成在最近一个超时任务的唤醒时刻中断一次,
+ *               没有超时任务时按中断源能定的最长时间,cpu空闲期间不再每个嘀嗒都被叫醒
+ * @return {*}
+ */
+void timer_nohz_start(void) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (nohz_active) return;
+    // 上一个周期中或者上一次单次定时以来已经过去的时间先记上
+    timer_advance(clockevent->elapsed_us());
+    nohz_active = true;
+    timer_program();
+}
 
-    /* 若间隔的ticks数不够便让出cpu */
-    while (ticks - start_tick < sleep_ticks) {
-        thread_yield();
+/**
+ * @description: idle被别的中断唤醒后调用,需要关中断.补上停掉周期中断期间过去的时间,恢复周期中断
+ * @return {*}
+ */
+void timer_nohz_stop(void) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (!nohz_active) return;
+    timer_advance(clockevent->elapsed_us());
+    nohz_active = false;
+    timer_set_periodic();
+    // 醒来之前别的中断可能加了嘀嗒之间到期的定时器
+    timer_program();
+}
+
+/**
+ * @description: 以微秒为单位的sleep,阻塞到时刻由超时定时器唤醒.不管cpu忙不忙,唤醒时刻都由单次定时保证,精度为微秒级,
+ *               之后还要等调度器选中
+ * @param {uint32_t} u_seconds 睡眠的微秒数
+ * @return {*}
+ */
+void utime_sleep(uint32_t u_seconds) {
+    enum intr_status old_status = intr_disable();
+    struct task_struct* cur = running_thread();
+    uint64_t wakeup_us = timer_now_us() + u_seconds;
+    while (timer_now_us() < wakeup_us) {
+        list_append(&sleep_list, &cur->general_tag);
+        timer_timeout_add(cur, wakeup_us);
+        thread_block(TASK_BLOCKED);
+        timer_timeout_del(cur);
     }
+    intr_set_status(old_status);
 }
 
 /**********************
@@ -77,9 +417,8 @@ static void ticks_to_sleep(uint32_t sleep_ticks) {
 @description: 以毫秒为单位的sleep
 ***********************/
 void mtime_sleep(uint32_t m_seconds) {
-    uint32_t sleep_ticks = DIV_ROUND_UP(m_seconds, mil_seconds_per_intr);
-    ASSERT(sleep_ticks > 0);
-    ticks_to_sleep(sleep_ticks); 
+    ASSERT(m_seconds > 0);
+    utime_sleep(m_seconds * 1000);
 }
 
 
@@ -90,7 +429,11 @@ void mtime_sleep(uint32_t m_seconds) {
 ***********************/
 void timer_init() {
     put_str("timer_init start!\n");
-    frequency_set(CONTRER0_PORT, CONTRER0_NO, CONTRER0_RWL, CONTRER0_MODE, COUNTER0_BCD, COUNTER0_VALUE);
+    timer_set_periodic();
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        for (uint32_t idx = 0; idx < WHEEL_SIZE; idx++) list_init(&wheel[level][idx]);
+    }
+    list_init(&sleep_list);
     register_handler(0x20, intr_timer_handler);
     put_str("timer_init end!\n");
 }
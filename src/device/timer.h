@@ -3,14 +3,56 @@
 #define __DEVICE_TIMER_H
 
 #include "stdin.h"
+#include "list.h"
+
+#define IRQ0_FREQUENCY     100                          // 周期时钟中断的频率
+#define TICK_US            (1000000 / IRQ0_FREQUENCY)   // 一个嘀嗒的微秒数
+
+/* 时钟中断源,可以周期性地中断,也可以只在设定的时刻中断一次 */
+struct clock_event_device {
+    const char* name;
+    uint32_t max_delta_us;                     // 单次定时最长的微秒数
+    void (*set_periodic)(void);                // 切换成每TICK_US微秒中断一次
+    void (*set_oneshot)(uint32_t delta_us);    // delta_us微秒后中断一次,之后不再中断
+    uint32_t (*elapsed_us)(void);              // 从上一次周期中断或者上一次设置单次定时起过去的微秒数
+};
+
+/* 内核定时器,到期时在时钟中断中以关中断的状态调用func(arg),func不能阻塞 */
+struct timer {
+    struct list_elem timer_tag;    // 在时间轮某个槽中的节点
+    uint64_t expires;              // 到期时刻,开机以来的微秒数
+    void (*func)(void* arg);       // 到期时调用的函数
+    void* arg;                     // 传给func的参数
+    bool pending;                  // 是否还在时间轮上等待到期
+};
+
+struct task_struct;
 
 // 总滴答数
 extern uint64_t ticks;
 
 /* 时钟初始化 */
 void timer_init(void);
-/* 休眠函数 */
+/* 开机以来的微秒数 */
+uint64_t timer_now_us(void);
+/* 以毫秒为单位的休眠 */
 void mtime_sleep(uint32_t m_seconds);
+/* 以微秒为单位的休眠 */
+void utime_sleep(uint32_t u_seconds);
+/* idle准备hlt前调用,停掉周期时钟中断,只在最近的超时时刻中断一次 */
+void timer_nohz_start(void);
+/* idle醒来后调用,补上停掉周期中断期间过去的时间,恢复周期时钟中断 */
+void timer_nohz_stop(void);
+/* 设置定时器到期时调用的函数 */
+void timer_setup(struct timer* timer, void (*func)(void*), void* arg);
+/* 让定时器在expires时刻到期,已经在等待的改为新的到期时刻 */
+void timer_add(struct timer* timer, uint64_t expires);
+/* 取消定时器,返回它是否还在等待 */
+bool timer_cancel(struct timer* timer);
+/* 给即将阻塞的任务设好超时定时器,到wakeup_us时刻仍未被唤醒就由时钟中断唤醒 */
+void timer_timeout_add(struct task_struct* pthread, uint64_t wakeup_us);
+/* 取消任务的超时定时器 */
+void timer_timeout_del(struct task_struct* pthread);
 
 #endif
 
@@ -0,0 +1,216 @@
+#include "dcache.h"
+#include "sync.h"
+#include "string.h"
+#include "stdio.h"
+
+/* 全部缓存项 */
+static struct dentry dentries[DCACHE_ENTRY_CNT];
+/* 以(父目录, 名字)为键的哈希桶 */
+static struct list name_table[DCACHE_HASH_CNT];
+/* 以i_no为键的哈希桶 */
+static struct list ino_table[DCACHE_HASH_CNT];
+/* lru链表,队首是最近使用的缓存项,队尾是最久未使用的缓存项 */
+static struct list lru_list;
+/* 缓存锁 */
+static struct lock dcache_lock;
+/* 统计信息 */
+static struct dcache_stat stat;
+
+/* 名字最多比较MAX_FILE_NAME_LEN个字符,目录项中的名字占满时没有结尾的0 */
+static bool dcache_name_equal(const char* a, const char* b) {
+    for (uint32_t idx = 0; idx < MAX_FILE_NAME_LEN; idx++) {
+        if (a[idx] != b[idx]) return false;
+        if (a[idx] == 0) return true;
+    }
+    return true;
+}
+
+/* 名字的长度,超过MAX_FILE_NAME_LEN时返回MAX_FILE_NAME_LEN+1 */
+static uint32_t dcache_name_len(const char* name) {
+    uint32_t len = 0;
+    while (len <= MAX_FILE_NAME_LEN && name[len] != 0) len++;
+    return len;
+}
+
+/* 计算(parent_ino, name)所在的哈希桶 */
+static struct list* dcache_name_bucket(uint32_t parent_ino, const char* name) {
+    uint32_t hash = 2166136261u ^ parent_ino;
+    for (uint32_t idx = 0; idx < MAX_FILE_NAME_LEN && name[idx] != 0; idx++) {
+        hash = (hash ^ (uint8_t)name[idx]) * 16777619u;
+    }
+    return &name_table[hash % DCACHE_HASH_CNT];
+}
+
+/* 计算i_no所在的哈希桶 */
+static struct list* dcache_ino_bucket(uint32_t i_no) {
+    return &ino_table[i_no % DCACHE_HASH_CNT];
+}
+
+/* 在缓存中查找(parent_ino, name),找不到返回NULL */
+static struct dentry* dcache_find(uint32_t parent_ino, const char* name) {
+    struct list* bucket = dcache_name_bucket(parent_ino, name);
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct dentry* de = elem2entry(struct dentry, hash_tag, elem);
+        if (de->parent_ino == parent_ino && dcache_name_equal(de->name, name)) return de;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 把缓存项从哈希桶中摘下,放到lru链表队尾优先复用 */
+static void dcache_drop(struct dentry* de) {
+    list_remove(&de->hash_tag);
+    list_remove(&de->ino_tag);
+    de->valid = false;
+    list_remove(&de->lru_tag);
+    list_append(&lru_list, &de->lru_tag);
+}
+
+/**
+ * @description: 在缓存中查找目录parent_ino中名为name的目录项,命中时目录项存入dir_e
+ * @param {uint32_t} parent_ino 父目录的inode编号
+ * @param {char*} name 名字
+ * @param {dir_entry*} dir_e 命中时存入目录项
+ * @return {*} 查找结果
+ */
+enum dcache_result dcache_lookup(uint32_t parent_ino, const char* name, struct dir_entry* dir_e) {
+    lock_acquire(&dcache_lock);
+    struct dentry* de = dcache_find(parent_ino, name);
+    if (de == NULL) {
+        stat.misses++;
+        lock_release(&dcache_lock);
+        return DCACHE_MISS;
+    }
+    list_remove(&de->lru_tag);
+    list_push(&lru_list, &de->lru_tag);
+    stat.hits++;
+    if (de->f_type == FT_UNKNOWN) {
+        stat.negative_hits++;
+        lock_release(&dcache_lock);
+        return DCACHE_NEGATIVE;
+    }
+    memset(dir_e, 0, sizeof(struct dir_entry));
+    memcpy(dir_e->filename, de->name, MAX_FILE_NAME_LEN);
+    dir_e->i_no = de->i_no;
+    dir_e->f_type = de->f_type;
+    lock_release(&dcache_lock);
+    return DCACHE_HIT;
+}
+
+/**
+ * @description: 把目录parent_ino中name的查找结果放入缓存,已有的缓存项直接覆盖,缓存满时淘汰最久未使用的项
+ * @param {uint32_t} parent_ino 父目录的inode编号
+ * @param {char*} name 名字
+ * @param {dir_entry*} dir_e 目录项,为NULL时放入负项
+ * @return {*}
+ */
+void dcache_add(uint32_t parent_ino, const char* name, struct dir_entry* dir_e) {
+    // 超长的名字在目录中一定找不到,不值得占一个缓存项
+    uint32_t name_len = dcache_name_len(name);
+    if (name_len > MAX_FILE_NAME_LEN) return;
+    lock_acquire(&dcache_lock);
+    struct dentry* de = dcache_find(parent_ino, name);
+    if (de != NULL) {
+        dcache_drop(de);
+    }
+    de = elem2entry(struct dentry, lru_tag, lru_list.tail.prev);
+    if (de->valid) dcache_drop(de);
+
+    de->valid = true;
+    de->parent_ino = parent_ino;
+    memset(de->name, 0, sizeof(de->name));
+    memcpy(de->name, name, name_len);
+    de->i_no = dir_e == NULL ? 0 : dir_e->i_no;
+    de->f_type = dir_e == NULL ? FT_UNKNOWN : dir_e->f_type;
+    list_push(dcache_name_bucket(parent_ino, name), &de->hash_tag);
+    list_push(dcache_ino_bucket(de->i_no), &de->ino_tag);
+    list_remove(&de->lru_tag);
+    list_push(&lru_list, &de->lru_tag);
+    lock_release(&dcache_lock);
+}
+
+/**
+ * @description: 目录parent_ino中的name被删除,去掉它的缓存项
+ * @param {uint32_t} parent_ino 父目录的inode编号
+ * @param {char*} name 名字
+ * @return {*}
+ */
+void dcache_remove(uint32_t parent_ino, const char* name) {
+    lock_acquire(&dcache_lock);
+    struct dentry* de = dcache_find(parent_ino, name);
+    if (de != NULL) dcache_drop(de);
+    lock_release(&dcache_lock);
+}
+
+/**
+ * @description: 目录dir_ino被删除,它的inode编号随后会被复用,去掉它下面的和指向它的全部缓存项
+ * @param {uint32_t} dir_ino 被删除目录的inode编号
+ * @return {*}
+ */
+void dcache_purge_dir(uint32_t dir_ino) {
+    lock_acquire(&dcache_lock);
+    for (uint32_t idx = 0; idx < DCACHE_ENTRY_CNT; idx++) {
+        struct dentry* de = &dentries[idx];
+        if (!de->valid) continue;
+        if (de->parent_ino == dir_ino || (de->f_type != FT_UNKNOWN && de->i_no == dir_ino)) {
+            dcache_drop(de);
+        }
+    }
+    lock_release(&dcache_lock);
+}
+
+/**
+ * @description: 反查子目录child_ino在父目录中的名字,"."和".."不算
+ * @param {uint32_t} child_ino 子目录的inode编号
+ * @param {uint32_t*} parent_ino 命中时存入父目录的inode编号
+ * @param {char*} name 命中时存入名字,至少MAX_FILE_NAME_LEN+1字节
+ * @return {*} 命中返回true
+ */
+bool dcache_lookup_name(uint32_t child_ino, uint32_t* parent_ino, char* name) {
+    lock_acquire(&dcache_lock);
+    struct list* bucket = dcache_ino_bucket(child_ino);
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct dentry* de = elem2entry(struct dentry, ino_tag, elem);
+        if (de->i_no == child_ino && de->f_type == FT_DIRECTORY && \
+            strcmp(de->name, ".") && strcmp(de->name, "..")) {
+            *parent_ino = de->parent_ino;
+            strcpy(name, de->name);
+            list_remove(&de->lru_tag);
+            list_push(&lru_list, &de->lru_tag);
+            stat.hits++;
+            lock_release(&dcache_lock);
+            return true;
+        }
+        elem = elem->next;
+    }
+    stat.misses++;
+    lock_release(&dcache_lock);
+    return false;
+}
+
+/* 获取统计信息 */
+void dcache_get_stat(struct dcache_stat* st) {
+    lock_acquire(&dcache_lock);
+    memcpy(st, &stat, sizeof(struct dcache_stat));
+    lock_release(&dcache_lock);
+}
+
+/* 目录项缓存初始化 */
+void dcache_init(void) {
+    printk("dcache_init start!\n");
+    lock_init(&dcache_lock);
+    list_init(&lru_list);
+    for (uint32_t bucket_idx = 0; bucket_idx < DCACHE_HASH_CNT; bucket_idx++) {
+        list_init(&name_table[bucket_idx]);
+        list_init(&ino_table[bucket_idx]);
+    }
+    for (uint32_t idx = 0; idx < DCACHE_ENTRY_CNT; idx++) {
+        struct dentry* de = &dentries[idx];
+        de->valid = false;
+        list_append(&lru_list, &de->lru_tag);
+    }
+    memset(&stat, 0, sizeof(struct dcache_stat));
+    printk("dcache_init done!\n");
+}
@@ -0,0 +1,52 @@
+#ifndef __FS_DCACHE_H
+#define __FS_DCACHE_H
+
+#include "stdin.h"
+#include "list.h"
+#include "dir.h"
+
+#define DCACHE_ENTRY_CNT   256    // 缓存的目录项个数
+#define DCACHE_HASH_CNT    64     // 哈希桶的数量
+
+/* 查找目录项缓存的结果 */
+enum dcache_result {
+    DCACHE_MISS,                  // 缓存中没有,需要读目录
+    DCACHE_HIT,                   // 命中,目录项已存入dir_e
+    DCACHE_NEGATIVE               // 命中负项,目录中确定没有这个名字
+};
+
+/* 缓存的目录项,以(父目录inode编号, 名字)为键,f_type为FT_UNKNOWN时是负项 */
+struct dentry {
+    bool valid;
+    uint32_t parent_ino;              // 所在目录的inode编号
+    char name[MAX_FILE_NAME_LEN + 1]; // 名字
+    uint32_t i_no;                    // 名字对应的inode编号
+    enum file_types f_type;           // 文件类型
+    struct list_elem hash_tag;        // 在(父目录, 名字)哈希桶中的节点
+    struct list_elem ino_tag;         // 在i_no哈希桶中的节点,用于从子目录反查名字
+    struct list_elem lru_tag;         // 在lru链表中的节点,越靠近队首越是最近使用的
+};
+
+/* 目录项缓存统计信息 */
+struct dcache_stat {
+    uint32_t hits;                // 命中的次数,含负项
+    uint32_t negative_hits;       // 命中负项的次数
+    uint32_t misses;              // 未命中的次数
+};
+
+/* 目录项缓存初始化 */
+void dcache_init(void);
+/* 在缓存中查找目录parent_ino中名为name的目录项 */
+enum dcache_result dcache_lookup(uint32_t parent_ino, const char* name, struct dir_entry* dir_e);
+/* 把目录parent_ino中name的查找结果放入缓存,dir_e为NULL时放入负项 */
+void dcache_add(uint32_t parent_ino, const char* name, struct dir_entry* dir_e);
+/* 目录parent_ino中的name被删除,去掉它的缓存 */
+void dcache_remove(uint32_t parent_ino, const char* name);
+/* 目录dir_ino被删除,去掉它下面的和指向它的全部缓存 */
+void dcache_purge_dir(uint32_t dir_ino);
+/* 反查子目录child_ino在父目录中的名字,命中返回true并存入parent_ino和name */
+bool dcache_lookup_name(uint32_t child_ino, uint32_t* parent_ino, char* name);
+/* 获取统计信息 */
+void dcache_get_stat(struct dcache_stat* stat);
+
+#endif
@@ -10,14 +10,19 @@
  */
 #include "dir.h"
 #include "ide.h"
+#include "bcache.h"
 #include "file.h"
 #include "string.h"
 #include "stdio.h"
 #include "assert.h"
 #include "super_block.h"
+#include "journal.h"
+#include "dcache.h"
 
  // 根目录
 struct dir root_dir;
+// 打开的目录
+struct slab_cache dir_cache;
 
 /**
  * @description: 打开根目录
@@ -36,14 +41,98 @@ void open_root_dir(struct partition* part) {
  * @return {*}
  */
 struct dir* dir_open(struct partition* part, uint32_t inode_no) {
-    struct dir* pdir = (struct dir*)sys_malloc(sizeof(struct dir));
+    struct dir* pdir = (struct dir*)slab_alloc(&dir_cache);
     pdir->inode = inode_open(part, inode_no);
     pdir->dir_pos = 0;
     return pdir;
 }
 
+/* 目录项名字的散列值,FNV-1a */
+static uint32_t dir_name_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t idx = 0; idx < MAX_FILE_NAME_LEN && name[idx] != 0; idx++) {
+        hash = (hash ^ (uint8_t)name[idx]) * 16777619u;
+    }
+    return hash;
+}
+
+/* 目录当前的散列桶个数 */
+static uint32_t dir_buckets(struct inode* dir_inode) {
+    return dir_inode->i_dir_buckets == 0 ? 1 : dir_inode->i_dir_buckets;
+}
+
+/* 线性散列: 桶数为2^level+split时,低于split的桶已经分裂过,要多看一位 */
+static uint32_t dir_hash_bucket(uint32_t hash, uint32_t buckets) {
+    uint32_t level_size = 1;
+    while (level_size * 2 <= buckets) level_size *= 2;
+    uint32_t bucket = hash & (level_size - 1);
+    if (bucket < buckets - level_size) bucket = hash & (level_size * 2 - 1);
+    return bucket;
+}
+
+/* 目录块末尾的散列信息 */
+static struct dir_block_tail* dir_block_tail(void* block) {
+    return (struct dir_block_tail*)((uint8_t*)block + cur_part->sb->block_size - sizeof(struct dir_block_tail));
+}
+
+/* 一个目录块能放的目录项个数,块末尾留给散列信息 */
+static uint32_t dir_block_entries(uint32_t dir_entry_size) {
+    return (cur_part->sb->block_size - sizeof(struct dir_block_tail)) / dir_entry_size;
+}
+
+/* "."和".."固定在目录的第0块,不参与散列 */
+static bool dir_is_dot(const char* name) {
+    return !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+/* 在一个目录块中查找名为name的目录项,找到后复制到dir_e */
+static bool dir_block_search(uint8_t* block, const char* name, struct dir_entry* dir_e, uint32_t dir_entry_size) {
+    struct dir_entry* p_de = (struct dir_entry*)block;
+    uint32_t dir_entry_cnt = dir_block_entries(dir_entry_size);
+    for (uint32_t dir_entry_idx = 0; dir_entry_idx < dir_entry_cnt; dir_entry_idx++) {
+        if (p_de->f_type != FT_UNKNOWN && !strcmp(p_de->filename, name)) {
+            memcpy(dir_e, p_de, dir_entry_size);
+            return true;
+        }
+        p_de++;
+    }
+    return false;
+}
+
+/* 把目录项放进目录块的空位,没有空位返回false */
+static bool dir_block_insert(uint8_t* block, struct dir_entry* p_de, uint32_t dir_entry_size) {
+    struct dir_entry* dir_e = (struct dir_entry*)block;
+    uint32_t dir_entry_cnt = dir_block_entries(dir_entry_size);
+    for (uint32_t dir_entry_idx = 0; dir_entry_idx < dir_entry_cnt; dir_entry_idx++) {
+        // FT_UNKNOWN为0,无论是初始化或是删除文件后,都会将f_type置为FT_UNKNOWN.
+        if ((dir_e + dir_entry_idx)->f_type == FT_UNKNOWN) {
+            memcpy(dir_e + dir_entry_idx, p_de, dir_entry_size);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 为目录的第block_idx块分配扇区,返回扇区地址,失败返回0 */
+static uint32_t dir_block_alloc(struct inode* dir_inode, uint32_t block_idx) {
+    int32_t block_lba = block_bitmap_alloc(cur_part);
+    if (block_lba == -1) {
+        printk("dir_block_alloc error: alloc block bitmap failed\n");
+        return 0;
+    }
+    // 每分配一个块就同步一次block_bitmap
+    bitmap_sync(cur_part, block_lba_to_bit(cur_part, block_lba), BLOCK_BITMAP);
+    // 把新块挂到目录的块索引上,需要时会顺带分配一级间接块表
+    if (inode_bmap_set(cur_part, dir_inode, block_idx, block_lba) != 0) {
+        block_bitmap_free(cur_part, block_lba);
+        printk("dir_block_alloc error: map dir block failed\n");
+        return 0;
+    }
+    return block_lba;
+}
+
 /**
- * @description: 在part分区内的pdir目录内寻找名为name的文件或目录,找到后返回true并将其目录项存入dir_e,否则返回false
+ * @description: 在part分区内的pdir目录内寻找名为name的文件或目录,名字散列到的桶就是要读的那一块,找到后返回true并将其目录项存入dir_e,否则返回false
  * @param {partition*} part 分区
  * @param {dir*} pdir 从此目录查找
  * @param {char*} name 文件或者目录
@@ -51,60 +140,56 @@ struct dir* dir_open(struct partition* part, uint32_t inode_no) {
  * @return {*}
  */
 bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e) {
-    // 12个直接块大小+128个间接块,共560字节
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(560);
-    // 申请内存
-    if (all_blocks == NULL) {
-        printk("search_dir_entry: sys_malloc for all_blocks failed");
+    struct inode* dir_inode = pdir->inode;
+    // 先查目录项缓存,找不到的名字也有缓存
+    enum dcache_result cached = dcache_lookup(dir_inode->i_no, name, dir_e);
+    if (cached != DCACHE_MISS) return cached == DCACHE_HIT;
+    // 写目录项的时候保证在一个块，读的时候就可以从一个块读，这样浪费了一点空间，但是更方便了
+    uint8_t* buf = (uint8_t*)slab_alloc(&io_buf_cache);
+    if (buf == NULL) {
+        printk("search_dir_entry: alloc for buf failed\n");
         return false;
     }
-
-    // 填充12个一级指针
-    for (uint32_t block_idx = 0; block_idx < 12; block_idx++) {
-        all_blocks[block_idx] = pdir->inode->i_sectors[block_idx];
-    }
-    // 再处理二级页表
-    if (pdir->inode->i_sectors[12] != 0) {
-        ide_read(part->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1);
-    }
-
-    // 写目录项的时候保证在一个扇区，读的时候就可以从一个扇区读，这样浪费了一点空间，但是更方便了
-    uint8_t* buf = (uint8_t*)sys_malloc(SECTOR_SIZE);
-    // 指向目录项的指针,值为buf起始地址
-    struct dir_entry* p_de = (struct dir_entry*)buf;
     // 目录项的大小
     uint32_t dir_entry_size = part->sb->dir_entry_size;
-    // 1扇区内可容纳的目录项个数
-    uint32_t dir_entry_cnt = SECTOR_SIZE / dir_entry_size;
-
-    // 开始在所有块中查找目录项
-    for (uint32_t block_idx = 0; block_idx < 140; block_idx++) {
-        // 块地址为0时表示该块中无数据,继续在其它块中找
-        if (all_blocks[block_idx] == 0) {
-            block_idx++;
-            continue;
-        }
-        // 读取有目录的块
-        ide_read(part->my_disk, all_blocks[block_idx], buf, 1);
-        // 遍历扇区中所有目录项
-        for (uint32_t dir_entry_idx = 0; dir_entry_idx < dir_entry_cnt; dir_entry_idx++) {
-            // 若找到了,就直接复制整个目录项
-            if (!strcmp(p_de->filename, name)) {
-                memcpy(dir_e, p_de, dir_entry_size);
-                sys_free(buf);
-                sys_free(all_blocks);
-                return true;
-            }
-            p_de++;
-        }
-        // 此时p_de已经指向扇区内最后一个完整目录项了,需要恢复p_de指向为buf
-        p_de = (struct dir_entry*)buf;
-        // 将buf清0,下次再用
-        memset(buf, 0, SECTOR_SIZE);
+    bool found = false;
+    bool overflow = false;
+
+    // 只需要读名字散列到的那一块
+    uint32_t block_idx = dir_is_dot(name) ? 0 : dir_hash_bucket(dir_name_hash(name), dir_buckets(dir_inode));
+    uint32_t block_lba = inode_bmap(part, dir_inode, block_idx);
+    if (block_lba != 0 && bcache_read(part->my_disk, block_lba, buf, part->sb->block_sects) == 0) {
+        found = dir_block_search(buf, name, dir_e, dir_entry_size);
+        overflow = dir_block_tail(buf)->overflow;
     }
-    sys_free(buf);
-    sys_free(all_blocks);
-    return false;
+    // 桶满了以后新来的目录项放在溢出块中
+    for (block_idx = DIR_OVERFLOW_FIRST; !found && overflow && block_idx < DIR_MAX_BLOCKS; block_idx++) {
+        block_lba = inode_bmap(part, dir_inode, block_idx);
+        if (block_lba == 0 || bcache_read(part->my_disk, block_lba, buf, part->sb->block_sects) != 0) continue;
+        found = dir_block_search(buf, name, dir_e, dir_entry_size);
+    }
+    slab_free(&io_buf_cache, buf);
+    // 查找都在元数据操作中,读目录期间别人不会改动它,结果放进缓存不会盖掉更新的目录项
+    ASSERT(part->meta_lock.holder == running_thread());
+    dcache_add(dir_inode->i_no, name, found ? dir_e : NULL);
+    return found;
+}
+
+/**
+ * @description: 在编号为dir_ino的目录中寻找名为name的目录项,缓存命中时不用打开目录
+ * @param {partition*} part 分区
+ * @param {uint32_t} dir_ino 目录的inode编号
+ * @param {char*} name 文件或者目录
+ * @param {dir_entry*} dir_e 找到目录项存入dir_e
+ * @return {*} 找到返回true
+ */
+bool dir_lookup(struct partition* part, uint32_t dir_ino, const char* name, struct dir_entry* dir_e) {
+    enum dcache_result cached = dcache_lookup(dir_ino, name, dir_e);
+    if (cached != DCACHE_MISS) return cached == DCACHE_HIT;
+    struct dir* pdir = dir_ino == part->sb->root_inode_no ? &root_dir : dir_open(part, dir_ino);
+    bool found = search_dir_entry(part, pdir, name, dir_e);
+    dir_close(pdir);
+    return found;
 }
 
 /**
@@ -116,7 +201,7 @@ void dir_close(struct dir* dir) {
     // 如果是根目录是不能关闭的，根目录打开的空间直接在内核。不在堆中，不能free
     if (dir == &root_dir) return;
     inode_close(dir->inode);
-    sys_free(dir);
+    slab_free(&dir_cache, dir);
 }
 
 /**
@@ -134,110 +219,121 @@ void create_dir_entry(char* filename, uint32_t inode_no, uint8_t file_type, stru
 }
 
 /**
- * @description: 将目录项p_de写入父目录parent_dir中,io_buf由主调函数提供
+ * @description: 线性散列的分裂: 新增一个桶,把下一个待分裂的桶中该去新桶的目录项搬过去
+ * @param {inode*} dir_inode 目录的inode
+ * @param {uint8_t*} io_buf 两个块大小的缓冲区
+ * @return {*} 成功返回true
+ */
+static bool dir_bucket_split(struct inode* dir_inode, uint8_t* io_buf) {
+    uint32_t buckets = dir_buckets(dir_inode);
+    uint32_t level_size = 1;
+    while (level_size * 2 <= buckets) level_size *= 2;
+    // 待分裂的桶和新桶
+    uint32_t old_idx = buckets - level_size;
+    uint32_t new_idx = buckets;
+    uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
+    uint32_t dir_entry_cnt = dir_block_entries(dir_entry_size);
+
+    uint32_t old_lba = inode_bmap(cur_part, dir_inode, old_idx);
+    ASSERT(inode_bmap(cur_part, dir_inode, new_idx) == 0);
+    dir_inode->i_dir_buckets = buckets + 1;
+    inode_mark_dirty(dir_inode);
+    // 旧桶还没有块,没有要搬的目录项
+    if (old_lba == 0) return true;
+
+    uint8_t* old_buf = io_buf;
+    uint8_t* new_buf = io_buf + cur_part->sb->block_size;
+    if (bcache_read(cur_part->my_disk, old_lba, old_buf, cur_part->sb->block_sects) != 0) return false;
+    memset(new_buf, 0, cur_part->sb->block_size);
+    struct dir_entry* old_de = (struct dir_entry*)old_buf;
+    struct dir_entry* new_de = (struct dir_entry*)new_buf;
+    uint32_t moved = 0;
+    for (uint32_t dir_entry_idx = 0; dir_entry_idx < dir_entry_cnt; dir_entry_idx++) {
+        struct dir_entry* p_de = old_de + dir_entry_idx;
+        if (p_de->f_type == FT_UNKNOWN || dir_is_dot(p_de->filename)) continue;
+        if (dir_hash_bucket(dir_name_hash(p_de->filename), buckets + 1) != new_idx) continue;
+        memcpy(new_de + moved, p_de, dir_entry_size);
+        memset(p_de, 0, dir_entry_size);
+        moved++;
+    }
+    if (moved == 0) return true;
+
+    // 先写新桶再改旧桶,两者在同一个事务中提交
+    uint32_t new_lba = dir_block_alloc(dir_inode, new_idx);
+    if (new_lba == 0) {
+        dir_inode->i_dir_buckets = buckets;
+        return false;
+    }
+    journal_write(cur_part, new_lba, new_buf, cur_part->sb->block_sects);
+    journal_write(cur_part, old_lba, old_buf, cur_part->sb->block_sects);
+    return true;
+}
+
+/**
+ * @description: 将目录项p_de写入父目录parent_dir中名字散列到的桶,桶满时先分裂,桶数到顶后放入溢出块,io_buf由主调函数提供
  * @param {dir*} parent_dir 父目录
  * @param {dir_entry*} p_de 要写入的目录项
- * @param {void*} io_buf    缓存，由主调函数提供
+ * @param {void*} io_buf    缓存，由主调函数提供,两个块大小
  * @return {*}
  */
 bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf) {
     // 根目录的inode
     struct inode* dir_inode = parent_dir->inode;
-    // 根目录的文件大小
-    uint32_t dir_size = dir_inode->i_size;
     // 目录项的大小，现在是
     uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
     // 保证根目录的文件大小是目录项的整数倍
-    ASSERT(dir_size % dir_entry_size == 0);
-    // 每个扇区最大的目录项树木
-    uint32_t dir_entrys_per_sec = (512 / dir_entry_size);
-    int32_t block_lba = -1;
-
-    // 将该目录的所有扇区地址存入all_blocks
-    uint32_t all_blocks[140];
-    for (uint8_t block_idx = 0; block_idx < 12; block_idx++) {
-        all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-    }
-
-    // 创建指向iobuf的指针用来遍历
-    struct dir_entry* dir_e = (struct dir_entry*)io_buf;
-    int32_t block_bitmap_idx = -1;
-
-    // 开始遍历所有块以寻找目录项空位,若已有扇区中没有空闲位,在不超过文件大小的情况下申请新扇区来存储新目录项
-    for (uint8_t block_idx = 0; block_idx < 140; block_idx++) {
-        block_bitmap_idx = -1;
-        if (all_blocks[block_idx] == 0) {
-            // 找到了一个没有地址的指针
-            block_lba = block_bitmap_alloc(cur_part);
-            if (block_lba == -1) {
-                printk("sync_dir_entry error: alloc block bitmap failed\n");
-                return false;
-            }
-
-            // 每分配一个块就同步一次block_bitmap
-            block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-
-            block_bitmap_idx = -1;
-            // 若是直接块，那么将这个地址赋值给直接块指正
-            if (block_idx < 12) {
-                dir_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-            }
-            // 若是尚未分配一级间接块表(block_idx等于12表示第0个间接块地址为0)
-            else if (block_idx == 12) {
-                // 将上面分配的块做为一级间接块表地址
-                dir_inode->i_sectors[12] = block_lba;
-                block_lba = -1;
-                // 再分配一个块做为第0个间接块，也就是第13个块
-                block_lba = block_bitmap_alloc(cur_part);
-                // 如果分配失败
-                if (block_lba == -1) {
-                    // 找到第一个分配的块
-                    block_bitmap_idx = dir_inode->i_sectors[12] - cur_part->sb->data_start_lba;
-                    // 将其恢复
-                    bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
-                    // 将一节间接表指正恢复
-                    dir_inode->i_sectors[12] = 0;
-                    // 打印报错信息
-                    printk("sync_dir_entry error: alloc block bitmap failed\n");
-                    return false;
-                }
-
-                // 每分配一个块就同步一次block_bitmap
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-                // 将指针指向新分配的块
-                all_blocks[12] = block_lba;
-                // 把新分配的第0个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-            }
-            // 若是间接块未分配
-            else {
-                all_blocks[block_idx] = block_lba;
-                // 把新分配的第(block_idx-12)个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-            }
-
-            // 再将新目录项p_de写入新分配的间接块
-            memset(io_buf, 0, 512);
+    ASSERT(dir_inode->i_size % dir_entry_size == 0);
+    uint32_t hash = dir_name_hash(p_de->filename);
+    uint32_t block_idx, block_lba;
+
+    while (1) {
+        block_idx = dir_hash_bucket(hash, dir_buckets(dir_inode));
+        block_lba = inode_bmap(cur_part, dir_inode, block_idx);
+        // 桶还没有块,分配一个新块
+        if (block_lba == 0) {
+            block_lba = dir_block_alloc(dir_inode, block_idx);
+            if (block_lba == 0) return false;
+            memset(io_buf, 0, cur_part->sb->block_size);
             memcpy(io_buf, p_de, dir_entry_size);
-            ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+            journal_write(cur_part, block_lba, io_buf, cur_part->sb->block_sects);
+            dir_inode->i_size += dir_entry_size;
+            dcache_add(dir_inode->i_no, p_de->filename, p_de);
+            return true;
+        }
+        if (bcache_read(cur_part->my_disk, block_lba, io_buf, cur_part->sb->block_sects) != 0) return false;
+        if (dir_block_insert(io_buf, p_de, dir_entry_size)) {
+            journal_write(cur_part, block_lba, io_buf, cur_part->sb->block_sects);
             dir_inode->i_size += dir_entry_size;
+            dcache_add(dir_inode->i_no, p_de->filename, p_de);
             return true;
         }
+        // 桶满了,还能增加桶就分裂后再试
+        if (dir_buckets(dir_inode) >= DIR_HASH_MAX) break;
+        if (!dir_bucket_split(dir_inode, io_buf)) return false;
+        // 每次分裂后分段,连续分裂多次也不会超出给一个操作预留的事务空间
+        fs_op_restart(cur_part);
+    }
 
-        // 若第block_idx块已存在,将其读进内存,然后在该块中查找空目录项
-        ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-        // 在扇区内查找空目录项 
-        for (uint8_t dir_entry_idx = 0; dir_entry_idx < dir_entrys_per_sec; dir_entry_idx++) {
-            // FT_UNKNOWN为0,无论是初始化或是删除文件后,都会将f_type置为FT_UNKNOWN.
-            if ((dir_e + dir_entry_idx)->f_type == FT_UNKNOWN) {
-                memcpy(dir_e + dir_entry_idx, p_de, dir_entry_size);
-                ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-                dir_inode->i_size += dir_entry_size;
-                return true;
-            }
+    // 桶数到顶,在桶上做溢出标记,目录项放进溢出块
+    if (!dir_block_tail(io_buf)->overflow) {
+        dir_block_tail(io_buf)->overflow = true;
+        journal_write(cur_part, block_lba, io_buf, cur_part->sb->block_sects);
+    }
+    for (block_idx = DIR_OVERFLOW_FIRST; block_idx < DIR_MAX_BLOCKS; block_idx++) {
+        block_lba = inode_bmap(cur_part, dir_inode, block_idx);
+        if (block_lba == 0) {
+            block_lba = dir_block_alloc(dir_inode, block_idx);
+            if (block_lba == 0) return false;
+            memset(io_buf, 0, cur_part->sb->block_size);
+        }
+        else if (bcache_read(cur_part->my_disk, block_lba, io_buf, cur_part->sb->block_sects) != 0) {
+            continue;
+        }
+        if (dir_block_insert(io_buf, p_de, dir_entry_size)) {
+            journal_write(cur_part, block_lba, io_buf, cur_part->sb->block_sects);
+            dir_inode->i_size += dir_entry_size;
+            dcache_add(dir_inode->i_no, p_de->filename, p_de);
+            return true;
         }
     }
     printk("directory is full!\n");
@@ -255,22 +351,10 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
 bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, void* io_buf) {
     // 目录所在块的结构
     struct inode* dir_inode = pdir->inode;
-    // 准备数据
-    uint32_t block_idx = 0;
-    uint32_t all_blocks[140] = { 0 };
-    // 收集目录全部块地址
-    while (block_idx < 12) {
-        all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-    if (dir_inode->i_sectors[12]) {
-        ide_read(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-    }
-
     // 目录项大小
     uint32_t dir_entry_size = part->sb->dir_entry_size;
-    // 每个扇区可以存储的目录项数目
-    uint32_t dir_entrys_per_sec = (SECTOR_SIZE / dir_entry_size);
+    // 每个块可以存储的目录项数目
+    uint32_t dir_entrys_per_sec = dir_block_entries(dir_entry_size);
     // 目录项
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     // 找到的inode_no目录项
@@ -279,18 +363,19 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
     bool is_dir_first_block = false;
 
     // 1、遍历所有块,寻找目录项
-    for (block_idx = 0; block_idx < 140; block_idx++) {
+    for (uint32_t block_idx = 0; block_idx < DIR_MAX_BLOCKS; block_idx++) {
         is_dir_first_block = false;
-        if (all_blocks[block_idx] == 0) continue;
+        uint32_t block_lba = inode_bmap(part, dir_inode, block_idx);
+        if (block_lba == 0) continue;
 
         // 初始化
         uint8_t dir_entry_cnt = 0;
-        memset(io_buf, 0, SECTOR_SIZE);
+        memset(io_buf, 0, part->sb->block_size);
 
-        // 1.1、读取扇区,获得目录项
-        ide_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
+        // 1.1、读取块,获得目录项
+        bcache_read(part->my_disk, block_lba, io_buf, part->sb->block_sects);
 
-        // 1.2、遍历所有的目录项,统计该扇区的目录项数量及是否有待删除的目录项
+        // 1.2、遍历所有的目录项,统计该块的目录项数量及是否有待删除的目录项
         for (uint8_t dir_entry_idx = 0; dir_entry_idx < dir_entrys_per_sec; dir_entry_idx++) {
             if ((dir_e + dir_entry_idx)->f_type != FT_UNKNOWN) {
                 // 是否是目录的第一个块，检测是否是‘.‘或者’..’目录
@@ -299,7 +384,7 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
                 }
                 // 不是‘.‘或者’..’目录
                 else if (strcmp((dir_e + dir_entry_idx)->filename, ".") && strcmp((dir_e + dir_entry_idx)->filename, "..")) {
-                    // 统计此扇区内的目录项个数,用来判断删除目录项后是否回收该扇区
+                    // 统计此块内的目录项个数,用来判断删除目录项后是否回收该块
                     dir_entry_cnt++;
                     // 如果找到此i结点,就将其记录在dir_entry_found
                     if ((dir_e + dir_entry_idx)->i_no == inode_no) {
@@ -312,52 +397,30 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
             }
         }
 
-        // 1.3、若此扇区未找到该目录项,继续在下个扇区中找
+        // 1.3、若此块未找到该目录项,继续在下个块中找
         if (dir_entry_found == NULL) continue;
 
-        // 1.4、在此扇区中找到目录项后,清除该目录项并判断是否回收扇区,随后退出循环直接返回
+        // 1.4、在此块中找到目录项后,清除该目录项并判断是否回收块,随后退出循环直接返回
         ASSERT(dir_entry_cnt >= 1);
-        // 1.5、若除目录第1个扇区外,若该扇区上只有该目录项自己,则将整个扇区回收
-        if (dir_entry_cnt == 1 && !is_dir_first_block) {
+        dcache_remove(dir_inode->i_no, dir_entry_found->filename);
+        // 1.5、若除目录第1个块外,若该块上只有该目录项自己,则将整个块回收
+        // 有溢出标记的桶不能回收,否则查找溢出块中的目录项时会断掉
+        if (dir_entry_cnt == 1 && !is_dir_first_block && !dir_block_tail(io_buf)->overflow) {
             // 1.5.1、在块位图中回收该块
-            uint32_t block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-            bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-            // 1.5.2、将块地址从数组i_sectors或索引表中去掉
-            if (block_idx < 12) {
-                dir_inode->i_sectors[block_idx] = 0;
-            }
-            else {
-                uint32_t indirect_blocks = 0;
-                for (uint32_t i = 12; i < 140; i++) {
-                    if (all_blocks[i]) indirect_blocks++;
-                }
-
-                if (indirect_blocks > 1) {
-                    // 间接索引表中还包括其它间接块,仅在索引表中擦除当前这个间接块地址
-                    all_blocks[block_idx] = 0;
-                    ide_write(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-                }
-                else {
-                    // 间接索引表中就当前这1个间接块,直接把间接索引表所在的块回收,然后擦除间接索引表块地址
-                    block_bitmap_idx = dir_inode->i_sectors[12] - part->sb->data_start_lba;
-                    bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-                    bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-                    dir_inode->i_sectors[12] = 0;
-                }
-            }
+            block_bitmap_free(part, block_lba);
+            // 1.5.2、将块地址从数组i_sectors或索引表中去掉,索引表空了会一并回收
+            inode_bmap_set(part, dir_inode, block_idx, 0);
         }
         // 仅将该目录项清空
         else {
             memset(dir_entry_found, 0, dir_entry_size);
-            ide_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
+            journal_write(part, block_lba, io_buf, part->sb->block_sects);
         }
 
         // 更新i结点信息并同步到硬盘
         ASSERT(dir_inode->i_size >= dir_entry_size);
         dir_inode->i_size -= dir_entry_size;
-        inode_sync(part, dir_inode);
+        inode_mark_dirty(dir_inode);
 
         return true;
     }
@@ -373,36 +436,25 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
 struct dir_entry* dir_read(struct dir* dir) {
     struct dir_entry* dir_e = (struct dir_entry*)dir->dir_buf;
     struct inode* dir_inode = dir->inode;
-    uint32_t all_blocks[140] = { 0 };
-    uint32_t block_cnt = 12;
-    // 先处理直接块
-    for (uint8_t i = 0; i < 12; i++) {
-        all_blocks[i] = dir_inode->i_sectors[i];
-    }
-    // 若含有一级间接块表
-    if (dir_inode->i_sectors[12] != 0) {
-        ide_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-        block_cnt = 140;
-    }
-
     // 当前目录项的偏移,此项用来判断是否是之前已经返回过的目录项
     uint32_t cur_dir_entry_pos = 0;
     // 目录项大小
     uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
-    // 1扇区内可容纳的目录项个数
-    uint32_t dir_entrys_per_sec = SECTOR_SIZE / dir_entry_size;
+    // 1块内可容纳的目录项个数
+    uint32_t dir_entrys_per_sec = dir_block_entries(dir_entry_size);
     // 因为此目录内可能删除了某些文件或子目录,所以要遍历所有块
-    for (uint8_t block_idx = 0; block_idx < block_cnt; block_idx++) {
+    for (uint32_t block_idx = 0; block_idx < DIR_MAX_BLOCKS; block_idx++) {
         if (dir->dir_pos >= dir_inode->i_size) {
             return NULL;
         }
         // 如果此块地址为0,即空块,继续读出下一块
-        if (all_blocks[block_idx] == 0) {
+        uint32_t block_lba = inode_bmap(cur_part, dir_inode, block_idx);
+        if (block_lba == 0) {
             continue;
         }
-        memset(dir_e, 0, SECTOR_SIZE);
-        ide_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
-        // 遍历扇区内所有目录项
+        memset(dir_e, 0, cur_part->sb->block_size);
+        bcache_read(cur_part->my_disk, block_lba, dir_e, cur_part->sb->block_sects);
+        // 遍历块内所有目录项
         for (uint32_t dir_entry_idx = 0; dir_entry_idx < dir_entrys_per_sec; dir_entry_idx++) {
             if ((dir_e + dir_entry_idx)->f_type) {
                 // 如果f_type不等于0,即不等于FT_UNKNOWN
@@ -440,13 +492,8 @@ bool dir_is_empty(struct dir* dir) {
  */
 int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir) {
     struct inode* child_dir_inode = child_dir->inode;
-    // 空目录只在inode->i_sectors[0]中有扇区,其它扇区都应该为空
-    int32_t block_idx = 1;
-    while (block_idx < 13) {
-        ASSERT(child_dir_inode->i_sectors[block_idx] == 0);
-        block_idx++;
-    }
-    void* io_buf = sys_malloc(SECTOR_SIZE * 2);
+    // 空目录中带溢出标记的空桶不会在删除目录项时回收,这里由inode_release一起回收
+    void* io_buf = sys_malloc(cur_part->sb->block_size * 2);
     if (io_buf == NULL) {
         printk("dir_remove: malloc for io_buf failed\n");
         return -1;
@@ -455,6 +502,8 @@ int32_t dir_remove(struct dir* parent_dir, struct dir* child_dir) {
     // 在父目录parent_dir中删除子目录child_dir对应的目录项
     delete_dir_entry(cur_part, parent_dir, child_dir_inode->i_no, io_buf);
 
+    // inode编号马上会被复用,目录下的缓存项和指向它的缓存项都要去掉
+    dcache_purge_dir(child_dir_inode->i_no);
     // 回收inode中i_secotrs中所占用的扇区,并同步inode_bitmap和block_bitmap
     inode_release(cur_part, child_dir_inode->i_no);
     sys_free(io_buf);
@@ -18,12 +18,14 @@
 
 
 #define MAX_FILE_NAME_LEN  16	 // 最大文件名长度
+#define DIR_HASH_MAX       128   // 散列桶的最大个数,第k个桶就是目录的第k块
+#define DIR_OVERFLOW_FIRST DIR_HASH_MAX  // 桶数到顶以后,满了的桶溢出到这之后的块中
 
 /* 目录结构 */
 struct dir {
     struct inode* inode;
     uint32_t dir_pos;	        // 记录在目录内的偏移
-    uint8_t dir_buf[512];       // 目录的数据缓存
+    uint8_t dir_buf[BLOCK_SIZE_MAX];  // 目录的数据缓存,一个块大小
 };
 
 /* 目录项结构 */
@@ -33,12 +35,20 @@ struct dir_entry {
     enum file_types f_type;	           // 文件类型
 };
 
+/* 目录块末尾不够放一个目录项的几个字节,记录散列信息 */
+struct dir_block_tail {
+    uint32_t overflow;                 // 散列到本块的目录项有的放到了溢出块中
+    uint32_t reserved;
+};
+
 extern struct dir root_dir;             // 根目录
+extern struct slab_cache dir_cache;     // 打开的目录都从这里分配
 
 void open_root_dir(struct partition* part);
 struct dir* dir_open(struct partition* part, uint32_t inode_no);
 void dir_close(struct dir* dir);
 bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e);
+bool dir_lookup(struct partition* part, uint32_t dir_ino, const char* name, struct dir_entry* dir_e);
 void create_dir_entry(char* filename, uint32_t inode_no, uint8_t file_type, struct dir_entry* p_de);
 bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf);
 bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, void* io_buf);
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "fs.h"
 #include "ide.h"
+#include "bcache.h"
 #include "dir.h"
 #include "string.h"
 #include "memory.h"
@@ -21,6 +22,7 @@
 #include "inode.h"
 #include "interrupt.h"
 #include "super_block.h"
+#include "journal.h"
 
  // 文件表
 struct file file_table[MAX_FILE_OPEN];
@@ -69,7 +71,27 @@ int32_t inode_bitmap_alloc(struct partition* part) {
 }
 
 /**
- * @description: 分配1个扇区,返回其扇区地址
+ * @description: 块位图中第bit_idx位对应的块的起始扇区
+ * @param {partition*} part 分区
+ * @param {uint32_t} bit_idx 块位图中的位
+ * @return {*} 扇区地址
+ */
+uint32_t block_bit_to_lba(struct partition* part, uint32_t bit_idx) {
+    return part->sb->data_start_lba + bit_idx * part->sb->block_sects;
+}
+
+/**
+ * @description: 起始扇区为lba的块在块位图中的位
+ * @param {partition*} part 分区
+ * @param {uint32_t} lba 块的起始扇区
+ * @return {*} 块位图中的位
+ */
+uint32_t block_lba_to_bit(struct partition* part, uint32_t lba) {
+    return (lba - part->sb->data_start_lba) / part->sb->block_sects;
+}
+
+/**
+ * @description: 分配1个块,返回其起始扇区地址
  * @param {partition*} part 分区
  * @return {*} 扇区地址，失败返回-1
  */
@@ -79,11 +101,23 @@ int32_t block_bitmap_alloc(struct partition* part) {
         return -1;
     }
     bitmap_set(&part->block_bitmap, bit_idx, 1);
-    return (part->sb->data_start_lba + bit_idx);
+    return block_bit_to_lba(part, bit_idx);
 }
 
 /**
- * @description: 将内存中bitmap第bit_idx位所在的512字节同步到硬盘
+ * @description: 回收起始扇区为lba的1个块,并把位图同步到硬盘
+ * @param {partition*} part 分区
+ * @param {uint32_t} lba 块的起始扇区
+ * @return {*}
+ */
+void block_bitmap_free(struct partition* part, uint32_t lba) {
+    uint32_t bit_idx = block_lba_to_bit(part, lba);
+    bitmap_set(&part->block_bitmap, bit_idx, 0);
+    bitmap_sync(part, bit_idx, BLOCK_BITMAP);
+}
+
+/**
+ * @description: 记录内存中bitmap第bit_idx位所在的512字节需要同步到硬盘,真正的写回由bitmap_flush成批完成
  * @param {partition*} part 分区
  * @param {uint32_t} bit_idx 位图中低bit_idx位
  * @param {uint8_t} btmp_type 同步inode位图或者块位图
@@ -92,24 +126,126 @@ int32_t block_bitmap_alloc(struct partition* part) {
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp_type) {
     // 本i结点索引相对于位图的扇区偏移量
     uint32_t off_sec = bit_idx / 4096;
-    // 本i结点索引相对于位图的字节偏移量
-    uint32_t off_size = off_sec * BLOCK_SIZE;
-    uint32_t sec_lba;
-    uint8_t* bitmap_off;
-
     // 需要被同步到硬盘的位图只有inode_bitmap和block_bitmap
-    switch (btmp_type) {
-    case INODE_BITMAP:
-        sec_lba = part->sb->inode_bitmap_lba + off_sec;
-        bitmap_off = part->inode_bitmap.bits + off_size;
-        break;
+    struct bitmap* dirty = btmp_type == INODE_BITMAP ? &part->inode_bitmap_dirty : &part->block_bitmap_dirty;
+    if (!bitmap_scan_test(dirty, off_sec)) {
+        bitmap_set(dirty, off_sec, 1);
+        part->bitmap_dirty_sects++;
+    }
+}
 
-    case BLOCK_BITMAP:
-        sec_lba = part->sb->block_bitmap_lba + off_sec;
-        bitmap_off = part->block_bitmap.bits + off_size;
-        break;
+/* 把dirty中记录的位图脏扇区写回硬盘,连续的脏扇区一次写入 */
+static void bitmap_flush_dirty(struct partition* part, struct bitmap* btmp, struct bitmap* dirty, uint32_t btmp_lba) {
+    uint32_t sec_cnt = btmp->btmp_bytes_len / SECTOR_SIZE;
+    uint32_t sec_idx = 0;
+    while (sec_idx < sec_cnt) {
+        if (!bitmap_scan_test(dirty, sec_idx)) {
+            sec_idx++;
+            continue;
+        }
+        // 先清掉脏标记再写,写的过程中又被改动的扇区会重新标脏
+        uint32_t run = 0;
+        while (sec_idx + run < sec_cnt && bitmap_scan_test(dirty, sec_idx + run)) {
+            bitmap_set(dirty, sec_idx + run, 0);
+            part->bitmap_dirty_sects--;
+            run++;
+        }
+        // 位图经过日志写回,和同一批的inode、目录一起提交
+        journal_write(part, btmp_lba + sec_idx, btmp->bits + sec_idx * SECTOR_SIZE, run);
+        sec_idx += run;
     }
-    ide_write(part->my_disk, sec_lba, bitmap_off, 1);
+}
+
+/**
+ * @description: 将分区中所有被修改过的位图扇区写回硬盘,调用者要在fs_op_begin和fs_op_end之间
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void bitmap_flush(struct partition* part) {
+    bitmap_flush_dirty(part, &part->block_bitmap, &part->block_bitmap_dirty, part->sb->block_bitmap_lba);
+    bitmap_flush_dirty(part, &part->inode_bitmap, &part->inode_bitmap_dirty, part->sb->inode_bitmap_lba);
+}
+
+/**
+ * @description: 在块位图中从bit_idx起预留cnt个块,并同步涉及到的位图扇区
+ * @param {partition*} part 分区
+ * @param {uint32_t} bit_idx 起始位
+ * @param {uint32_t} cnt 块数
+ * @return {*}
+ */
+static void block_bitmap_reserve(struct partition* part, uint32_t bit_idx, uint32_t cnt) {
+    for (uint32_t idx = 0; idx < cnt; idx++) {
+        bitmap_set(&part->block_bitmap, bit_idx + idx, 1);
+    }
+    // 连续的位最多跨越两个位图扇区
+    bitmap_sync(part, bit_idx, BLOCK_BITMAP);
+    if ((bit_idx + cnt - 1) / 4096 != bit_idx / 4096) {
+        bitmap_sync(part, bit_idx + cnt - 1, BLOCK_BITMAP);
+    }
+}
+
+/**
+ * @description: 为文件分配一个数据块,优先从预分配窗口中取,窗口用完时在goal_lba处预留一段连续的块
+ * @param {file*} file 文件
+ * @param {uint32_t} goal_lba 希望分配到的块,一般是文件上一个块之后紧挨着的块,为0表示没有要求
+ * @return {*} 块的起始扇区地址,失败返回-1
+ */
+static int32_t file_block_alloc(struct file* file, uint32_t goal_lba) {
+    if (file->pa_cnt == 0) {
+        struct partition* part = cur_part;
+        uint32_t bit_len = part->block_bitmap.btmp_bytes_len * 8;
+        int32_t bit_idx = -1;
+        uint32_t cnt = 0;
+        // 先尝试紧接着文件的上一个块往后预留,这样文件在硬盘上是连续的
+        if (goal_lba >= part->sb->data_start_lba) {
+            uint32_t goal_bit = block_lba_to_bit(part, goal_lba);
+            while (cnt < PREALLOC_BLOCKS && goal_bit + cnt < bit_len && \
+                !bitmap_scan_test(&part->block_bitmap, goal_bit + cnt)) {
+                cnt++;
+            }
+            if (cnt > 0) bit_idx = goal_bit;
+        }
+        // 再找一段完整的空闲窗口,找不到就退回到单个块
+        if (bit_idx == -1) {
+            cnt = PREALLOC_BLOCKS;
+            bit_idx = bitmap_scan(&part->block_bitmap, cnt);
+        }
+        if (bit_idx == -1) {
+            cnt = 1;
+            bit_idx = bitmap_scan(&part->block_bitmap, cnt);
+        }
+        if (bit_idx == -1) return -1;
+        block_bitmap_reserve(part, bit_idx, cnt);
+        file->pa_lba = block_bit_to_lba(part, bit_idx);
+        file->pa_cnt = cnt;
+    }
+    uint32_t lba = file->pa_lba;
+    file->pa_cnt--;
+    file->pa_lba += cur_part->sb->block_sects;
+    return lba;
+}
+
+/* 将预分配窗口中没有用掉的块还给块位图 */
+static void file_prealloc_release(struct file* file) {
+    if (file->pa_cnt == 0) return;
+    uint32_t bit_idx = block_lba_to_bit(cur_part, file->pa_lba);
+    for (uint32_t idx = 0; idx < file->pa_cnt; idx++) {
+        bitmap_set(&cur_part->block_bitmap, bit_idx + idx, 0);
+    }
+    bitmap_sync(cur_part, bit_idx, BLOCK_BITMAP);
+    if ((bit_idx + file->pa_cnt - 1) / 4096 != bit_idx / 4096) {
+        bitmap_sync(cur_part, bit_idx + file->pa_cnt - 1, BLOCK_BITMAP);
+    }
+    file->pa_cnt = 0;
+}
+
+/* 从all_blocks[block_idx]起统计扇区连续的块数,最多max_cnt个,每块block_sects个扇区 */
+static uint32_t block_run_len(uint32_t* all_blocks, uint32_t block_idx, uint32_t max_cnt, uint32_t block_sects) {
+    uint32_t cnt = 1;
+    while (cnt < max_cnt && all_blocks[block_idx + cnt] == all_blocks[block_idx] + cnt * block_sects) {
+        cnt++;
+    }
+    return cnt;
 }
 
 /**
@@ -121,7 +257,7 @@ void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp_type) {
  */
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     // 后续操作的公共缓冲区
-    void* io_buf = sys_malloc(1024);
+    void* io_buf = sys_malloc(cur_part->sb->block_size * 2);
     // 申请内存失败
     if (io_buf == NULL) {
         printk("in file_creat: sys_malloc for io_buf failed\n");
@@ -138,19 +274,12 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
         return -1;
     }
 
-    // 想要让这个inode节点被所有线程共享，只能在高1GB的内核空间，所以先降页表置为空
-    struct task_struct* cur = running_thread();
-    // 获取页表的旧地址
-    uint32_t* cur_pagedir_bak = cur->pgdir;
-    cur->pgdir = NULL;
-    // 此时申请的内存在内核地址池
-    struct inode* new_file_inode  = (struct inode*)sys_malloc(sizeof(struct inode));
-    // 页表的旧地址赋值
-    cur->pgdir = cur_pagedir_bak;
+    // inode要被所有线程共享,inode_cache的对象都在高1GB的内核空间
+    struct inode* new_file_inode = (struct inode*)slab_alloc(&inode_cache);
 
     // 失败则回滚
     if (new_file_inode == NULL) {
-        printk("file_create: sys_malloc for inode failded\n");
+        printk("file_create: alloc for inode failded\n");
         rollback_step = 1;
         goto rollback;
     }
@@ -171,6 +300,9 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     file_table[fd_idx].fd_inode = new_file_inode;
     file_table[fd_idx].fd_pos = 0;
     file_table[fd_idx].fd_flag = flag;
+    file_table[fd_idx].ra_next = 0;
+    file_table[fd_idx].ra_size = 0;
+    file_table[fd_idx].pa_cnt = 0;
     file_table[fd_idx].fd_inode->write_deny = false;
 
     // 生成目录项，并初始化
@@ -190,25 +322,22 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
         goto rollback;
     }
 
-    // 2、将父目录i结点的内容同步到硬盘
-    inode_sync(cur_part, parent_dir->inode);
+    // 2、父目录i结点被修改,等待写回
+    inode_mark_dirty(parent_dir->inode);
 
-    // 3、将新创建文件的i结点内容同步到硬盘
-    inode_sync(cur_part, new_file_inode);
+    // 3、新创建文件的i结点等待写回
+    inode_mark_dirty(new_file_inode);
 
-    // 4、将inode_bitmap位图同步到硬盘
+    // 4、将inode_bitmap位图标记为等待写回
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
-    // 5、将创建的文件i结点添加到open_inodes链表
-    list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
+    // 5、将创建的文件i结点添加到inode表,打开inode节点数变为1
+    inode_table_add(cur_part, new_file_inode);
 
-    // 6、将打开inode节点数变为1
-    new_file_inode->i_open_cnts = 1;
-
-    // 7、释放缓冲区
+    // 6、释放缓冲区
     sys_free(io_buf);
 
-    // 8、将描述符安装到当前线程的描述符表中
+    // 7、将描述符安装到当前线程的描述符表中
     return pcb_fd_install(fd_idx);
 
     // 失败会跳转到这里回滚
@@ -220,7 +349,7 @@ rollback:
         // fall through
     case 2:
         // 释放生成的inode节点
-        sys_free(new_file_inode);
+        slab_free(&inode_cache, new_file_inode);
         // fall through
     case 1:
         // 如果新文件的i结点创建失败,之前位图中分配的inode_no也要恢复
@@ -251,6 +380,10 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
     file_table[fd_idx].fd_pos = 0;
     // 将文件权限置为flag
     file_table[fd_idx].fd_flag = flag;
+    // 预读状态清零,从头读时按顺序读处理
+    file_table[fd_idx].ra_next = 0;
+    file_table[fd_idx].ra_size = 0;
+    file_table[fd_idx].pa_cnt = 0;
     // 获得写文件标志位的指正
     bool* write_deny = &file_table[fd_idx].fd_inode->write_deny;
 
@@ -283,9 +416,11 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
  */
 int32_t file_close(struct file* file) {
     if (file == NULL) return -1;
+    // 预分配但没有用到的块还给位图
+    file_prealloc_release(file);
     // 将写的位置为false
     file->fd_inode->write_deny = false;
-    // 关闭inode节点
+    // 关闭inode节点,延迟的元数据和脏数据由sys_close在操作结束后提交
     inode_close(file->fd_inode);
     // 使文件结构可用
     file->fd_inode = NULL;
@@ -301,214 +436,131 @@ int32_t file_close(struct file* file) {
  * @return {*} 写入的字节数，失败返回-1
  */
 int32_t file_write(struct file* file, const void* buf, uint32_t count) {
-    // 文件目前最大只支持512*140=71680字节
-    if ((file->fd_inode->i_size + count) > (BLOCK_SIZE * 140)) {
-        printk("file_write: exceed max file_size 71680 bytes\n");
+    struct inode* inode = file->fd_inode;
+    uint32_t block_size = cur_part->sb->block_size;
+    uint32_t block_sects = cur_part->sb->block_sects;
+    // 三级间接块能寻址的块数随块大小增长,文件大小还受i_size为32位的限制
+    uint32_t max_blocks = inode_max_blocks(cur_part);
+    uint64_t max_size = (uint64_t)max_blocks * block_size;
+    if (max_size > 0xffffffff) max_size = 0xffffffff;
+    if (count > max_size - inode->i_size) {
+        printk("file_write: exceed max file_size %d blocks\n", max_blocks);
         return -1;
     }
-    // 一个扇区的缓存
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    // 一个块的缓存
+    uint8_t* io_buf = slab_alloc(&io_buf_cache);
     if (io_buf == NULL) {
-        printk("file_write: sys_malloc for io_buf failed\n");
+        printk("file_write: alloc for io_buf failed\n");
         return -1;
     }
-    // 记录所有的块地址的缓存
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
-    if (all_blocks == NULL) {
-        printk("file_write: sys_malloc for all_blocks failed\n");
+    // 一批块的扇区地址
+    uint32_t* blocks = (uint32_t*)sys_malloc(FILE_MAP_BATCH * sizeof(uint32_t));
+    if (blocks == NULL) {
+        printk("file_write: sys_malloc for blocks failed\n");
+        slab_free(&io_buf_cache, io_buf);
         return -1;
     }
 
     const uint8_t* src = buf;	    // 用src指向buf中待写入的数据 
     uint32_t bytes_written = 0;	    // 用来记录已写入数据大小
-    uint32_t size_left = count;	    // 用来记录未写入数据大小
-    int32_t block_lba = -1;	        // 块地址
-    uint32_t block_bitmap_idx = 0;  // 用来记录block对应于block_bitmap中的索引,做为参数传给bitmap_sync
-    uint32_t sec_idx;	            // 用来索引扇区
-    uint32_t sec_lba;	            // 扇区地址
+    uint32_t size_left;	            // 用来记录未写入数据大小
+    uint32_t sec_idx;	            // 本批次内的块下标
     uint32_t sec_off_bytes;         // 扇区内字节偏移量
     uint32_t sec_left_bytes;        // 扇区内剩余字节量
     uint32_t chunk_size;	        // 每次写入硬盘的数据块大小
-    int32_t indirect_block_table;   // 用来获取一级间接表地址
-    uint32_t block_idx;		        // 块索引
-
-    // 判断文件是否是第一次写,如果是,先为其分配一个块
-    if (file->fd_inode->i_sectors[0] == 0) {
-        block_lba = block_bitmap_alloc(cur_part);
-        if (block_lba == -1) {
-            printk("file_write: block_bitmap_alloc failed\n");
-            return -1;
-        }
-        file->fd_inode->i_sectors[0] = block_lba;
-
-        // 每分配一个块就将位图同步到硬盘
-        block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-    }
-
-    // 写入count个字节前,该文件已经占用的块数 
-    uint32_t file_has_used_blocks = file->fd_inode->i_size / BLOCK_SIZE + 1;
-    // 存储count字节后该文件将占用的块数
-    uint32_t file_will_use_blocks = (file->fd_inode->i_size + count) / BLOCK_SIZE + 1;
-    if (file_will_use_blocks > 140) {
-        printk("file_write: buf is more than 140 blocks\n");
-        return -1;
-    }
-
-    // 通过此增量判断是否需要分配扇区,如增量为0,表示原扇区够用
-    uint32_t add_blocks = file_will_use_blocks - file_has_used_blocks;
-
-    // 若不需要增加扇区
-    if (add_blocks == 0) {
-        // 文件数据量将在12块之内
-        if (file_has_used_blocks <= 12) {
-            block_idx = file_has_used_blocks - 1;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        }
-        // 文件数据量将在12块之外
-        else {
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+    bool failed = false;            // 分配块或者写硬盘失败
+
+    file->fd_pos = inode->i_size - 1;
+    // 每次查好一批块的扇区地址再写,缺少的块紧接着前一个块分配
+    while (bytes_written < count && !failed) {
+        // 每批块分成一段,大的写入不会超出给一个操作预留的事务空间
+        if (bytes_written > 0) {
+            inode_mark_dirty(inode);
+            fs_op_restart(cur_part);
         }
-    }
-    // 若需要增加扇区则分为三种情况
-    else {
-        // 12个直接块够用
-        if (file_will_use_blocks <= 12) {
-            // 先将有剩余空间的可继续用的扇区地址写入all_blocks
-            block_idx = file_has_used_blocks - 1;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 再将未来要用的扇区分配好后写入all_blocks
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-                    return -1;
+        uint32_t start_idx = inode->i_size / block_size;
+        uint32_t end_idx = (inode->i_size + (count - bytes_written) - 1) / block_size;
+        if (end_idx - start_idx >= FILE_MAP_BATCH) end_idx = start_idx + FILE_MAP_BATCH - 1;
+
+        uint32_t prev_lba = start_idx > 0 ? inode_bmap(cur_part, inode, start_idx - 1) : 0;
+        uint32_t map_cnt = 0;
+        for (uint32_t block_idx = start_idx; block_idx <= end_idx; block_idx++) {
+            uint32_t block_lba = inode_bmap(cur_part, inode, block_idx);
+            if (block_lba == 0) {
+                // 改动的位图多了就在分配前分段,已经映射的块还在i_size之外,分段处是一致的
+                inode_mark_dirty(inode);
+                fs_op_checkpoint(cur_part);
+                int32_t new_lba = file_block_alloc(file, prev_lba == 0 ? 0 : prev_lba + block_sects);
+                if (new_lba == -1) {
+                    printk("file_write: block_bitmap_alloc failed\n");
+                    failed = true;
+                    break;
                 }
-
-                // 写文件时,不应该存在块未使用但已经分配扇区的情况,当文件删除时,就会把块地址清0
-                ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-                file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
-
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-                // 下一个分配的新扇区
-                block_idx++;
+                if (inode_bmap_set(cur_part, inode, block_idx, new_lba) != 0) {
+                    printk("file_write: map block %d failed\n", block_idx);
+                    block_bitmap_free(cur_part, new_lba);
+                    failed = true;
+                    break;
+                }
+                block_lba = new_lba;
             }
+            blocks[map_cnt++] = block_lba;
+            prev_lba = block_lba;
         }
-        // 第二种情况: 旧数据在12个直接块内,新数据将使用间接块
-        else if (file_has_used_blocks <= 12 && file_will_use_blocks > 12) {
-            // 先将有剩余空间的可继续用的扇区地址收集到all_blocks 
-            block_idx = file_has_used_blocks - 1;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-            // 创建一级间接块表
-            block_lba = block_bitmap_alloc(cur_part);
-            if (block_lba == -1) {
-                printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                return -1;
+
+        // 写已经有扇区的这部分块
+        uint32_t map_end = (start_idx + map_cnt) * block_size;
+        while (bytes_written < count && inode->i_size < map_end) {
+            sec_idx = inode->i_size / block_size - start_idx;
+            sec_off_bytes = inode->i_size % block_size;
+            sec_left_bytes = block_size - sec_off_bytes;
+            size_left = count - bytes_written;
+
+            int32_t ret;
+            if (sec_off_bytes == 0 && size_left >= block_size) {
+                // 写整块时,扇区连续的块一次写入,不经过io_buf
+                uint32_t run_max = size_left / block_size;
+                if (run_max > map_cnt - sec_idx) run_max = map_cnt - sec_idx;
+                uint32_t run_blocks = block_run_len(blocks, sec_idx, run_max, block_sects);
+                chunk_size = run_blocks * block_size;
+                ret = bcache_write(cur_part->my_disk, blocks[sec_idx], (void*)src, run_blocks * block_sects);
             }
-            // 确保一级间接块表未分配
-            ASSERT(file->fd_inode->i_sectors[12] == 0);
-            // 分配一级间接块索引表
-            indirect_block_table = file->fd_inode->i_sectors[12] = block_lba;
-            // 第一个未使用的块,即本文件最后一个已经使用的直接块的下一块
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-                    return -1;
+            else {
+                // 判断此次写入硬盘的数据大小
+                chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
+                memset(io_buf, 0, block_size);
+                // 块中已有数据时先读出来,再拼上新数据
+                ret = 0;
+                if (sec_off_bytes != 0) {
+                    ret = bcache_read(cur_part->my_disk, blocks[sec_idx], io_buf, block_sects);
                 }
-                // 新创建的0~11块直接存入all_blocks数组
-                if (block_idx < 12) {
-                    // 确保尚未分配扇区地址
-                    ASSERT(file->fd_inode->i_sectors[block_idx] == 0);
-                    file->fd_inode->i_sectors[block_idx] = all_blocks[block_idx] = block_lba;
+                if (ret == 0) {
+                    memcpy(io_buf + sec_off_bytes, src, chunk_size);
+                    ret = bcache_write(cur_part->my_disk, blocks[sec_idx], io_buf, block_sects);
                 }
-                // 间接块只写入到all_block数组中,待全部分配完成后一次性同步到硬盘
-                else {
-                    all_blocks[block_idx] = block_lba;
-                }
-
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-                // 下一个新扇区
-                block_idx++;
             }
-            // 同步一级间接块表到硬盘
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-        // 第三种情况:新数据占据间接块
-        else if (file_has_used_blocks > 12) {
-            // 已经具备了一级间接块表
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            // 获取一级间接表地址
-            indirect_block_table = file->fd_inode->i_sectors[12];
-
-            // 已使用的间接块也将被读入all_blocks,无须单独收录
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-            // 第一个未使用的间接块,即已经使用的间接块的下一块
-            block_idx = file_has_used_blocks;
-            while (block_idx < file_will_use_blocks) {
-                block_lba = block_bitmap_alloc(cur_part);
-                if (block_lba == -1) {
-                    printk("file_write: block_bitmap_alloc for situation 3 failed\n");
-                    return -1;
-                }
-                all_blocks[block_idx++] = block_lba;
-
-                // 每分配一个块就将位图同步到硬盘
-                block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-                bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+            if (ret != 0) {
+                printk("file_write: write block %d failed\n", start_idx + sec_idx);
+                failed = true;
+                break;
             }
-            // 同步一级间接块表到硬盘
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-    }
-
-    // 含有剩余空间的扇区标识
-    bool first_write_block = true;
-    // 块地址已经收集到all_blocks中,下面开始写数据 
-    file->fd_pos = file->fd_inode->i_size - 1;
-    // 直到写完所有数据
-    while (bytes_written < count) {
-        memset(io_buf, 0, BLOCK_SIZE);
-        sec_idx = file->fd_inode->i_size / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-
-        // 判断此次写入硬盘的数据大小
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
-        if (first_write_block) {
-            ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-            first_write_block = false;
+            // 将指针推移到下个新数据
+            src += chunk_size;
+            // 更新文件大小
+            inode->i_size += chunk_size;
+            // 更新文件指针
+            file->fd_pos += chunk_size;
+            // 更新已写入数据
+            bytes_written += chunk_size;
         }
-        memcpy(io_buf + sec_off_bytes, src, chunk_size);
-        ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
-        //调试,完成后去掉
-        printk("file write at lba 0x%x\n", sec_lba);
-        // 将指针推移到下个新数据
-        src += chunk_size;
-        // 更新文件大小
-        file->fd_inode->i_size += chunk_size;
-        // 更新文件指针
-        file->fd_pos += chunk_size;
-        // 更新已写入数据
-        bytes_written += chunk_size;
-        // 更新未写入数据
-        size_left -= chunk_size;
     }
-    // 更新文件的inode信息
-    inode_sync(cur_part, file->fd_inode);
+    // 文件的inode信息等关闭或者刷新时再写回
+    inode_mark_dirty(inode);
     // 释放内存
-    sys_free(all_blocks);
-    sys_free(io_buf);
+    sys_free(blocks);
+    slab_free(&io_buf_cache, io_buf);
+    // 写了一部分时返回已写入的字节数
+    if (failed && bytes_written == 0) return -1;
     return bytes_written;
 }
 
@@ -522,119 +574,126 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
  * @return {*}
  */
 int32_t file_read(struct file* file, void* buf, uint32_t count) {
+    struct inode* inode = file->fd_inode;
     uint8_t* buf_dst = (uint8_t*)buf;
-    uint32_t size = count, size_left = size;
+    uint32_t size = count, size_left;
 
     // 若要读取的字节数超过了文件可读的剩余量, 就用剩余量做为待读取的字节数
-    if ((file->fd_pos + count) > file->fd_inode->i_size) {
-        size = file->fd_inode->i_size - file->fd_pos;
-        size_left = size;
+    if ((file->fd_pos + count) > inode->i_size) {
+        size = inode->i_size - file->fd_pos;
         if (size == 0) {
             // 若到文件尾则返回-1
             return -1;
         }
     }
 
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
-    if (io_buf == NULL) {
-        printk("file_read: sys_malloc for io_buf failed\n");
-    }
-    // 用来记录文件所有的块地址
-    uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
-    if (all_blocks == NULL) {
-        printk("file_read: sys_malloc for all_blocks failed\n");
+    uint32_t block_size = cur_part->sb->block_size;
+    uint32_t block_sects = cur_part->sb->block_sects;
+    // 只有首尾不完整的块需要经过io_buf中转,用到时再申请
+    uint8_t* io_buf = NULL;
+    // 一批块的扇区地址
+    uint32_t* blocks = (uint32_t*)sys_malloc(FILE_MAP_BATCH * sizeof(uint32_t));
+    if (blocks == NULL) {
+        printk("file_read: sys_malloc for blocks failed\n");
         return -1;
     }
 
     // 数据所在块的起始地址
-    uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE;
-    // 数据所在块的终止地址
-    uint32_t block_read_end_idx = (file->fd_pos + size) / BLOCK_SIZE;
-    // 如增量为0,表示数据在同一扇区
-    uint32_t read_blocks = block_read_start_idx - block_read_end_idx;
-    // 确保在最大数据范围内
-    ASSERT(block_read_start_idx < 139 && block_read_end_idx < 139);
-    // 用来获取一级间接表地址
-    int32_t indirect_block_table;
-    // 获取待读的块地址 
-    uint32_t block_idx;
-
-    // 以下开始构建all_blocks块地址数组,专门存储用到的块地址(本程序中块大小同扇区大小)
-    if (read_blocks == 0) {
-        // 在同一扇区内读数据,不涉及到跨扇区读取
-        ASSERT(block_read_end_idx == block_read_start_idx);
-        if (block_read_end_idx < 12) {
-            // 待读的数据在12个直接块之内
-            block_idx = block_read_end_idx;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-        }
-        else {
-            // 若用到了一级间接块表,需要将表中间接块读进来
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
+    uint32_t block_read_start_idx = file->fd_pos / block_size;
+    // 数据所在的最后一个块
+    uint32_t block_read_end_idx = (file->fd_pos + size - 1) / block_size;
+
+    // 从上次读到的块接着读就认为是顺序读,预读窗口翻倍,否则关闭预读
+    if (block_read_start_idx == file->ra_next) {
+        file->ra_size = file->ra_size == 0 ? READ_AHEAD_MIN : file->ra_size * 2;
+        if (file->ra_size > READ_AHEAD_MAX) file->ra_size = READ_AHEAD_MAX;
     }
-    // 若要读多个块
     else {
-        // 第一种情况: 起始块和终止块属于直接块
-        if (block_read_end_idx < 12) {
-            // 数据结束所在的块属于直接块
-            block_idx = block_read_start_idx;
-            while (block_idx <= block_read_end_idx) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-        }
-        // 第二种情况: 待读入的数据跨越直接块和间接块两类
-        else if (block_read_start_idx < 12 && block_read_end_idx >= 12) {    
-            block_idx = block_read_start_idx;
-            while (block_idx < 12) {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
+        file->ra_size = 0;
+    }
+    // 下次顺序读开始的块,本次停在块中间时还是最后一个块
+    file->ra_next = (file->fd_pos + size) / block_size;
+    // 从最后一个块的下一块开始预读,预读到的最后一个块不超过文件末尾
+    uint32_t file_blocks = DIV_ROUND_UP(inode->i_size, block_size);
+    uint32_t block_ra_end_idx = block_read_end_idx + file->ra_size;
+    if (block_ra_end_idx >= file_blocks) block_ra_end_idx = file_blocks - 1;
+
+    // 预读窗口里的块只提交请求不等待,下次顺序读时就在缓存中了,没有分配的块跳过
+    if (block_ra_end_idx > block_read_end_idx) {
+        // 块缓存一次最多预读BCACHE_PREFETCH_MAX个扇区,大块时窗口按扇区数截断
+        uint32_t ra_lbas[BCACHE_PREFETCH_MAX];
+        uint32_t ra_cnt = 0;
+        for (uint32_t block_idx = block_read_end_idx + 1; block_idx <= block_ra_end_idx; block_idx++) {
+            if (ra_cnt + block_sects > BCACHE_PREFETCH_MAX) break;
+            uint32_t block_lba = inode_bmap(cur_part, inode, block_idx);
+            if (block_lba == 0) continue;
+            for (uint32_t sec_idx = 0; sec_idx < block_sects; sec_idx++) {
+                ra_lbas[ra_cnt++] = block_lba + sec_idx;
             }
-            // 确保已经分配了一级间接块表
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            // 再将间接块地址写入all_blocks
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            // 将一级间接块表读进来写入到第13个块的位置之后
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-        // 第三种情况: 数据在间接块中
-        else {
-            // 确保已经分配了一级间接块表
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-            // 获取一级间接表地址
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            // 将一级间接块表读进来写入到第13个块的位置之后
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);	      
         }
+        if (ra_cnt > 0) bcache_readahead(cur_part->my_disk, ra_lbas, ra_cnt);
     }
 
-    // 用到的块地址已经收集到all_blocks中,下面开始读数据
-    uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
+    // 每次查好一批块的扇区地址再读
+    uint32_t sec_idx, sec_off_bytes, sec_left_bytes, chunk_size;
     uint32_t bytes_read = 0;
-    // 直到读完为止
-    while (bytes_read < size) {
-        sec_idx = file->fd_pos / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-        // 待读入的数据大小
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
-
-        memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-        memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
-
-        buf_dst += chunk_size;
-        file->fd_pos += chunk_size;
-        bytes_read += chunk_size;
-        size_left -= chunk_size;
+    bool failed = false;
+    while (bytes_read < size && !failed) {
+        uint32_t start_idx = file->fd_pos / block_size;
+        uint32_t end_idx = (file->fd_pos + (size - bytes_read) - 1) / block_size;
+        if (end_idx - start_idx >= FILE_MAP_BATCH) end_idx = start_idx + FILE_MAP_BATCH - 1;
+        uint32_t map_cnt = end_idx - start_idx + 1;
+        for (uint32_t idx = 0; idx < map_cnt; idx++) {
+            blocks[idx] = inode_bmap(cur_part, inode, start_idx + idx);
+        }
+
+        uint32_t map_end = (end_idx + 1) * block_size;
+        while (bytes_read < size && file->fd_pos < map_end) {
+            sec_idx = file->fd_pos / block_size - start_idx;
+            sec_off_bytes = file->fd_pos % block_size;
+            sec_left_bytes = block_size - sec_off_bytes;
+            size_left = size - bytes_read;
+
+            int32_t ret = 0;
+            if (blocks[sec_idx] == 0) {
+                // 没有分配扇区的块读出来是0
+                chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
+                memset(buf_dst, 0, chunk_size);
+            }
+            else if (sec_off_bytes == 0 && size_left >= block_size) {
+                // 读整块时,扇区连续的块由硬盘直接读入buf,不经过io_buf也不装入块缓存
+                uint32_t max_blocks = size_left / block_size;
+                if (max_blocks > map_cnt - sec_idx) max_blocks = map_cnt - sec_idx;
+                uint32_t run_blocks = block_run_len(blocks, sec_idx, max_blocks, block_sects);
+                chunk_size = run_blocks * block_size;
+                ret = bcache_read_direct(cur_part->my_disk, blocks[sec_idx], buf_dst, run_blocks * block_sects);
+            }
+            else {
+                // 待读入的数据大小
+                chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
+                if (io_buf == NULL) io_buf = slab_alloc(&io_buf_cache);
+                if (io_buf == NULL) {
+                    printk("file_read: alloc for io_buf failed\n");
+                    failed = true;
+                    break;
+                }
+                ret = bcache_read(cur_part->my_disk, blocks[sec_idx], io_buf, block_sects);
+                if (ret == 0) memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
+            }
+            if (ret != 0) {
+                printk("file_read: read block %d failed\n", start_idx + sec_idx);
+                failed = true;
+                break;
+            }
+
+            buf_dst += chunk_size;
+            file->fd_pos += chunk_size;
+            bytes_read += chunk_size;
+        }
     }
-    sys_free(all_blocks);
-    sys_free(io_buf);
+    sys_free(blocks);
+    if (io_buf != NULL) slab_free(&io_buf_cache, io_buf);
+    // 读了一部分时返回已读出的字节数
+    if (failed && bytes_read == 0) return -1;
     return bytes_read;
 }
-
-
-
@@ -19,11 +19,25 @@
 // 系统可打开的最大文件数
 #define MAX_FILE_OPEN 32    
 
+// 预读窗口的最小和最大块数,顺序读时窗口从最小值开始翻倍增长
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 64
+
+// 写文件时一次预留的连续块数
+#define PREALLOC_BLOCKS 16
+
+// 读写文件时一次查好扇区地址的块数
+#define FILE_MAP_BATCH 128
+
 /* 文件结构 */
 struct file {
     uint32_t fd_pos;          // 记录当前文件操作的偏移地址,以0为起始,最大为文件大小-1
     uint32_t fd_flag;         // 权限      
     struct inode* fd_inode;   // 当前文件对应的inode节点指针
+    uint32_t ra_next;         // 顺序读时下一次读取的起始块
+    uint32_t ra_size;         // 当前预读窗口的块数,为0表示不预读
+    uint32_t pa_lba;          // 预分配窗口中下一个可用的块
+    uint32_t pa_cnt;          // 预分配窗口中剩余的块数,关闭文件时还给位图
 };
 
 /* 标准输入输出描述符 */
@@ -43,9 +57,13 @@ enum bitmap_type {
 extern struct file file_table[MAX_FILE_OPEN];
 
 int32_t inode_bitmap_alloc(struct partition* part);
+uint32_t block_bit_to_lba(struct partition* part, uint32_t bit_idx);
+uint32_t block_lba_to_bit(struct partition* part, uint32_t lba);
 int32_t block_bitmap_alloc(struct partition* part);
+void block_bitmap_free(struct partition* part, uint32_t lba);
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag);
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp);
+void bitmap_flush(struct partition* part);
 int32_t get_free_slot_in_global(void);
 int32_t pcb_fd_install(int32_t globa_fd_idx);
 int32_t file_open(uint32_t inode_no, uint8_t flag);
@@ -1,5 +1,6 @@
 #include "fs.h"
 #include "ide.h"
+#include "bcache.h"
 #include "dir.h"
 #include "file.h"
 #include "cmos.h"
@@ -13,9 +14,20 @@
 #include "ioqueue.h"
 #include "keyboard.h"
 #include "super_block.h"
+#include "journal.h"
+#include "dcache.h"
+#include "thread.h"
+#include "sync.h"
+#include "interrupt.h"
+#include "mmap.h"
 
 // 默认情况下的操作分区
 struct partition* cur_part;
+// 读写一个块用的缓冲区,挂载分区后按块大小初始化
+struct slab_cache io_buf_cache;
+
+// 后台刷新线程睡在这里,周期到了或者有人催促时醒来
+static struct semaphore flusher_wakeup;
 
 /**
  * @description: 在分区链表中找到名为part_name的分区,并将其指针赋值给cur_part
@@ -41,17 +53,20 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
         // 初始化buf
         memset(sb_buf, 0, SECTOR_SIZE);
         // 读入超级块
-        ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
+        bcache_read(hd, cur_part->start_lba + 1, sb_buf, 1);
         // 把sb_buf中超级块的信息复制到分区的超级块sb中
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
 
+        // 先加载日志,重放没有写回的事务,之后读入的位图才是最新的
+        journal_load(cur_part);
+
         // 将块位图读入内存
         cur_part->block_bitmap.bits = (uint8_t*)sys_malloc(sb_buf->block_bitmap_sects * SECTOR_SIZE);
         if (cur_part->block_bitmap.bits == NULL) {
             PANIC("alloc memory failed!");
         }
         cur_part->block_bitmap.btmp_bytes_len = sb_buf->block_bitmap_sects * SECTOR_SIZE;
-        ide_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_sects);
+        bcache_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_sects);
 
         // 将inode位图读入内存
         cur_part->inode_bitmap.bits = (uint8_t*)sys_malloc(sb_buf->inode_bitmap_sects * SECTOR_SIZE);
@@ -59,10 +74,24 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
             PANIC("alloc memory failed!");
         }
         cur_part->inode_bitmap.btmp_bytes_len = sb_buf->inode_bitmap_sects * SECTOR_SIZE;
-        ide_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
+        bcache_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
+
+        // 位图的脏扇区记录,位图修改后先只在这里记一下,操作结束时由fs_op_end成批写进事务
+        cur_part->block_bitmap_dirty.btmp_bytes_len = DIV_ROUND_UP(sb_buf->block_bitmap_sects, 8);
+        cur_part->block_bitmap_dirty.bits = (uint8_t*)sys_malloc(cur_part->block_bitmap_dirty.btmp_bytes_len);
+        cur_part->inode_bitmap_dirty.btmp_bytes_len = DIV_ROUND_UP(sb_buf->inode_bitmap_sects, 8);
+        cur_part->inode_bitmap_dirty.bits = (uint8_t*)sys_malloc(cur_part->inode_bitmap_dirty.btmp_bytes_len);
+        if (cur_part->block_bitmap_dirty.bits == NULL || cur_part->inode_bitmap_dirty.bits == NULL) {
+            PANIC("alloc memory failed!");
+        }
+        bitmap_init(&cur_part->block_bitmap_dirty);
+        bitmap_init(&cur_part->inode_bitmap_dirty);
+        cur_part->bitmap_dirty_sects = 0;
 
-        // 初始化以打开inode链表
-        list_init(&cur_part->open_inodes);
+        // 初始化inode表
+        inode_table_init(cur_part);
+        // 元数据操作锁,刷新线程只在操作之间提交事务
+        lock_init(&cur_part->meta_lock);
 
         // 打印挂载成功
         printk("mount %s done!\n", part->name);
@@ -75,11 +104,18 @@ static bool mount_partition(struct list_elem* pelem, int arg) {
 }
 
 /**
- * @description: 格式化分区,也就是初始化分区的元信息,创建文件系统
+ * @description: 格式化分区,也就是初始化分区的元信息,创建文件系统,数据区按block_size字节的块分配
  * @param {partition*} part 分区
+ * @param {uint32_t} block_size 块字节大小,512/1024/2048/4096之一,不合法时用FS_BLOCK_SIZE
  * @return {*}
  */
-static void partition_format(struct partition* part) {
+static void partition_format(struct partition* part, uint32_t block_size) {
+    if (block_size < BLOCK_SIZE_MIN || block_size > BLOCK_SIZE_MAX || (block_size & (block_size - 1)) != 0) {
+        printk("partition_format: bad block size %d, use %d\n", block_size, FS_BLOCK_SIZE);
+        block_size = FS_BLOCK_SIZE;
+    }
+    // 每块的扇区数
+    uint32_t block_sects = block_size / SECTOR_SIZE;
     // 导引块占一个块
     uint32_t boot_sector_sects = 1;
     // 超级块占一个块
@@ -88,15 +124,17 @@ static void partition_format(struct partition* part) {
     uint32_t inode_bitmap_sects = DIV_ROUND_UP(MAX_FILES_PER_PART, BITS_PER_SECTOR);
     // inode占的块数
     uint32_t inode_table_sects = DIV_ROUND_UP(((sizeof(struct inode) * MAX_FILES_PER_PART)), SECTOR_SIZE);
+    // 元数据日志占的块数
+    uint32_t journal_sects = JOURNAL_SECTS;
     // 已使用的块数
-    uint32_t used_sects = boot_sector_sects + super_block_sects + inode_bitmap_sects + inode_table_sects;
-    // 空闲块数
+    uint32_t used_sects = boot_sector_sects + super_block_sects + inode_bitmap_sects + inode_table_sects + journal_sects;
+    // 空闲扇区数
     uint32_t free_sects = part->sec_cnt - used_sects;
-    // 空闲块位图占据的扇区数
+    // 空闲块位图占据的扇区数,位图中每一位对应一个块
     uint32_t block_bitmap_sects;
-    block_bitmap_sects = DIV_ROUND_UP(free_sects, BITS_PER_SECTOR);
+    block_bitmap_sects = DIV_ROUND_UP(free_sects / block_sects, BITS_PER_SECTOR);
     // block_bitmap_bit_len是位图中位的长度,也是可用块的数量
-    uint32_t block_bitmap_bit_len = free_sects - block_bitmap_sects;
+    uint32_t block_bitmap_bit_len = (free_sects - block_bitmap_sects) / block_sects;
     block_bitmap_sects = DIV_ROUND_UP(block_bitmap_bit_len, BITS_PER_SECTOR);
 
 
@@ -113,9 +151,13 @@ static void partition_format(struct partition* part) {
     sb.inode_bitmap_sects = inode_bitmap_sects;
     sb.inode_table_lba = sb.inode_bitmap_lba + sb.inode_bitmap_sects;
     sb.inode_table_sects = inode_table_sects;
-    sb.data_start_lba = sb.inode_table_lba + sb.inode_table_sects;
+    sb.journal_lba = sb.inode_table_lba + sb.inode_table_sects;
+    sb.journal_sects = journal_sects;
+    sb.data_start_lba = sb.journal_lba + sb.journal_sects;
     sb.root_inode_no = 0;
     sb.dir_entry_size = sizeof(struct dir_entry);
+    sb.block_size = block_size;
+    sb.block_sects = block_sects;
 
     printk("%s info:\n", part->name);
     printk("magic:0x%x\n   \
@@ -128,7 +170,10 @@ static void partition_format(struct partition* part) {
             inode_bitmap_sectors:0x%x\n   \
             inode_table_lba:0x%x\n   \
             inode_table_sectors:0x%x\n   \
-            data_start_lba:0x%x\n", \
+            journal_lba:0x%x\n   \
+            journal_sectors:0x%x\n   \
+            data_start_lba:0x%x\n   \
+            block_size:%d\n", \
         sb.magic, \
         sb.part_lba_base, \
         sb.sec_cnt, \
@@ -139,18 +184,23 @@ static void partition_format(struct partition* part) {
         sb.inode_bitmap_sects, \
         sb.inode_table_lba, \
         sb.inode_table_sects, \
-        sb.data_start_lba);
+        sb.journal_lba, \
+        sb.journal_sects, \
+        sb.data_start_lba, \
+        sb.block_size);
 
     // 拿到硬盘的指针
     struct disk* hd = part->my_disk;
     // 将超级块写入本分区的第一扇区
-    ide_write(hd, part->start_lba + 1, &sb, 1);
+    bcache_write(hd, part->start_lba + 1, &sb, 1);
     // 超级块的lba
     printk("   super_block_lba:0x%x\n", part->start_lba + 1);
 
     // 找出数据量最大的元信息,用其尺寸做存储缓冲区
     uint32_t buf_size = (sb.block_bitmap_sects >= sb.inode_bitmap_sects ? sb.block_bitmap_sects : sb.inode_bitmap_sects);
     buf_size = (buf_size >= sb.inode_table_sects ? buf_size : sb.inode_table_sects) * SECTOR_SIZE;
+    // 至少要放得下根目录的一个块
+    if (buf_size < block_size) buf_size = block_size;
     // 申请的内存由内存管理系统清0后返回
     uint8_t* buf = (uint8_t*)sys_malloc(buf_size);
     // 将块位图初始化并写入sb.block_bitmap_lba,第0个块留给根目录
@@ -165,14 +215,14 @@ static void partition_format(struct partition* part) {
         buf[block_bitmap_last_byte] &= ~(1 << bit_idx);
     }
     // 写入块位图
-    ide_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
+    bcache_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
 
     // 清空缓冲区
     memset(buf, 0, buf_size);
     // 第0个inode节点是根目录
     buf[0] |= 0x01;
     // 写入inode节点位图，这里直接写入的原因是一共就支持4096个节点，正好一个扇区
-    ide_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
+    bcache_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
 
     // 清空缓冲区
     memset(buf, 0, buf_size);
@@ -182,7 +232,7 @@ static void partition_format(struct partition* part) {
     inode->i_size = sb.dir_entry_size * 2;
     // 修改第0个inode的节点编号
     inode->i_no = 0;
-    // 修改第0个inode的第一个扇区指针
+    // 修改第0个inode的第一个块指针
     inode->i_sectors[0] = sb.data_start_lba;
     // 修改第0个inode的时间
     inode->ctime = get_time();
@@ -191,7 +241,10 @@ static void partition_format(struct partition* part) {
     // 修改第0个inode的权限
     inode->privilege = 4;
     // 写入inode数组
-    ide_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+    bcache_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+
+    // 初始化元数据日志区
+    journal_format(hd, sb.journal_lba);
 
     // 写入根目录的两个目录项.和..
     // 清空缓冲区
@@ -208,7 +261,7 @@ static void partition_format(struct partition* part) {
     p_de->i_no = 0;   // 根目录的父目录依然是根目录自己
     p_de->f_type = FT_DIRECTORY;
     // 将目录项写入硬盘
-    ide_write(hd, sb.data_start_lba, buf, 1);
+    bcache_write(hd, sb.data_start_lba, buf, block_sects);
 
     // 完成了一个分区的全部初始化工作，释放buf
     printk("   root_dir_lba:0x%x\n", sb.data_start_lba);
@@ -262,6 +315,11 @@ int32_t path_depth_cnt(char* pathname) {
     return depth;
 }
 
+/* 打开search_file找到的目录,根目录常驻内存不用再打开 */
+static struct dir* search_dir_open(uint32_t inode_no) {
+    return inode_no == cur_part->sb->root_inode_no ? &root_dir : dir_open(cur_part, inode_no);
+}
+
 /**
  * @description: 搜索文件pathname,若找到则返回其inode号,否则返回-1
  * @param {char*} pathname 路径名
@@ -286,18 +344,18 @@ int32_t search_file(const char* pathname, struct path_search_record* searched_re
 
     // 子路径    
     char* sub_path = (char*)pathname;
-    // 根目录
-    struct dir* parent_dir = &root_dir;
     // 目录项
     struct dir_entry dir_e;
     // 解析出来的各级路径
     char name[MAX_FILE_NAME_LEN] = { 0 };
     // 设置父目录
-    searched_record->parent_dir = parent_dir;
+    searched_record->parent_dir = &root_dir;
     // 设置文件类型为未知
     searched_record->file_type = FT_UNKNOWN;
+    // 中间各级目录只记inode编号,目录项缓存命中时不用打开目录,最后才打开直接父目录
+    uint32_t dir_inode_no = cur_part->sb->root_inode_no;
     // 父目录的inode号
-    uint32_t parent_inode_no = 0;
+    uint32_t parent_inode_no = dir_inode_no;
     // 将最上层路劲解析出来给name，同事sub_path指针指向下一个目录
     sub_path = path_parse(sub_path, name);
     // 若第一个字符就是结束符,结束循环
@@ -307,7 +365,7 @@ int32_t search_file(const char* pathname, struct path_search_record* searched_re
         strcat(searched_record->searched_path, "/");
         strcat(searched_record->searched_path, name);
         // 在所给的目录中查找文件
-        if (search_dir_entry(cur_part, parent_dir, name, &dir_e)) {
+        if (dir_lookup(cur_part, dir_inode_no, name, &dir_e)) {
             memset(name, 0, MAX_FILE_NAME_LEN);
             // 若sub_path不等于NULL,也就是未结束时继续拆分路径
             if (sub_path) {
@@ -316,17 +374,15 @@ int32_t search_file(const char* pathname, struct path_search_record* searched_re
             // 如果被打开的是目录
             if (FT_DIRECTORY == dir_e.f_type) {
                 // 父目录的inode编号
-                parent_inode_no = parent_dir->inode->i_no;
-                // 关闭当前目录
-                dir_close(parent_dir);
-                // 更新父目录
-                parent_dir = dir_open(cur_part, dir_e.i_no);
-                // 将新的父目录记录在结构体
-                searched_record->parent_dir = parent_dir;
+                parent_inode_no = dir_inode_no;
+                // 更新当前目录
+                dir_inode_no = dir_e.i_no;
                 continue;
             }
             // 被打开的是普通文件
             else if (FT_REGULAR == dir_e.f_type) {
+                // 打开文件所在的目录记录在结构体
+                searched_record->parent_dir = search_dir_open(dir_inode_no);
                 // 更新搜索路径的文件类型
                 searched_record->file_type = FT_REGULAR;
                 // 直接返回路径的inode编号
@@ -334,28 +390,23 @@ int32_t search_file(const char* pathname, struct path_search_record* searched_re
             }
         }
         else {
-            // 找不到目录项时,要留着parent_dir不要关闭,若是创建新文件的话需要在parent_dir中创建
+            // 找不到目录项时,要打开parent_dir留给调用者,若是创建新文件的话需要在parent_dir中创建
+            searched_record->parent_dir = search_dir_open(dir_inode_no);
             return -1;
         }
     }
 
     // 执行到此,必然是遍历了完整路径并且最后一项不是文件而是目录。
-    dir_close(searched_record->parent_dir);
     // 保存被查找目录的直接父目录
-    searched_record->parent_dir = dir_open(cur_part, parent_inode_no);
+    searched_record->parent_dir = search_dir_open(parent_inode_no);
     // 搜索路径的文件类型置为目录
     searched_record->file_type = FT_DIRECTORY;
     // 返回目录项的inode
     return dir_e.i_no;
 }
 
-/**
- * @description: 打开或创建文件成功后,返回文件描述符,否则返回-1
- * @param {char*} pathname 路径
- * @param {uint8_t} flags 打开标识，只读，只写，读写，创建 只支持文件打开，不支持目录打开,以/结尾的都是目录
- * @return {*}
- */
-int32_t sys_open(const char* pathname, uint8_t flags) {
+/* sys_open的实现,在元数据操作中调用 */
+static int32_t open_path(const char* pathname, uint8_t flags) {
     // 如果结尾是 ‘/’ 则最后是目录
     if (pathname[strlen(pathname) - 1] == '/') {
         printk("sys_open error: can`t open a directory %s\n", pathname);
@@ -429,6 +480,20 @@ int32_t sys_open(const char* pathname, uint8_t flags) {
     return fd;
 }
 
+/**
+ * @description: 打开或创建文件成功后,返回文件描述符,否则返回-1
+ * @param {char*} pathname 路径
+ * @param {uint8_t} flags 打开标识，只读，只写，读写，创建 只支持文件打开，不支持目录打开,以/结尾的都是目录
+ * @return {*}
+ */
+int32_t sys_open(const char* pathname, uint8_t flags) {
+    // 查找和创建放在同一个操作中,别人不会在中间创建同名文件
+    fs_op_begin(cur_part);
+    int32_t fd = open_path(pathname, flags);
+    fs_op_end(cur_part);
+    return fd;
+}
+
 /**
  * @description: 将文件描述符转化为文件表的下标
  * @param {uint32_t} local_fd 本地的文件描述符下标
@@ -451,14 +516,115 @@ int32_t sys_close(int32_t fd) {
     int32_t ret = -1;
     if (fd > 2) {
         uint32_t _fd = fd_local2global(fd);
-        // 关闭文件
+        // 关闭文件,可能要归还预分配的块和写回inode
+        fs_op_begin(cur_part);
         ret = file_close(&file_table[_fd]);
+        fs_op_end(cur_part);
+        // 操作结束后才能提交,把关闭前的修改写回硬盘
+        fs_sync(cur_part);
         // 使该文件描述符位可用
         running_thread()->fd_table[fd] = -1;
     }
     return ret;
 }
 
+/**
+ * @description: 开始一个修改元数据的操作.操作之间以及操作和fs_sync之间互斥,最外层的操作在日志中预留事务空间.
+ *               同一个线程可以嵌套
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void fs_op_begin(struct partition* part) {
+    lock_acquire(&part->meta_lock);
+    if (part->meta_lock.holder_repeat_nr == 1) journal_begin(part);
+}
+
+/**
+ * @description: 结束fs_op_begin开始的操作,最外层的操作结束时把这次改动的位图和inode写进事务
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void fs_op_end(struct partition* part) {
+    if (part->meta_lock.holder_repeat_nr == 1) {
+        bitmap_flush(part);
+        inode_flush(part);
+        journal_end(part);
+    }
+    lock_release(&part->meta_lock);
+}
+
+/**
+ * @description: 把长操作在这里分成两段,前一段的改动和之后的改动可能落在不同的事务中,
+ *               调用处的元数据必须是一致的,崩溃时最多泄漏块和inode.嵌套在别的操作中时什么都不做
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void fs_op_restart(struct partition* part) {
+    ASSERT(part->meta_lock.holder == running_thread());
+    if (part->meta_lock.holder_repeat_nr != 1) return;
+    bitmap_flush(part);
+    inode_flush(part);
+    journal_end(part);
+    journal_begin(part);
+}
+
+/**
+ * @description: 长操作每改动一步位图后调用,改动的位图扇区快到预留的上限时就在这里分段
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void fs_op_checkpoint(struct partition* part) {
+    if (part->bitmap_dirty_sects + JOURNAL_OP_BITMAP_STEP > JOURNAL_OP_BITMAP_SECTS) {
+        fs_op_restart(part);
+    }
+}
+
+/**
+ * @description: 提交当前事务,再写回块缓存中的脏数据.只在操作之间提交,不能在fs_op_begin和fs_op_end之间调用
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void fs_sync(struct partition* part) {
+    ASSERT(part->meta_lock.holder != running_thread());
+    lock_acquire(&part->meta_lock);
+    journal_commit(part);
+    bcache_flush(part->my_disk);
+    lock_release(&part->meta_lock);
+}
+
+/**
+ * @description: 催促后台刷新线程尽快提交,已经催过的不再重复
+ * @return {*}
+ */
+void fs_flusher_wakeup(void) {
+    enum intr_status old_status = intr_disable();
+    if (flusher_wakeup.value == 0) sema_up(&flusher_wakeup);
+    intr_set_status(old_status);
+}
+
+/**
+ * @description: 把文件描述符fd对应文件的修改写回硬盘,成功返回0,失败返回-1
+ * @param {int32_t} fd 文件描述符
+ * @return {*}
+ */
+int32_t sys_fsync(int32_t fd) {
+    if (fd <= 2 || fd >= MAX_FILES_OPEN_PER_PROC || running_thread()->fd_table[fd] == -1) {
+        printk("sys_fsync: fd error\n");
+        return -1;
+    }
+    // 分配块时位图和目录都可能被改动,整个分区一起刷新
+    fs_sync(cur_part);
+    return 0;
+}
+
+/* 后台刷新线程,周期性地把延迟的元数据写回硬盘 */
+static void fs_flusher(void* arg UNUSED) {
+    while (1) {
+        sema_down_timeout(&flusher_wakeup, FS_FLUSH_TICKS);
+        fs_sync(cur_part);
+    }
+}
+
 /**
  * @description: 将buf中连续count个字节写入文件描述符fd,成功则返回写入的字节数,失败返回-1
  * @param {int32_t} fd 文件描述符
@@ -477,10 +643,17 @@ int32_t sys_write(int32_t fd, const void* buf, uint32_t count) {
         console_put_str(tmp_buf);
         return count;
     }
+    // 缓冲区中还没有调入的映射页先调入
+    if (!vm_prefault(buf, count, false)) {
+        console_put_str("sys_write: bad buffer\n");
+        return -1;
+    }
     uint32_t _fd = fd_local2global(fd);
     struct file* wr_file = &file_table[_fd];
     if (wr_file->fd_flag & O_WRONLY || wr_file->fd_flag & O_RDWR) {
+        fs_op_begin(cur_part);
         uint32_t bytes_written = file_write(wr_file, buf, count);
+        fs_op_end(cur_part);
         return bytes_written;
     }
     else {
@@ -502,7 +675,12 @@ int32_t sys_read(int32_t fd, void* buf, uint32_t count) {
         printk("sys_read: fd error\n");
         return -1;
     }
-    else if (fd == stdin_no) {
+    // 缓冲区中还没有调入的映射页先调入,只读的映射区不能作为读入的目标
+    if (!vm_prefault(buf, count, true)) {
+        printk("sys_read: bad buffer\n");
+        return -1;
+    }
+    if (fd == stdin_no) {
         char* buffer = buf;
         uint32_t bytes_read = 0;
         while (bytes_read < count) {
@@ -561,12 +739,8 @@ int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence) {
     return pf->fd_pos;
 }
 
-/**
- * @description: 删除文件(非目录),成功返回0,失败返回-1
- * @param {char*} pathname 地址
- * @return {*}
- */
-int32_t sys_unlink(const char* pathname) {
+/* sys_unlink的实现,在元数据操作中调用 */
+static int32_t unlink_path(const char* pathname) {
     ASSERT(strlen(pathname) < MAX_PATH_LEN);
 
     // 1、先检查待删除的文件是否存在
@@ -600,7 +774,7 @@ int32_t sys_unlink(const char* pathname) {
     }
 
     // 3、为delete_dir_entry申请缓冲区
-    void* io_buf = sys_malloc(SECTOR_SIZE + SECTOR_SIZE);
+    void* io_buf = sys_malloc(cur_part->sb->block_size * 2);
     if (io_buf == NULL) {
         dir_close(searched_record.parent_dir);
         printk("sys_unlink: malloc for io_buf failed\n");
@@ -616,19 +790,27 @@ int32_t sys_unlink(const char* pathname) {
     sys_free(io_buf);
     // 6、关闭父目录
     dir_close(searched_record.parent_dir);
-    // 7、成功删除文件 
+    // 7、成功删除文件,元信息由后台线程成批提交
     return 0;
 }
 
 /**
- * @description: 创建目录pathname,成功返回0,失败返回-1
+ * @description: 删除文件(非目录),成功返回0,失败返回-1
  * @param {char*} pathname 地址
  * @return {*}
  */
-int32_t sys_mkdir(const char* pathname) {
+int32_t sys_unlink(const char* pathname) {
+    fs_op_begin(cur_part);
+    int32_t ret = unlink_path(pathname);
+    fs_op_end(cur_part);
+    return ret;
+}
+
+/* sys_mkdir的实现,在元数据操作中调用 */
+static int32_t mkdir_path(const char* pathname) {
     // 用于操作失败时回滚各资源状态
     uint8_t rollback_step = 0;
-    void* io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void* io_buf = sys_malloc(cur_part->sb->block_size * 2);
     if (io_buf == NULL) {
         printk("sys_mkdir: sys_malloc for io_buf failed\n");
         return -1;
@@ -685,12 +867,12 @@ int32_t sys_mkdir(const char* pathname) {
     }
     new_dir_inode.i_sectors[0] = block_lba;
     // 每分配一个块就将位图同步到硬盘
-    block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
+    block_bitmap_idx = block_lba_to_bit(cur_part, block_lba);
     ASSERT(block_bitmap_idx != 0);
     bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
 
     // 将当前目录的目录项'.'和'..'写入目录
-    memset(io_buf, 0, SECTOR_SIZE * 2);
+    memset(io_buf, 0, cur_part->sb->block_size * 2);
     struct dir_entry* p_de = (struct dir_entry*)io_buf;
 
     // 初始化当前目录"."
@@ -703,7 +885,7 @@ int32_t sys_mkdir(const char* pathname) {
     memcpy(p_de->filename, "..", 2);
     p_de->i_no = parent_dir->inode->i_no;
     p_de->f_type = FT_DIRECTORY;
-    ide_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
+    journal_write(cur_part, new_dir_inode.i_sectors[0], io_buf, cur_part->sb->block_sects);
 
     new_dir_inode.i_size = 2 * cur_part->sb->dir_entry_size;
 
@@ -711,7 +893,7 @@ int32_t sys_mkdir(const char* pathname) {
     struct dir_entry new_dir_entry;
     memset(&new_dir_entry, 0, sizeof(struct dir_entry));
     create_dir_entry(dirname, inode_no, FT_DIRECTORY, &new_dir_entry);
-    memset(io_buf, 0, SECTOR_SIZE * 2);
+    memset(io_buf, 0, cur_part->sb->block_size * 2);
     // sync_dir_entry中将block_bitmap通过bitmap_sync同步到硬盘
     if (!sync_dir_entry(parent_dir, &new_dir_entry, io_buf)) {
         printk("sys_mkdir: sync_dir_entry to disk failed!\n");
@@ -721,18 +903,19 @@ int32_t sys_mkdir(const char* pathname) {
 
     sys_free(io_buf);
 
-    // 父目录的inode同步到硬盘
-    inode_sync(cur_part, parent_dir->inode);
+    // 父目录的inode等待写回
+    inode_mark_dirty(parent_dir->inode);
 
-    // 将新创建目录的inode同步到硬盘
+    // 新创建目录的inode不在inode表中,直接同步
     inode_sync(cur_part, &new_dir_inode);
 
-    // 将inode位图同步到硬盘
+    // 将inode位图标记为等待写回
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
     // 关闭所创建目录的父目录
     dir_close(searched_record.parent_dir);
 
+    // 元信息由后台线程成批提交
     return 0;
 
     // 创建文件或目录需要创建相关的多个资源,若某步失败则会执行到下面的回滚步骤
@@ -753,11 +936,19 @@ rollback:
 }
 
 /**
- * @description: 目录打开成功后返回目录指针,失败返回NULL
- * @param {char*} name 打开的目录路径
+ * @description: 创建目录pathname,成功返回0,失败返回-1
+ * @param {char*} pathname 地址
  * @return {*}
  */
-struct dir* sys_opendir(const char* name) {
+int32_t sys_mkdir(const char* pathname) {
+    fs_op_begin(cur_part);
+    int32_t ret = mkdir_path(pathname);
+    fs_op_end(cur_part);
+    return ret;
+}
+
+/* sys_opendir的实现,在元数据操作中调用 */
+static struct dir* opendir_path(const char* name) {
     ASSERT(strlen(name) < MAX_PATH_LEN);
     // 如果是根目录'/',直接返回&root_dir
     if (name[0] == '/' && (name[1] == 0 || name[0] == '.')) {
@@ -789,6 +980,19 @@ struct dir* sys_opendir(const char* name) {
     return ret;
 }
 
+/**
+ * @description: 目录打开成功后返回目录指针,失败返回NULL
+ * @param {char*} name 打开的目录路径
+ * @return {*}
+ */
+struct dir* sys_opendir(const char* name) {
+    // 查找放在操作中,和修改目录的操作互斥,不会把过时的查找结果放进目录项缓存
+    fs_op_begin(cur_part);
+    struct dir* dir = opendir_path(name);
+    fs_op_end(cur_part);
+    return dir;
+}
+
 /**
  * @description: 成功关闭目录dir返回0,失败返回-1
  * @param {dir*} dir
@@ -828,6 +1032,7 @@ void sys_rewinddir(struct dir* dir) {
  * @return {*}
  */
 int32_t sys_rmdir(const char* pathname) {
+    fs_op_begin(cur_part);
     // 先检查待删除的文件是否存在
     struct path_search_record searched_record;
     memset(&searched_record, 0, sizeof(struct path_search_record));
@@ -857,6 +1062,7 @@ int32_t sys_rmdir(const char* pathname) {
         }
     }
     dir_close(searched_record.parent_dir);
+    fs_op_end(cur_part);
     return retval;
 }
 
@@ -872,7 +1078,7 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void* io_buf) {
     uint32_t block_lba = child_dir_inode->i_sectors[0];
     ASSERT(block_lba >= cur_part->sb->data_start_lba);
     inode_close(child_dir_inode);
-    ide_read(cur_part->my_disk, block_lba, io_buf, 1);
+    bcache_read(cur_part->my_disk, block_lba, io_buf, cur_part->sb->block_sects);
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     // 第0个目录项是".",第1个目录项是".."
     ASSERT(dir_e[1].i_no < 4096 && dir_e[1].f_type == FT_DIRECTORY);
@@ -890,61 +1096,45 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void* io_buf) {
  */
 static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char* path, void* io_buf) {
     struct inode* parent_dir_inode = inode_open(cur_part, p_inode_nr);
-    // 填充all_blocks,将该目录的所占扇区地址全部写入all_blocks
-    uint8_t block_idx = 0;
-    uint32_t all_blocks[140] = { 0 }, block_cnt = 12;
-    while (block_idx < 12) {
-        all_blocks[block_idx] = parent_dir_inode->i_sectors[block_idx];
-        block_idx++;
-    }
-    if (parent_dir_inode->i_sectors[12]) {
-        // 若包含了一级间接块表,将共读入all_blocks.
-        ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
-        block_cnt = 140;
-    }
-    inode_close(parent_dir_inode);
-
     struct dir_entry* dir_e = (struct dir_entry*)io_buf;
     uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
-    uint32_t dir_entrys_per_sec = (512 / dir_entry_size);
-    block_idx = 0;
+    uint32_t dir_entrys_per_sec = (cur_part->sb->block_size - sizeof(struct dir_block_tail)) / dir_entry_size;
     /* 遍历所有块 */
-    while (block_idx < block_cnt) {
-        if (all_blocks[block_idx]) {
-            // 如果相应块不为空则读入相应块
-            ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-            uint8_t dir_e_idx = 0;
-            // 遍历每个目录项
-            while (dir_e_idx < dir_entrys_per_sec) {
-                if ((dir_e + dir_e_idx)->i_no == c_inode_nr) {
-                    strcat(path, "/");
-                    strcat(path, (dir_e + dir_e_idx)->filename);
-                    return 0;
-                }
-                dir_e_idx++;
+    for (uint32_t block_idx = 0; block_idx < DIR_MAX_BLOCKS; block_idx++) {
+        uint32_t block_lba = inode_bmap(cur_part, parent_dir_inode, block_idx);
+        if (block_lba == 0) continue;
+        // 如果相应块不为空则读入相应块
+        bcache_read(cur_part->my_disk, block_lba, io_buf, cur_part->sb->block_sects);
+        uint32_t dir_e_idx = 0;
+        // 遍历每个目录项
+        while (dir_e_idx < dir_entrys_per_sec) {
+            if ((dir_e + dir_e_idx)->i_no == c_inode_nr) {
+                // 记入目录项缓存,下次getcwd可以直接反查名字.持有元数据锁,读到的目录项不会过时
+                ASSERT(cur_part->meta_lock.holder == running_thread());
+                dcache_add(p_inode_nr, (dir_e + dir_e_idx)->filename, dir_e + dir_e_idx);
+                strcat(path, "/");
+                strcat(path, (dir_e + dir_e_idx)->filename);
+                inode_close(parent_dir_inode);
+                return 0;
             }
+            dir_e_idx++;
         }
-        block_idx++;
     }
+    inode_close(parent_dir_inode);
     return -1;
 }
 
-/**
- * @description: 把当前工作目录绝对路径写入buf, size是buf的大小。当buf为NULL时,由操作系统分配存储工作路径的空间并返回地址,
- * @param {char*} buf
- * @param {uint32_t} size
- * @return {*} 失败则返回NULL
- */
-char* sys_getcwd(char* buf, uint32_t size) {
+/* sys_getcwd的实现,在元数据操作中调用 */
+static char* getcwd_path(char* buf, uint32_t size) {
     // 确保buf不为空,若用户进程提供的buf为NULL, 系统调用getcwd中要为用户进程通过malloc分配内存
     ASSERT(buf != NULL);
-    void* io_buf = sys_malloc(SECTOR_SIZE);
+    void* io_buf = slab_alloc(&io_buf_cache);
     if (io_buf == NULL) {
         return NULL;
     }
 
     struct task_struct* cur_thread = running_thread();
-    int32_t parent_inode_nr = 0;
+    uint32_t parent_inode_nr = 0;
     int32_t child_inode_nr = cur_thread->cwd_inode_nr;
     // 最大支持4096个inode
     ASSERT(child_inode_nr >= 0 && child_inode_nr < 4096);
@@ -958,15 +1148,24 @@ char* sys_getcwd(char* buf, uint32_t size) {
     memset(buf, 0, size);
     // 用来做全路径缓冲区
     char full_path_reverse[MAX_PATH_LEN] = { 0 };
+    // 从目录项缓存中反查到的名字
+    char name[MAX_FILE_NAME_LEN + 1];
 
     /* 从下往上逐层找父目录,直到找到根目录为止.
      * 当child_inode_nr为根目录的inode编号(0)时停止,
      * 即已经查看完根目录中的目录项 */
     while ((child_inode_nr)) {
+        // 缓存中有这一级的父目录和名字就不用读硬盘
+        if (dcache_lookup_name(child_inode_nr, &parent_inode_nr, name)) {
+            strcat(full_path_reverse, "/");
+            strcat(full_path_reverse, name);
+            child_inode_nr = parent_inode_nr;
+            continue;
+        }
         parent_inode_nr = get_parent_dir_inode_nr(child_inode_nr, io_buf);
         if (get_child_dir_name(parent_inode_nr, child_inode_nr, full_path_reverse, io_buf) == -1) {
             // 或未找到名字,失败退出
-            sys_free(io_buf);
+            slab_free(&io_buf_cache, io_buf);
             return NULL;
         }
         child_inode_nr = parent_inode_nr;
@@ -983,16 +1182,25 @@ char* sys_getcwd(char* buf, uint32_t size) {
         // 在full_path_reverse中添加结束字符,做为下一次执行strcpy中last_slash的边界
         *last_slash = 0;
     }
-    sys_free(io_buf);
+    slab_free(&io_buf_cache, io_buf);
     return buf;
 }
 
 /**
- * @description: 更改当前工作目录为绝对路径path,成功则返回0,失败返回-1
- * @param {char*} path
- * @return {*}
+ * @description: 把当前工作目录绝对路径写入buf, size是buf的大小。当buf为NULL时,由操作系统分配存储工作路径的空间并返回地址,
+ * @param {char*} buf
+ * @param {uint32_t} size
+ * @return {*} 失败则返回NULL
  */
-int32_t sys_chdir(const char* path) {
+char* sys_getcwd(char* buf, uint32_t size) {
+    fs_op_begin(cur_part);
+    char* ret = getcwd_path(buf, size);
+    fs_op_end(cur_part);
+    return ret;
+}
+
+/* sys_chdir的实现,在元数据操作中调用 */
+static int32_t chdir_path(const char* path) {
     int32_t ret = -1;
     struct path_search_record searched_record;
     memset(&searched_record, 0, sizeof(struct path_search_record));
@@ -1011,12 +1219,19 @@ int32_t sys_chdir(const char* path) {
 }
 
 /**
- * @description: 在buf中填充文件结构相关信息,
- * @param {char*} path 路径
- * @param {stat*} buf buf中填充文件结构相关信息
- * @return {*} 成功时返回0,失败返回-1
+ * @description: 更改当前工作目录为绝对路径path,成功则返回0,失败返回-1
+ * @param {char*} path
+ * @return {*}
  */
-int32_t sys_stat(const char* path, struct stat* buf) {
+int32_t sys_chdir(const char* path) {
+    fs_op_begin(cur_part);
+    int32_t ret = chdir_path(path);
+    fs_op_end(cur_part);
+    return ret;
+}
+
+/* sys_stat的实现,在元数据操作中调用 */
+static int32_t stat_path(const char* path, struct stat* buf) {
     // 若直接查看根目录'/'
     if (!strcmp(path, "/") || !strcmp(path, "/.") || !strcmp(path, "/..")) {
         buf->st_filetype = FT_DIRECTORY;
@@ -1047,6 +1262,42 @@ int32_t sys_stat(const char* path, struct stat* buf) {
     return ret;
 }
 
+/**
+ * @description: 在buf中填充文件结构相关信息,
+ * @param {char*} path 路径
+ * @param {stat*} buf buf中填充文件结构相关信息
+ * @return {*} 成功时返回0,失败返回-1
+ */
+int32_t sys_stat(const char* path, struct stat* buf) {
+    fs_op_begin(cur_part);
+    int32_t ret = stat_path(path, buf);
+    fs_op_end(cur_part);
+    return ret;
+}
+
+/**
+ * @description: 打印inode缓存、块缓存和目录项缓存的命中统计
+ * @return {*}
+ */
+void sys_cachestat(void) {
+    struct inode_stat ist;
+    struct bcache_stat bst;
+    struct dcache_stat dst;
+    inode_get_stat(cur_part, &ist);
+    bcache_get_stat(&bst);
+    dcache_get_stat(&dst);
+
+    char line[128];
+    sprintf(line, "inode   hits %d misses %d evictions %d open %d cached %d\n", \
+        ist.hits, ist.misses, ist.evictions, ist.open_cnt, ist.cached_cnt);
+    sys_write(stdout_no, line, strlen(line));
+    sprintf(line, "bcache  hits %d misses %d evictions %d writebacks %d direct %d\n", \
+        bst.hits, bst.misses, bst.evictions, bst.writebacks, bst.direct_reads);
+    sys_write(stdout_no, line, strlen(line));
+    sprintf(line, "dcache  hits %d negative %d misses %d\n", dst.hits, dst.negative_hits, dst.misses);
+    sys_write(stdout_no, line, strlen(line));
+}
+
 /**
  * @description: 向屏幕输出一个字符
  * @param {char} char_asci
@@ -1061,6 +1312,14 @@ void sys_putchar(char char_asci) {
  * @return {*}
  */
 void filesys_init() {
+    // 挂载之后写元数据就可能催促刷新线程,先把信号量准备好
+    sema_init(&flusher_wakeup, 0);
+    // 路径解析要用目录项缓存
+    dcache_init();
+    // inode和目录频繁打开关闭,放在各自的cache中重用,都在内核空间,所有进程共享
+    slab_cache_init(&inode_cache, "inode", sizeof(struct inode), NULL);
+    slab_cache_init(&icache_cache, "icache", sizeof(struct indirect_cache), NULL);
+    slab_cache_init(&dir_cache, "dir", sizeof(struct dir), NULL);
     // sb_buf用来存储从硬盘上读入的超级块
     struct super_block* sb_buf = (struct super_block*)sys_malloc(SECTOR_SIZE);
     for (uint8_t channel_no = 0; channel_no < channel_cnt; channel_no++) {
@@ -1080,18 +1339,22 @@ void filesys_init() {
                     // 初始化buf
                     memset(sb_buf, 0, SECTOR_SIZE);
                     // 读出分区的超级块,根据魔数是否正确来判断是否存在文件系统
-                    ide_read(hd, part->start_lba + 1, sb_buf, 1);
+                    bcache_read(hd, part->start_lba + 1, sb_buf, 1);
+#ifdef FS_FORCE_FORMAT
+                    // 编译时指定了FS_FORMAT=1,不管有没有文件系统都重新格式化
+                    bool has_fs = false;
+#else
+                    bool has_fs = sb_buf->magic == SUPER_BLOCK_MAGIC;
+#endif
                     // 如果魔数正确，那么说明分区已经正确初始化
-                    if (sb_buf->magic == SUPER_BLOCK_MAGIC) {
+                    if (has_fs) {
                         printk("%s has filesystem\n", part->name);
                     }
                     // 魔数不正确，直接初始化分区
                     else {
-                        printk("formatting %s`s partition %s......\n", hd->name, part->name);
-                        partition_format(part);
+                        printk("formatting %s`s partition %s with %d-byte blocks......\n", hd->name, part->name, FS_BLOCK_SIZE);
+                        partition_format(part, FS_BLOCK_SIZE);
                     }
-
-                    // partition_format(part);
                 }
                 // 下一个分区
                 part++;
@@ -1104,6 +1367,9 @@ void filesys_init() {
     char default_part[8] = "sdb1";
     // 挂载分区
     list_traversal(&partition_list, mount_partition, (int)default_part);
+    // inode跨扇区时要读写两个扇区,块缓冲区至少两个扇区大
+    uint32_t io_buf_size = cur_part->sb->block_size;
+    slab_cache_init(&io_buf_cache, "io_buf", io_buf_size < SECTOR_SIZE * 2 ? SECTOR_SIZE * 2 : io_buf_size, NULL);
 
     // 将当前分区的根目录打开
     open_root_dir(cur_part);
@@ -1111,5 +1377,7 @@ void filesys_init() {
     for (int i = 0; i < MAX_FILE_OPEN; i++) {
         file_table[i].fd_inode = NULL;
     }
+    // 启动后台刷新线程
+    thread_start("flusher", fs_flusher, NULL);
 }
 
@@ -13,12 +13,18 @@
 
 #include "stdin.h"
 #include "ide.h"
+#include "slab.h"
 
 #define MAX_FILES_PER_PART     4096	    // 每个分区所支持最大创建的文件数
 #define BITS_PER_SECTOR        4096	    // 每扇区的位数
 #define SECTOR_SIZE            512		// 扇区字节大小
-#define BLOCK_SIZE             512	    // 块字节大小
+#define BLOCK_SIZE_MIN         512	    // 块字节大小的下限,即一个扇区
+#define BLOCK_SIZE_MAX         4096	    // 块字节大小的上限,即一页
+#ifndef FS_BLOCK_SIZE
+#define FS_BLOCK_SIZE          4096	    // 格式化分区时使用的块字节大小,可以在makefile中用FS_BLOCK_SIZE指定
+#endif
 #define MAX_PATH_LEN           512	    // 路径最大长度
+#define FS_FLUSH_TICKS         500      // 后台刷新延迟元数据的周期,约5秒
 
 /* 文件类型 */
 enum file_types {
@@ -57,6 +63,7 @@ struct stat {
 };
 
 extern struct partition* cur_part;
+extern struct slab_cache io_buf_cache;     // 一个块大小的缓冲区,至少两个扇区
 
 void filesys_init(void);
 int32_t path_depth_cnt(char* pathname);
@@ -64,6 +71,13 @@ char* path_parse(char* pathname, char* name_store);
 int32_t search_file(const char* pathname, struct path_search_record* searched_record);
 int32_t sys_open(const char* pathname, uint8_t flags);
 int32_t sys_close(int32_t fd);
+void fs_op_begin(struct partition* part);
+void fs_op_end(struct partition* part);
+void fs_op_restart(struct partition* part);
+void fs_op_checkpoint(struct partition* part);
+void fs_sync(struct partition* part);
+void fs_flusher_wakeup(void);
+int32_t sys_fsync(int32_t fd);
 int32_t sys_write(int32_t fd, const void* buf, uint32_t count);
 int32_t sys_read(int32_t fd, void* buf, uint32_t count);
 int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence);
@@ -77,6 +91,7 @@ int32_t sys_rmdir(const char* pathname);
 char* sys_getcwd(char* buf, uint32_t size);
 int32_t sys_chdir(const char* path);
 int32_t sys_stat(const char* path, struct stat* buf);
+void sys_cachestat(void);
 void sys_putchar(char char_asci);
 
 #endif /* __FS_FS_H */
@@ -13,6 +13,7 @@
 #include "stdin.h"
 #include "file.h"
 #include "ide.h"
+#include "bcache.h"
 #include "fs.h"
 #include "string.h"
 #include "list.h"
@@ -21,6 +22,13 @@
 #include "super_block.h"
 #include "thread.h"
 #include "interrupt.h"
+#include "memory.h"
+#include "journal.h"
+
+// 内存中的inode
+struct slab_cache inode_cache;
+// inode的间接块表缓存头
+struct slab_cache icache_cache;
 
 /* 用来存储inode位置 */
 struct inode_position {
@@ -73,7 +81,7 @@ static void inode_locate(struct partition* part, uint32_t inode_no, struct inode
  */
 void inode_sync(struct partition* part, struct inode* inode) {
     // inode 编号
-    uint8_t inode_no = inode->i_no;
+    uint32_t inode_no = inode->i_no;
     // inode 位置
     struct inode_position inode_pos;
     // inode 位置信息会存入 inode_pos
@@ -85,35 +93,180 @@ void inode_sync(struct partition* part, struct inode* inode) {
     // 给这个 inode 初始化
     memcpy(&pure_inode, inode, sizeof(struct inode));
 
-    // 以下inode的三个成员只存在于内存中,现在将inode同步到硬盘,清掉这三项即可
+    // 马上就要写回了,之后的修改会重新标脏
+    inode->i_dirty = false;
+
+    // 以下inode的五个成员只存在于内存中,现在将inode同步到硬盘,清掉这五项即可
     pure_inode.i_open_cnts = 0;
+    pure_inode.i_dirty = false;
     // 置为false,以保证在硬盘中读出时为可写
     pure_inode.write_deny = false;
+    // 间接块表缓存
+    pure_inode.i_icache = NULL;
     // 链表清空
     pure_inode.inode_tag.prev = NULL;
     pure_inode.inode_tag.next = NULL;
+    pure_inode.lru_tag.prev = NULL;
+    pure_inode.lru_tag.next = NULL;
 
-    // 申请两个扇区的空间
-    char* inode_buf = (char*)sys_malloc(1024);
+    // 块缓冲区至少有两个扇区的空间
+    char* inode_buf = (char*)slab_alloc(&io_buf_cache);
     // 若是跨了两个扇区,就要读出两个扇区再写入两个扇区
     if (inode_pos.two_sec) {
         // 先读出两个扇区的内容
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        bcache_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
         // 开始将待写入的inode拼入到这2个扇区中的相应位置 
         memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
         // 将拼接好的数据再写入磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        journal_write(part, inode_pos.sec_lba, inode_buf, 2);
     }
     // 若只是一个扇区
     else {
         // 先读出一个扇区的内容
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        bcache_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
         // 开始将待写入的inode拼入到这个扇区中的相应位置 
         memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
         // 将拼接好的数据再写入磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        journal_write(part, inode_pos.sec_lba, inode_buf, 1);
+    }
+    slab_free(&io_buf_cache, inode_buf);
+}
+
+/**
+ * @description: 标记inode在内存中被修改过,由inode_flush或最后一次关闭时写回硬盘,inode必须在inode表中
+ * @param {inode*} inode 被修改的inode
+ * @return {*}
+ */
+void inode_mark_dirty(struct inode* inode) {
+    inode->i_dirty = true;
+}
+
+/* inode编号所在的哈希桶 */
+static struct list* inode_bucket(struct inode_table* itable, uint32_t inode_no) {
+    return &itable->buckets[inode_no % INODE_HASH_CNT];
+}
+
+/* 在inode表中查找inode,调用者关中断 */
+static struct inode* inode_table_lookup(struct inode_table* itable, uint32_t inode_no) {
+    struct list* bucket = inode_bucket(itable, inode_no);
+    struct list_elem* elem = bucket->head.next;
+    while (elem != &bucket->tail) {
+        struct inode* inode = elem2entry(struct inode, inode_tag, elem);
+        if (inode->i_no == inode_no) return inode;
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 增加表中inode的打开计数,已经关闭的要从lru中取回,调用者关中断 */
+static void inode_table_get(struct inode_table* itable, struct inode* inode) {
+    if (inode->i_open_cnts++ == 0) {
+        list_remove(&inode->lru_tag);
+        itable->cached_cnt--;
+        itable->open_cnt++;
+    }
+}
+
+/* 释放inode的间接块表缓存,各张表还给io_buf_cache */
+static void icache_free(struct inode* inode) {
+    struct indirect_cache* icache = inode->i_icache;
+    if (icache == NULL) return;
+    for (uint32_t idx = 0; idx < INDIRECT_CACHE_TABLES; idx++) {
+        if (icache->tables[idx].entries != NULL) slab_free(&io_buf_cache, icache->tables[idx].entries);
+    }
+    slab_free(&icache_cache, icache);
+    inode->i_icache = NULL;
+}
+
+/* 释放inode占用的内存,inode必须已经不在inode表中 */
+static void inode_free(struct inode* inode) {
+    icache_free(inode);
+    slab_free(&inode_cache, inode);
+}
+
+/**
+ * @description: 挂载分区时初始化分区的inode表
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void inode_table_init(struct partition* part) {
+    struct inode_table* itable = (struct inode_table*)sys_malloc(sizeof(struct inode_table));
+    if (itable == NULL) {
+        PANIC("inode_table_init: alloc memory failed!");
+    }
+    for (uint32_t bucket_idx = 0; bucket_idx < INODE_HASH_CNT; bucket_idx++) {
+        list_init(&itable->buckets[bucket_idx]);
+    }
+    list_init(&itable->lru);
+    itable->open_cnt = 0;
+    itable->cached_cnt = 0;
+    itable->hits = 0;
+    itable->misses = 0;
+    itable->evictions = 0;
+    part->itable = itable;
+}
+
+/**
+ * @description: 把新创建的inode加入inode表,打开计数置为1
+ * @param {partition*} part 分区
+ * @param {inode*} inode 新创建的inode
+ * @return {*}
+ */
+void inode_table_add(struct partition* part, struct inode* inode) {
+    enum intr_status old_status = intr_disable();
+    ASSERT(inode_table_lookup(part->itable, inode->i_no) == NULL);
+    inode->i_open_cnts = 1;
+    list_push(inode_bucket(part->itable, inode->i_no), &inode->inode_tag);
+    part->itable->open_cnt++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @description: 获取分区inode表的命中率和占用情况
+ * @param {partition*} part 分区
+ * @param {inode_stat*} st 统计信息存入st
+ * @return {*}
+ */
+void inode_get_stat(struct partition* part, struct inode_stat* st) {
+    struct inode_table* itable = part->itable;
+    enum intr_status old_status = intr_disable();
+    st->hits = itable->hits;
+    st->misses = itable->misses;
+    st->evictions = itable->evictions;
+    st->open_cnt = itable->open_cnt;
+    st->cached_cnt = itable->cached_cnt;
+    intr_set_status(old_status);
+}
+
+/**
+ * @description: 把分区inode表中所有被修改过的inode写回硬盘,调用者要在fs_op_begin和fs_op_end之间,不和修改inode的操作交错
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void inode_flush(struct partition* part) {
+    struct inode_table* itable = part->itable;
+    while (1) {
+        // 关中断找出一个脏inode并增加打开计数,防止写回时被别的线程关闭释放
+        struct inode* dirty_inode = NULL;
+        enum intr_status old_status = intr_disable();
+        for (uint32_t bucket_idx = 0; bucket_idx < INODE_HASH_CNT && dirty_inode == NULL; bucket_idx++) {
+            struct list* bucket = &itable->buckets[bucket_idx];
+            struct list_elem* elem = bucket->head.next;
+            while (elem != &bucket->tail) {
+                struct inode* inode = elem2entry(struct inode, inode_tag, elem);
+                if (inode->i_dirty) {
+                    dirty_inode = inode;
+                    inode_table_get(itable, dirty_inode);
+                    break;
+                }
+                elem = elem->next;
+            }
+        }
+        intr_set_status(old_status);
+        if (dirty_inode == NULL) break;
+        inode_sync(part, dirty_inode);
+        inode_close(dirty_inode);
     }
-    sys_free(inode_buf);
 }
 
 /**
@@ -123,75 +276,88 @@ void inode_sync(struct partition* part, struct inode* inode) {
  * @return {struct inode*} 返回inode结构体的指针
  */
 struct inode* inode_open(struct partition* part, uint32_t inode_no) {
-    // 先在已打开inode链表中找inode,此链表是为提速创建的缓冲区
-    struct list_elem* elem = part->open_inodes.head.next;
-    struct inode* inode_found;
-    while (elem != &part->open_inodes.tail) {
-        inode_found = elem2entry(struct inode, inode_tag, elem);
-        if (inode_found->i_no == inode_no) {
-            inode_found->i_open_cnts++;
-            // 在已打开的inode中找到了该节点，就直接返回
-            return inode_found;
-        }
-        elem = elem->next;
+    struct inode_table* itable = part->itable;
+    // 先在inode表中找,打开着的和最近关闭的inode都不用再读硬盘
+    enum intr_status old_status = intr_disable();
+    struct inode* inode_found = inode_table_lookup(itable, inode_no);
+    if (inode_found != NULL) {
+        inode_table_get(itable, inode_found);
+        itable->hits++;
+        intr_set_status(old_status);
+        return inode_found;
     }
+    itable->misses++;
+    intr_set_status(old_status);
 
-    // 在已打开节点中没找到，就从硬盘中找
+    // 在inode表中没找到，就从硬盘中找
     struct inode_position inode_pos;
 
     // inode位置信息会存入inode_pos, 包括inode所在扇区地址和扇区内的字节偏移量
     inode_locate(part, inode_no, &inode_pos);
 
-    // 想要让这个inode节点被所有线程共享，只能在高1GB的内核空间，所以先降页表置为空
-    struct task_struct* cur = running_thread();
+    // inode要被所有线程共享,inode_cache的对象都在高1GB的内核空间
+    inode_found = (struct inode*)slab_alloc(&inode_cache);
 
-    // 获取页表的旧地址
-    uint32_t* cur_pagedir_bak = cur->pgdir;
-    cur->pgdir = NULL;
-    // 此时申请的内存在内核地址池
-    inode_found = (struct inode*)sys_malloc(sizeof(struct inode));
-    // 页表的旧地址赋值
-    cur->pgdir = cur_pagedir_bak;
+    // 直接从块缓存拷贝到inode中,跨扇区的inode也不用另外申请缓冲区
+    bcache_read_bytes(part->my_disk, inode_pos.sec_lba, inode_pos.off_size, inode_found, sizeof(struct inode));
+    // 间接块表缓存在第一次用到时才申请
+    inode_found->i_icache = NULL;
+    inode_found->i_dirty = false;
 
-    char* inode_buf;
-    // inode处于两个扇区
-    if (inode_pos.two_sec) {
-        inode_buf = (char*)sys_malloc(1024);
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+    old_status = intr_disable();
+    // 读硬盘时会阻塞,别的线程可能已经把同一个inode放进了表中,以表中的为准
+    struct inode* inode_raced = inode_table_lookup(itable, inode_no);
+    if (inode_raced != NULL) {
+        inode_table_get(itable, inode_raced);
+        intr_set_status(old_status);
+        inode_free(inode_found);
+        return inode_raced;
     }
-    // inode处于一个扇区
-    else {
-        inode_buf = (char*)sys_malloc(512);
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-    }
-    memcpy(inode_found, inode_buf + inode_pos.off_size, sizeof(struct inode));
-    // 因为一会很可能要用到此inode,故将其插入到队首便于提前检索到
-    list_push(&part->open_inodes, &(inode_found->inode_tag));
     // 第一次被打开，将cnt置为1
     inode_found->i_open_cnts = 1;
-    // 释放缓存
-    sys_free(inode_buf);
+    list_push(inode_bucket(itable, inode_no), &inode_found->inode_tag);
+    itable->open_cnt++;
+    intr_set_status(old_status);
     // 返回inode节点
     return inode_found;
 }
 
 /**
- * @description: 关闭一个inode节点，释放inode节点占用的内存，如果有多个线程都打开了这个inode，那么计数器减1
+ * @description: 关闭一个inode节点,没有线程再使用时放进inode表的lru中留在内存,超出上限时淘汰最久未使用的inode
  * @param {inode*} inode 要关闭的inode节点
  * @return {*}
  */
 void inode_close(struct inode* inode) {
+    struct inode_table* itable = cur_part->itable;
+    // 最后一个使用者关闭前先把延迟的修改写回,写硬盘可能阻塞,不能放在关中断里
+    if (inode->i_open_cnts == 1 && inode->i_dirty) {
+        inode_sync(cur_part, inode);
+    }
     // 关中断
     enum intr_status old_status = intr_disable();
     // 如果当前线程关闭这个inode，且没有线程再占用这个inode
     if (--inode->i_open_cnts == 0) {
-        list_remove(&inode->inode_tag);
-        // 释放掉inode节点占用的堆内存,也是需要将页表值置空再恢复
-        struct task_struct* cur = running_thread();
-        uint32_t* cur_pagedir_bak = cur->pgdir;
-        cur->pgdir = NULL;
-        sys_free(inode);
-        cur->pgdir = cur_pagedir_bak;
+        itable->open_cnt--;
+        // 已经删除的inode不能留在表中,否则编号复用后会读到旧的内容
+        if (!bitmap_scan_test(&cur_part->inode_bitmap, inode->i_no)) {
+            list_remove(&inode->inode_tag);
+            inode_free(inode);
+        }
+        else {
+            // 间接块表缓存每张表占一个块,关闭时就释放,只留inode本身
+            icache_free(inode);
+            list_push(&itable->lru, &inode->lru_tag);
+            itable->cached_cnt++;
+        }
+        // lru超出上限,淘汰队尾最久未使用的inode
+        if (itable->cached_cnt > INODE_CACHE_MAX) {
+            struct inode* victim = elem2entry(struct inode, lru_tag, itable->lru.tail.prev);
+            list_remove(&victim->lru_tag);
+            list_remove(&victim->inode_tag);
+            itable->cached_cnt--;
+            itable->evictions++;
+            inode_free(victim);
+        }
     }
     // 恢复中断
     intr_set_status(old_status);
@@ -223,19 +389,259 @@ void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf) {
     // 是否跨扇区
     if (inode_pos.two_sec) {
         // 将原硬盘上的内容先读出来
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        bcache_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
         // 将inode_buf清0
         memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
         // 用清0的内存数据覆盖磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        journal_write(part, inode_pos.sec_lba, inode_buf, 2);
     } else {
         // 将原硬盘上的内容先读出来
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        bcache_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
         // 将inode_buf清0
         memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
         // 用清0的内存数据覆盖磁盘
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        journal_write(part, inode_pos.sec_lba, inode_buf, 1);
+    }
+}
+
+/**
+ * @description: 分区上一个文件最多能有的块数,间接块表能放的地址个数随块大小变化
+ * @param {partition*} part 分区
+ * @return {*} 块数,超出32位时返回0xffffffff
+ */
+uint32_t inode_max_blocks(struct partition* part) {
+    uint64_t ptrs = part->sb->block_size / 4;
+    uint64_t blocks = INODE_DIRECT_BLOCKS + ptrs + ptrs * ptrs + ptrs * ptrs * ptrs;
+    return blocks > 0xffffffff ? 0xffffffff : (uint32_t)blocks;
+}
+
+/**
+ * @description: 把文件内的块号换算成索引路径
+ * @param {partition*} part 分区
+ * @param {uint32_t} block_idx 文件内的块号
+ * @param {uint32_t*} root_idx 返回路径起点在i_sectors中的下标
+ * @param {uint32_t*} offsets 返回每一级间接块表中的下标
+ * @return {*} 间接的层数,0表示直接块,超出文件最大块数返回-1
+ */
+static int32_t bmap_path(struct partition* part, uint32_t block_idx, uint32_t* root_idx, uint32_t* offsets) {
+    const uint32_t ptrs = part->sb->block_size / 4;
+    if (block_idx < INODE_DIRECT_BLOCKS) {
+        *root_idx = block_idx;
+        return 0;
+    }
+    block_idx -= INODE_DIRECT_BLOCKS;
+    if (block_idx < ptrs) {
+        *root_idx = INODE_SINGLE_IDX;
+        offsets[0] = block_idx;
+        return 1;
+    }
+    block_idx -= ptrs;
+    if (block_idx < ptrs * ptrs) {
+        *root_idx = INODE_DOUBLE_IDX;
+        offsets[0] = block_idx / ptrs;
+        offsets[1] = block_idx % ptrs;
+        return 2;
+    }
+    block_idx -= ptrs * ptrs;
+    // 4KB的块时三级表能寻址的块数超出32位,任何块号都在范围内
+    if (block_idx / ptrs / ptrs < ptrs) {
+        *root_idx = INODE_TRIPLE_IDX;
+        offsets[0] = block_idx / (ptrs * ptrs);
+        offsets[1] = (block_idx / ptrs) % ptrs;
+        offsets[2] = block_idx % ptrs;
+        return 3;
+    }
+    return -1;
+}
+
+/* 在inode的间接块表缓存中找一个空闲或最久未用的位置,缓存和位置上的表空间都在第一次用到时才申请 */
+static struct indirect_table* icache_slot(struct inode* inode, uint32_t lba, bool* hit) {
+    if (inode->i_icache == NULL) {
+        // inode为所有进程共享,不能用sys_malloc,在用户进程中调用时它会从进程自己的堆里分配
+        inode->i_icache = slab_alloc(&icache_cache);
+        if (inode->i_icache == NULL) return NULL;
+        memset(inode->i_icache, 0, sizeof(struct indirect_cache));
+    }
+    struct indirect_cache* icache = inode->i_icache;
+    struct indirect_table* victim = &icache->tables[0];
+    icache->clock++;
+    for (uint32_t idx = 0; idx < INDIRECT_CACHE_TABLES; idx++) {
+        struct indirect_table* table = &icache->tables[idx];
+        if (table->lba == lba) {
+            table->stamp = icache->clock;
+            *hit = true;
+            return table;
+        }
+        if (table->stamp < victim->stamp) victim = table;
+    }
+    if (victim->entries == NULL) {
+        // io_buf_cache的对象不小于一个块
+        victim->entries = slab_alloc(&io_buf_cache);
+        if (victim->entries == NULL) return NULL;
+    }
+    victim->stamp = icache->clock;
+    *hit = false;
+    return victim;
+}
+
+/* 取得lba处的间接块表,优先从inode的缓存中取,失败返回NULL */
+static uint32_t* icache_table(struct partition* part, struct inode* inode, uint32_t lba) {
+    bool hit;
+    struct indirect_table* table = icache_slot(inode, lba, &hit);
+    if (table == NULL) return NULL;
+    if (!hit) {
+        table->lba = 0;
+        if (bcache_read(part->my_disk, lba, table->entries, part->sb->block_sects) != 0) return NULL;
+        table->lba = lba;
+    }
+    return table->entries;
+}
+
+/* 把lba处新分配的间接块表清零后写入硬盘,同时放进缓存 */
+static int32_t icache_table_new(struct partition* part, struct inode* inode, uint32_t lba) {
+    bool hit;
+    struct indirect_table* table = icache_slot(inode, lba, &hit);
+    if (table == NULL) return -1;
+    memset(table->entries, 0, part->sb->block_size);
+    table->lba = lba;
+    journal_write(part, lba, table->entries, part->sb->block_sects);
+    return 0;
+}
+
+/* 间接块表被回收时让它在缓存中失效 */
+static void icache_table_drop(struct inode* inode, uint32_t lba) {
+    if (inode->i_icache == NULL) return;
+    for (uint32_t idx = 0; idx < INDIRECT_CACHE_TABLES; idx++) {
+        if (inode->i_icache->tables[idx].lba == lba) {
+            inode->i_icache->tables[idx].lba = 0;
+            inode->i_icache->tables[idx].stamp = 0;
+        }
+    }
+}
+
+/* 判断间接块表中是否已经没有块地址 */
+static bool indirect_table_empty(struct partition* part, uint32_t* entries) {
+    for (uint32_t idx = 0; idx < part->sb->block_size / 4; idx++) {
+        if (entries[idx] != 0) return false;
+    }
+    return true;
+}
+
+/**
+ * @description: 查找文件内第block_idx块所在的扇区,经过的间接块表都在inode的缓存中,随机访问时最多多读一次元数据
+ * @param {partition*} part 分区
+ * @param {inode*} inode 文件的inode
+ * @param {uint32_t} block_idx 文件内的块号
+ * @return {*} 扇区地址,块尚未分配或读取失败时返回0
+ */
+uint32_t inode_bmap(struct partition* part, struct inode* inode, uint32_t block_idx) {
+    uint32_t root_idx, offsets[3];
+    int32_t depth = bmap_path(part, block_idx, &root_idx, offsets);
+    if (depth == -1) return 0;
+
+    uint32_t lba = inode->i_sectors[root_idx];
+    for (int32_t level = 0; level < depth && lba != 0; level++) {
+        uint32_t* entries = icache_table(part, inode, lba);
+        if (entries == NULL) return 0;
+        lba = entries[offsets[level]];
     }
+    return lba;
+}
+
+/**
+ * @description: 把文件内第block_idx块映射到扇区lba,缺少的间接块表会被分配,lba为0时解除映射并回收变空的间接块表
+ * @param {partition*} part 分区
+ * @param {inode*} inode 文件的inode,i_sectors的改动由调用者同步到硬盘
+ * @param {uint32_t} block_idx 文件内的块号
+ * @param {uint32_t} lba 扇区地址
+ * @return {*} 成功返回0,失败返回-1
+ */
+int32_t inode_bmap_set(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t lba) {
+    uint32_t root_idx, offsets[3], path[3];
+    int32_t depth = bmap_path(part, block_idx, &root_idx, offsets);
+    if (depth == -1) return -1;
+    if (depth == 0) {
+        inode->i_sectors[root_idx] = lba;
+        return 0;
+    }
+
+    // 一级表还没有
+    if (inode->i_sectors[root_idx] == 0) {
+        if (lba == 0) return 0;
+        int32_t table_lba = block_bitmap_alloc(part);
+        if (table_lba == -1) return -1;
+        bitmap_sync(part, block_lba_to_bit(part, table_lba), BLOCK_BITMAP);
+        inode->i_sectors[root_idx] = table_lba;
+        if (icache_table_new(part, inode, table_lba) != 0) return -1;
+    }
+
+    // 沿着路径往下走,缺少的中间表现场分配
+    uint32_t table_lba = inode->i_sectors[root_idx];
+    for (int32_t level = 0; level < depth; level++) {
+        path[level] = table_lba;
+        uint32_t* entries = icache_table(part, inode, table_lba);
+        if (entries == NULL) return -1;
+        if (level == depth - 1) {
+            entries[offsets[level]] = lba;
+            journal_write(part, table_lba, entries, part->sb->block_sects);
+            break;
+        }
+        uint32_t child_lba = entries[offsets[level]];
+        if (child_lba == 0) {
+            if (lba == 0) return 0;
+            int32_t new_lba = block_bitmap_alloc(part);
+            if (new_lba == -1) return -1;
+            bitmap_sync(part, block_lba_to_bit(part, new_lba), BLOCK_BITMAP);
+            // 先更新父表,再建子表,建子表可能会把父表挤出缓存
+            entries[offsets[level]] = new_lba;
+            journal_write(part, table_lba, entries, part->sb->block_sects);
+            if (icache_table_new(part, inode, new_lba) != 0) return -1;
+            child_lba = new_lba;
+        }
+        table_lba = child_lba;
+    }
+    if (lba != 0) return 0;
+
+    // 解除映射后由下往上回收变空的间接块表
+    for (int32_t level = depth - 1; level >= 0; level--) {
+        uint32_t* entries = icache_table(part, inode, path[level]);
+        if (entries == NULL || !indirect_table_empty(part, entries)) break;
+        icache_table_drop(inode, path[level]);
+        block_bitmap_free(part, path[level]);
+        if (level == 0) {
+            inode->i_sectors[root_idx] = 0;
+            break;
+        }
+        uint32_t* parent = icache_table(part, inode, path[level - 1]);
+        if (parent == NULL) return -1;
+        parent[offsets[level - 1]] = 0;
+        journal_write(part, path[level - 1], parent, part->sb->block_sects);
+    }
+    return 0;
+}
+
+/* 回收lba处的depth级间接块表以及它指向的所有块 */
+static void indirect_release(struct partition* part, uint32_t lba, uint32_t depth) {
+    if (lba == 0) return;
+    uint32_t* entries = (uint32_t*)slab_alloc(&io_buf_cache);
+    if (entries == NULL) {
+        printk("indirect_release: alloc for entries failed\n");
+        return;
+    }
+    if (bcache_read(part->my_disk, lba, entries, part->sb->block_sects) == 0) {
+        for (uint32_t idx = 0; idx < part->sb->block_size / 4; idx++) {
+            if (entries[idx] == 0) continue;
+            if (depth > 1) {
+                indirect_release(part, entries[idx], depth - 1);
+            }
+            else {
+                block_bitmap_free(part, entries[idx]);
+                fs_op_checkpoint(part);
+            }
+        }
+    }
+    slab_free(&io_buf_cache, entries);
+    block_bitmap_free(part, lba);
 }
 
 /**
@@ -248,48 +654,29 @@ void inode_release(struct partition* part, uint32_t inode_no) {
     // 获取inode
     struct inode* inode_to_del = inode_open(part, inode_no);
 
-    // 1 回收inode占用的所有块
-    uint8_t block_idx = 0, block_cnt = 12;
-    uint32_t block_bitmap_idx;
-    uint32_t all_blocks[140] = {0};
-
-    // 1.1 先将前12个直接块存入all_blocks
-    while (block_idx < 12) {
-        all_blocks[block_idx] = inode_to_del->i_sectors[block_idx];
-        block_idx++;
-    }
-
-    // 1.2 如果一级间接块表存在,将其128个间接块读到all_blocks[12~], 并释放一级间接块表所占的扇区
-    if (inode_to_del->i_sectors[12] != 0) {
-        ide_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
-        block_cnt = 140;
-        // 回收一级间接块表占用的扇区
-        block_bitmap_idx = inode_to_del->i_sectors[12] - part->sb->data_start_lba;
-        // 修改bitmap
-        bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-        // 每次修改bitmap都要先写入硬盘
-        bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-    }
-    
-    // 1.3 inode所有的块地址已经收集到all_blocks中,下面逐个回收
-    for (block_idx = 0; block_idx < block_cnt; block_idx++) {
-        if (all_blocks[block_idx] != 0) {
-            block_bitmap_idx = 0;
-            block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-            bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-            bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+    // 1 回收inode占用的所有块,先回收直接块,再逐级回收间接块表及其指向的块.
+    //   大文件的位图改动多,中途会分段,此时目录项已经删除,崩溃时最多泄漏这些块和inode
+    for (uint32_t block_idx = 0; block_idx < INODE_DIRECT_BLOCKS; block_idx++) {
+        if (inode_to_del->i_sectors[block_idx] != 0) {
+            block_bitmap_free(part, inode_to_del->i_sectors[block_idx]);
+            fs_op_checkpoint(part);
         }
-        
     }
+    indirect_release(part, inode_to_del->i_sectors[INODE_SINGLE_IDX], 1);
+    indirect_release(part, inode_to_del->i_sectors[INODE_DOUBLE_IDX], 2);
+    indirect_release(part, inode_to_del->i_sectors[INODE_TRIPLE_IDX], 3);
+
     // 2 回收该inode所占用的inode
     bitmap_set(&part->inode_bitmap, inode_no, 0);  
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
     // 3 删除inode，这部分本不需要，inode是否存在收到inode bitmap控制，其中的inode不需要清0
-    void* io_buf = sys_malloc(1024);
+    void* io_buf = slab_alloc(&io_buf_cache);
     inode_delete(part, inode_no, io_buf);
-    sys_free(io_buf);
+    slab_free(&io_buf_cache, io_buf);
 
+    // inode已经删除,不能再把内存中的内容写回去
+    inode_to_del->i_dirty = false;
     // 关闭inode
     inode_close(inode_to_del);
 }
@@ -301,13 +688,18 @@ void inode_release(struct partition* part, uint32_t inode_no) {
  * @return {*}
  */
 void inode_init(uint32_t inode_no, struct inode* new_inode) {
+    // 从inode_cache中重用的inode还留着上一个文件的内容
+    memset(new_inode, 0, sizeof(struct inode));
     new_inode->i_no = inode_no;
     new_inode->i_size = 0;
     new_inode->i_open_cnts = 0;
     new_inode->write_deny = false;
 
+    new_inode->i_icache = NULL;
+    new_inode->i_dir_buckets = 1;
+
     /* 初始化块索引数组i_sector */
-    for (uint8_t sec_idx = 0; sec_idx < 13; sec_idx++) {
+    for (uint8_t sec_idx = 0; sec_idx < INODE_SECTORS_CNT; sec_idx++) {
         new_inode->i_sectors[sec_idx] = 0;
     }
 }
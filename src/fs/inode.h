@@ -14,6 +14,30 @@
 #include "stdin.h"
 #include "list.h"
 #include "ide.h"
+#include "fs.h"
+
+#define INODE_DIRECT_BLOCKS   12                      // 直接块的个数
+#define INODE_SINGLE_IDX      12                      // i_sectors中一级间接块表的下标
+#define INODE_DOUBLE_IDX      13                      // i_sectors中二级间接块表的下标
+#define INODE_TRIPLE_IDX      14                      // i_sectors中三级间接块表的下标
+#define INODE_SECTORS_CNT     15                      // i_sectors的元素个数
+#define DIR_MAX_BLOCKS        (INODE_DIRECT_BLOCKS + BLOCK_SIZE_MIN / 4)  // 目录最多只用到一级间接块表的前128项
+#define INDIRECT_CACHE_TABLES 4                       // 每个inode缓存的间接块表个数,三级索引查一次要走3张表
+#define INODE_HASH_CNT        64                      // inode表的哈希桶个数
+#define INODE_CACHE_MAX       64                      // 关闭以后仍留在内存中的inode个数上限
+
+/* 缓存在内存中的一张间接块表 */
+struct indirect_table {
+    uint32_t lba;                               // 表所在的块,为0表示空闲
+    uint32_t stamp;                             // 最近一次使用的时间戳,淘汰时选最小的
+    uint32_t* entries;                          // 表中的块地址,一个块大小,第一次用到这个位置时从io_buf_cache中分配
+};
+
+/* inode的间接块表缓存,随机访问大文件时三级索引的上层表基本都能命中,占用的内存是用到的表数乘以块大小 */
+struct indirect_cache {
+    uint32_t clock;                                    // 时间戳计数
+    struct indirect_table tables[INDIRECT_CACHE_TABLES];
+};
 
 /* inode结构 */
 struct inode {
@@ -26,15 +50,50 @@ struct inode {
     uint32_t privilege;      // 权限，可读可写可执行 1-7
     uint32_t i_open_cnts;    // 记录此文件被打开的次数
     bool write_deny;	     // 写文件不能并行,进程写文件前检查此标识
-    uint32_t i_sectors[13];  // i_sectors[0-11]是直接块, i_sectors[12]用来存储一级间接块指针
-    struct list_elem inode_tag;
+    bool i_dirty;            // inode在内存中被修改过还没有写回硬盘,只存在于内存中
+    uint32_t i_dir_buckets;  // 目录的散列桶个数,0和1都表示只有一个桶
+    uint32_t i_sectors[INODE_SECTORS_CNT];  // i_sectors[0-11]是直接块, i_sectors[12-14]分别是一、二、三级间接块表
+    struct indirect_cache* i_icache;        // 间接块表缓存,只存在于内存中
+    struct list_elem inode_tag;             // 在inode表哈希桶中的节点
+    struct list_elem lru_tag;               // 关闭以后在inode表lru链表中的节点
 };
 
+/* 分区在内存中的inode表,打开的inode和最近关闭的inode都按编号散列,关闭的inode再按lru淘汰 */
+struct inode_table {
+    struct list buckets[INODE_HASH_CNT];    // 内存中的全部inode
+    struct list lru;                        // 已经关闭但还留在内存中的inode,队首是最近关闭的
+    uint32_t open_cnt;                      // 打开着的inode个数
+    uint32_t cached_cnt;                    // 留在lru中的inode个数
+    uint32_t hits;                          // inode_open在表中找到的次数
+    uint32_t misses;                        // inode_open要从硬盘读入的次数
+    uint32_t evictions;                     // 从lru中淘汰的次数
+};
+
+/* inode表统计信息 */
+struct inode_stat {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t open_cnt;
+    uint32_t cached_cnt;
+};
+
+extern struct slab_cache inode_cache;      // 内存中的inode都从这里分配
+extern struct slab_cache icache_cache;     // inode的间接块表缓存头都从这里分配
+
+void inode_table_init(struct partition* part);
+void inode_table_add(struct partition* part, struct inode* inode);
+void inode_get_stat(struct partition* part, struct inode_stat* stat);
 struct inode* inode_open(struct partition* part, uint32_t inode_no);
 void inode_close(struct inode* inode);
 void inode_sync(struct partition* part, struct inode* inode);
+void inode_mark_dirty(struct inode* inode);
+void inode_flush(struct partition* part);
 void inode_init(uint32_t inode_no, struct inode* new_inode);
 void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf);
 void inode_release(struct partition* part, uint32_t inode_no);
+uint32_t inode_max_blocks(struct partition* part);
+uint32_t inode_bmap(struct partition* part, struct inode* inode, uint32_t block_idx);
+int32_t inode_bmap_set(struct partition* part, struct inode* inode, uint32_t block_idx, uint32_t lba);
 
 #endif
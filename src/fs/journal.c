@@ -0,0 +1,249 @@
+#include "journal.h"
+#include "fs.h"
+#include "bcache.h"
+#include "memory.h"
+#include "string.h"
+#include "stdio.h"
+#include "assert.h"
+#include "super_block.h"
+#include "thread.h"
+#include "interrupt.h"
+
+// 提交缓冲区的页数,放得下描述块和一个事务的全部扇区
+#define JOURNAL_BUF_PAGES DIV_ROUND_UP((1 + JOURNAL_TRANS_MAX) * SECTOR_SIZE, PG_SIZE)
+
+/* 计算cnt个扇区内容的校验和 */
+static uint32_t journal_checksum(uint8_t* data, uint32_t cnt) {
+    uint32_t* word = (uint32_t*)data;
+    uint32_t sum = 0;
+    for (uint32_t idx = 0; idx < cnt * SECTOR_SIZE / 4; idx++) {
+        sum = ((sum << 1) | (sum >> 31)) ^ word[idx];
+    }
+    return sum;
+}
+
+/* 写日志头,记录seq及之前的事务都已经写回原位置 */
+static int32_t journal_checkpoint(struct disk* hd, uint32_t lba, uint32_t seq) {
+    struct journal_header header;
+    memset(&header, 0, sizeof(struct journal_header));
+    header.magic = JOURNAL_MAGIC;
+    header.checkpoint_seq = seq;
+    // 日志区不经过块缓存,写完就已经落盘
+    return ide_write(hd, lba, &header, 1);
+}
+
+/**
+ * @description: 格式化分区时初始化日志区,日志头中没有需要重放的事务
+ * @param {disk*} hd 硬盘
+ * @param {uint32_t} lba 日志区起始扇区
+ * @return {*}
+ */
+void journal_format(struct disk* hd, uint32_t lba) {
+    struct journal_desc desc;
+    memset(&desc, 0, sizeof(struct journal_desc));
+    ide_write(hd, lba + 1, &desc, 1);
+    journal_checkpoint(hd, lba, 0);
+}
+
+/* 重放日志区中的事务,把扇区的新内容写回原位置 */
+static void journal_replay(struct partition* part, struct journal* jn) {
+    struct journal_desc* desc = (struct journal_desc*)jn->buf;
+    uint8_t* data = jn->buf + SECTOR_SIZE;
+    for (uint32_t idx = 0; idx < desc->cnt; idx++) {
+        bcache_write(part->my_disk, desc->lbas[idx], data + idx * SECTOR_SIZE, 1);
+    }
+    bcache_flush(part->my_disk);
+    journal_checkpoint(part->my_disk, jn->lba, desc->seq);
+    printk("journal: replayed transaction %d, %d sectors\n", desc->seq, desc->cnt);
+}
+
+/**
+ * @description: 挂载分区时加载日志,日志中有提交完整但还没有写回原位置的事务就先重放,必须在读入位图之前调用
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void journal_load(struct partition* part) {
+    struct journal* jn = (struct journal*)sys_malloc(sizeof(struct journal));
+    uint8_t* buf = get_kernel_pages(JOURNAL_BUF_PAGES);
+    if (jn == NULL || buf == NULL) {
+        PANIC("journal_load: alloc memory failed!");
+    }
+    jn->lba = part->sb->journal_lba;
+    jn->cnt = 0;
+    jn->trans_max = part->sb->journal_sects - 2;
+    if (jn->trans_max > JOURNAL_TRANS_MAX) jn->trans_max = JOURNAL_TRANS_MAX;
+    jn->op_sects = JOURNAL_OP_BITMAP_SECTS + JOURNAL_OP_INODES * 2 + JOURNAL_OP_BLOCKS * part->sb->block_sects;
+    jn->outstanding = 0;
+    jn->committing = false;
+    list_init(&jn->waiters);
+    jn->buf = buf;
+    lock_init(&jn->lock);
+    part->journal = jn;
+    // 日志区放不下一个最坏情况的操作,只能重新格式化出更大的日志区
+    if (jn->op_sects > jn->trans_max) {
+        printk("journal_load: journal of %s too small (%d < %d sectors), rebuild with FS_FORMAT=1\n", \
+               part->name, jn->trans_max, jn->op_sects);
+        PANIC("journal_load: journal too small");
+    }
+
+    struct journal_header header;
+    if (ide_read(part->my_disk, jn->lba, &header, 1) != 0 || header.magic != JOURNAL_MAGIC) {
+        printk("journal_load: bad journal header on %s\n", part->name);
+        memset(&header, 0, sizeof(struct journal_header));
+    }
+    jn->seq = header.checkpoint_seq + 1;
+
+    // 描述块和事务内容一次读入
+    struct journal_desc* desc = (struct journal_desc*)buf;
+    if (ide_read(part->my_disk, jn->lba + 1, buf, 1) != 0) return;
+    if (desc->magic != JOURNAL_MAGIC || desc->seq <= header.checkpoint_seq || \
+        desc->cnt == 0 || desc->cnt > JOURNAL_TRANS_MAX) {
+        return;
+    }
+    if (ide_read(part->my_disk, jn->lba + 2, buf + SECTOR_SIZE, desc->cnt) != 0) return;
+    // 校验和对不上说明写日志时掉电了,事务没有提交,丢弃即可
+    if (journal_checksum(buf + SECTOR_SIZE, desc->cnt) != desc->checksum) return;
+    journal_replay(part, jn);
+    jn->seq = desc->seq + 1;
+}
+
+/* 提交当前事务,调用者已经置上committing,期间没有进行中的操作 */
+static void journal_commit_io(struct partition* part) {
+    struct journal* jn = part->journal;
+    struct disk* hd = part->my_disk;
+    if (jn->cnt == 0) return;
+
+    // 1 先把没有钉住的数据块写回,保证事务提交时元数据指向的数据已经在硬盘上
+    bcache_flush(hd);
+
+    // 2 描述块后面拼上事务中各扇区的内容,一次顺序写入日志区
+    struct journal_desc* desc = (struct journal_desc*)jn->buf;
+    uint8_t* data = jn->buf + SECTOR_SIZE;
+    memset(desc, 0, sizeof(struct journal_desc));
+    for (uint32_t idx = 0; idx < jn->cnt; idx++) {
+        // 钉住的扇区一定在缓存中
+        bcache_read(hd, jn->lbas[idx], data + idx * SECTOR_SIZE, 1);
+        desc->lbas[idx] = jn->lbas[idx];
+    }
+    desc->magic = JOURNAL_MAGIC;
+    desc->seq = jn->seq;
+    desc->cnt = jn->cnt;
+    desc->checksum = journal_checksum(data, jn->cnt);
+    if (ide_write(hd, jn->lba + 1, jn->buf, jn->cnt + 1) != 0) {
+        // 日志写不进去也只能照常写回,此时不再有崩溃一致性的保证
+        printk("journal_commit: write journal failed, seq %d\n", jn->seq);
+    }
+
+    // 3 事务已经落盘,解除钉住后写回原位置,再推进检查点,之后的事务才能覆盖日志区
+    for (uint32_t idx = 0; idx < jn->cnt; idx++) {
+        bcache_unpin(hd, jn->lbas[idx]);
+    }
+    bcache_flush(hd);
+    journal_checkpoint(hd, jn->lba, jn->seq);
+    jn->seq++;
+    jn->cnt = 0;
+}
+
+/* 把当前线程挂到日志的等待队列上阻塞,调用者关中断 */
+static void journal_wait(struct journal* jn) {
+    ASSERT(!elem_find(&jn->waiters, &running_thread()->general_tag));
+    list_append(&jn->waiters, &running_thread()->general_tag);
+    thread_block(TASK_BLOCKED);
+}
+
+/* 唤醒所有等待的线程,由它们各自重新检查条件,调用者关中断 */
+static void journal_wake_all(struct journal* jn) {
+    while (!list_empty(&jn->waiters)) {
+        struct task_struct* waiter = elem2entry(struct task_struct, general_tag, list_pop(&jn->waiters));
+        thread_unblock(waiter);
+    }
+}
+
+/* 在操作之间提交当前事务,调用者关中断并确认没有进行中的操作,提交时恢复成调用前的中断状态 */
+static void journal_commit_between(struct partition* part, enum intr_status old_status) {
+    struct journal* jn = part->journal;
+    ASSERT(jn->outstanding == 0 && !jn->committing);
+    jn->committing = true;
+    intr_set_status(old_status);
+    journal_commit_io(part);
+    intr_disable();
+    jn->committing = false;
+    journal_wake_all(jn);
+}
+
+/**
+ * @description: 开始一个修改元数据的操作,在当前事务中按最坏情况为它预留空间.
+ *               正在提交或者空间不够时等待,没有别的操作在进行时自己提交事务腾出空间
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void journal_begin(struct partition* part) {
+    struct journal* jn = part->journal;
+    enum intr_status old_status = intr_disable();
+    while (jn->committing || jn->cnt + (jn->outstanding + 1) * jn->op_sects > jn->trans_max) {
+        if (!jn->committing && jn->outstanding == 0) {
+            journal_commit_between(part, old_status);
+            continue;
+        }
+        journal_wait(jn);
+    }
+    jn->outstanding++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @description: 结束journal_begin开始的操作,事务过半就催后台线程提交
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void journal_end(struct partition* part) {
+    struct journal* jn = part->journal;
+    enum intr_status old_status = intr_disable();
+    ASSERT(jn->outstanding > 0);
+    jn->outstanding--;
+    // 等空间和等提交的线程都要在操作结束时重新检查
+    journal_wake_all(jn);
+    bool half_full = jn->cnt >= jn->trans_max / 2;
+    intr_set_status(old_status);
+    if (half_full) fs_flusher_wakeup();
+}
+
+/**
+ * @description: 经过日志写入元数据扇区,数据写入块缓存并被钉住,事务提交之前不会写回原位置
+ * @param {partition*} part 分区
+ * @param {uint32_t} lba 起始扇区
+ * @param {void*} buf 缓冲区
+ * @param {uint32_t} sec_cnt 扇区数
+ * @return {*}
+ */
+void journal_write(struct partition* part, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    struct journal* jn = part->journal;
+    // 只有在操作中才能写,事务只在操作之间提交,不会把一个操作拆到两个事务里
+    ASSERT(jn->outstanding > 0 && !jn->committing);
+    lock_acquire(&jn->lock);
+    for (uint32_t sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+        uint32_t sec_lba = lba + sec_idx;
+        uint32_t idx = 0;
+        while (idx < jn->cnt && jn->lbas[idx] != sec_lba) idx++;
+        if (idx == jn->cnt) {
+            // 每个操作都预留了最坏情况的空间,满了说明有操作超出了预留
+            if (jn->cnt == jn->trans_max) PANIC("journal_write: operation exceeds its reservation");
+            jn->lbas[jn->cnt++] = sec_lba;
+        }
+        bcache_write_pinned(part->my_disk, sec_lba, (uint8_t*)buf + sec_idx * SECTOR_SIZE);
+    }
+    lock_release(&jn->lock);
+}
+
+/**
+ * @description: 等正在进行的操作都结束后提交分区当前的事务,事务中的扇区随后写回原位置.不能在操作中调用
+ * @param {partition*} part 分区
+ * @return {*}
+ */
+void journal_commit(struct partition* part) {
+    struct journal* jn = part->journal;
+    enum intr_status old_status = intr_disable();
+    while (jn->committing || jn->outstanding > 0) journal_wait(jn);
+    journal_commit_between(part, old_status);
+    intr_set_status(old_status);
+}
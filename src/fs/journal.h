@@ -0,0 +1,64 @@
+#ifndef __FS_JOURNAL_H
+#define __FS_JOURNAL_H
+
+#include "stdin.h"
+#include "sync.h"
+#include "list.h"
+#include "ide.h"
+
+#define JOURNAL_MAGIC       0x4a524e4c                // 日志魔数"JRNL"
+#define JOURNAL_TRANS_MAX   120                       // 一个事务最多记录的元数据扇区数
+#define JOURNAL_SECTS       (2 + JOURNAL_TRANS_MAX)   // 日志区大小: 日志头 + 描述块 + 事务中的扇区
+
+// 一个操作最多改动的元数据,按最坏情况为每个操作预留事务空间,超出的长操作要用fs_op_restart分段
+#define JOURNAL_OP_BITMAP_SECTS 24                    // 位图扇区
+#define JOURNAL_OP_BITMAP_STEP  8                     // 两次fs_op_checkpoint之间最多改动的位图扇区
+#define JOURNAL_OP_INODES       3                     // inode,每个最多跨两个扇区
+#define JOURNAL_OP_BLOCKS       8                     // 目录块和间接块表
+
+/* 日志头,位于日志区第0扇区 */
+struct journal_header {
+    uint32_t magic;
+    uint32_t checkpoint_seq;                  // 这个序号及之前的事务都已经写回了原位置
+    uint8_t  pad[504];
+} __attribute__ ((packed));
+
+/* 事务描述块,位于日志区第1扇区,后面紧跟事务中各扇区的新内容,三者一次顺序写入 */
+struct journal_desc {
+    uint32_t magic;
+    uint32_t seq;                             // 事务序号
+    uint32_t cnt;                             // 事务中的扇区数
+    uint32_t checksum;                        // 事务中各扇区内容的校验和,对不上说明事务没有写完整
+    uint32_t lbas[JOURNAL_TRANS_MAX];         // 各扇区在分区中的原位置
+    uint8_t  pad[512 - 16 - JOURNAL_TRANS_MAX * 4];
+} __attribute__ ((packed));
+
+/* 分区的元数据日志 */
+struct journal {
+    uint32_t lba;                             // 日志区起始扇区
+    uint32_t seq;                             // 当前事务的序号
+    uint32_t cnt;                             // 当前事务中的扇区数
+    uint32_t trans_max;                       // 事务最多的扇区数,受格式化时日志区大小的限制
+    uint32_t op_sects;                        // 每个操作预留的扇区数
+    uint32_t outstanding;                     // 正在进行的操作数
+    bool committing;                          // 正在提交,新的操作要等提交结束
+    struct list waiters;                      // 等待事务有空间或者提交结束的线程
+    uint32_t lbas[JOURNAL_TRANS_MAX];         // 当前事务中的扇区,都钉在块缓存中
+    uint8_t* buf;                             // 提交时拼接描述块和扇区内容的缓冲区
+    struct lock lock;
+};
+
+/* 格式化时初始化hd上lba处的日志区 */
+void journal_format(struct disk* hd, uint32_t lba);
+/* 挂载时加载分区的日志,有提交完整但没有写回的事务就重放 */
+void journal_load(struct partition* part);
+/* 开始一个操作,在当前事务中为它预留空间 */
+void journal_begin(struct partition* part);
+/* 结束journal_begin开始的操作 */
+void journal_end(struct partition* part);
+/* 在操作中经过日志写入元数据,数据在事务提交之前只留在缓存中 */
+void journal_write(struct partition* part, uint32_t lba, void* buf, uint32_t sec_cnt);
+/* 等正在进行的操作都结束后提交当前事务,随后把其中的扇区写回原位置 */
+void journal_commit(struct partition* part);
+
+#endif
@@ -3,7 +3,7 @@
 
 #include "stdin.h"
 
-#define SUPER_BLOCK_MAGIC 0x19590318  // 超级块魔数 
+#define SUPER_BLOCK_MAGIC 0x1959031d  // 超级块魔数 
 
 /* 超级块 */
 struct super_block {
@@ -21,11 +21,16 @@ struct super_block {
     uint32_t inode_table_lba;	      // i结点表起始扇区lba地址
     uint32_t inode_table_sects;	      // i结点表占用的扇区数量
 
+    uint32_t journal_lba;	          // 元数据日志区起始扇区lba地址
+    uint32_t journal_sects;	          // 元数据日志区占用的扇区数量
+
     uint32_t data_start_lba;	      // 数据区开始的第一个扇区号
     uint32_t root_inode_no;	          // 根目录所在的I结点号
     uint32_t dir_entry_size;	      // 目录项大小，现在是32字节
+    uint32_t block_size;	          // 数据块字节大小,格式化时选定,512/1024/2048/4096
+    uint32_t block_sects;	          // 每个数据块的扇区数
 
-    uint8_t  pad[460];		          // 加上460字节,凑够512字节1扇区大小
+    uint8_t  pad[444];		          // 加上444字节,凑够512字节1扇区大小
 } __attribute__ ((packed));
 
 #endif
\ No newline at end of file
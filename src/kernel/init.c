@@ -9,6 +9,7 @@
 #include "tss.h"
 #include "syscall_init.h"
 #include "ide.h"
+#include "bcache.h"
 #include "cmos.h"
 #include "fs.h"
 
@@ -33,6 +34,8 @@ void init_all(void) {
     syscall_init();
     /* 10、硬盘驱动初始化 */
     ide_init();
-    /* 11、文件系统初始化 */
+    /* 11、块缓存初始化 */
+    bcache_init();
+    /* 12、文件系统初始化 */
     filesys_init();
 }
\ No newline at end of file
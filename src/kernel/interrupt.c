@@ -3,6 +3,11 @@
 #include "print.h"
 #include "global.h"
 #include "io.h"
+#include "thread.h"
+#include "mmap.h"
+#include "wait_exit.h"
+
+#define PF_ERR_WRITE 0x2       // 缺页错误码的第1位,为1表示由写操作引起
 
 // idt是中断描述符表,本质上就是个中断门描述符数组
 static struct gate_desc idt[IDT_DESC_CNT];
@@ -58,11 +63,8 @@ static void idt_desc_init(void) {
     put_str("----dt_desc_init done!\n");
 }
 
-/* 通用中断处理程序 */
-static void general_intr_handler(uint8_t vec_nr) {
-    if (vec_nr == 0x27 || vec_nr == 0x2f) {	// 0x2f是从片8259A上的最后一个irq引脚，保留
-        return;		                        // IRQ7和IRQ15会产生伪中断(spurious interrupt),无须处理。
-    }
+/* 打印异常信息.用户进程引起的异常只结束这个进程,内核中的异常才悬停 */
+static void exception_report(uint8_t vec_nr, struct intr_stack* frame) {
     put_str("\n");
     put_str("###################interrupt message###################\n");
     put_str("interrupt name is ");
@@ -72,16 +74,43 @@ static void general_intr_handler(uint8_t vec_nr) {
     put_hex(vec_nr);
     put_char('\n');
 
-    if (vec_nr == 14) {	                                         // 若为Pagefault,将缺失的地址打印出来并悬停
+    if (vec_nr == 14) {	                                         // 若为Pagefault,将缺失的地址打印出来
         int page_fault_vaddr = 0; 
         asm ("movl %%cr2, %0" : "=r" (page_fault_vaddr));	     // cr2是存放造成page_fault的地址
         put_str("\npage fault addr is ");put_int(page_fault_vaddr); put_char('\n');
     }
+    // 0x20以下是cpu异常,被打断的代码段特权级为3说明是用户进程引起的
+    struct task_struct* cur = running_thread();
+    if (vec_nr < 0x20 && (frame->cs & 3) == 3 && cur->pgdir != NULL && cur != init_proc) {
+        put_str("process "); put_str(cur->name); put_str(" killed\n");
+        put_str("#######################################################\n");
+        sys_exit(-1);
+    }
     put_str("#######################################################\n");
 
     while(1); // 能进入中断处理程序表明已经关闭了中断。
 }
 
+/* 通用中断处理程序,参数就是中断栈中压入的中断号 */
+static void general_intr_handler(uint32_t vec_nr) {
+    if (vec_nr == 0x27 || vec_nr == 0x2f) {	// 0x2f是从片8259A上的最后一个irq引脚，保留
+        return;		                        // IRQ7和IRQ15会产生伪中断(spurious interrupt),无须处理。
+    }
+    exception_report(vec_nr, (struct intr_stack*)&vec_nr);
+}
+
+/* 缺页处理程序,用户空间映射区的缺页就地调入后返回重新执行,其余的缺页按异常处理 */
+static void page_fault_handler(uint32_t vec_nr) {
+    uint32_t page_fault_vaddr = 0;
+    asm ("movl %%cr2, %0" : "=r" (page_fault_vaddr));
+    // 参数就是中断栈中压入的中断号,后面紧跟着cpu压入的错误码
+    struct intr_stack* frame = (struct intr_stack*)&vec_nr;
+    if (page_fault_vaddr < KERNEL_SPACE_START && vm_fault(page_fault_vaddr, (frame->err_code & PF_ERR_WRITE) != 0)) {
+        return;
+    }
+    exception_report(vec_nr, frame);
+}
+
 /* 一般中断处理函数注册及异常名称注册 */
 static void exception_init(void) {	
     put_str("----exception_init begin!\n");
@@ -114,6 +143,7 @@ static void exception_init(void) {
     intr_name[0x21] = "keyboard interrupt";
     intr_name[0x2e] = "Hard disk interrupt";
     intr_name[0x80] = "System call";
+    idt_table[14] = page_fault_handler;
 
     put_str("----exception_init end!\n");
 }
@@ -8,12 +8,37 @@
 #include "sync.h"
 #include "interrupt.h"
 
-/* 内存池结构 */
+// 伙伴系统最大的块是2^BUDDY_MAX_ORDER页,即4MB
+#define BUDDY_MAX_ORDER 10
+// 单页空闲链表最多留着的页数
+#define FRAME_HOT_MAX   32
+
+/* 页框的状态 */
+enum frame_state {
+    FRAME_USED,     // 已分配,或者是空闲块中首页以外的页
+    FRAME_FREE,     // 伙伴系统中空闲块的首页
+    FRAME_HOT       // 在单页空闲链表中
+};
+
+/* 物理页框信息,每个页框一个 */
+struct page_frame {
+    struct list_elem free_elem;  // 在伙伴系统空闲链表或者单页空闲链表中的节点
+    uint32_t refs;               // 用户页除自己以外的共享者个数,fork共享页时增加,只在关中断时读写
+    uint8_t order;               // 空闲块的阶,只在空闲块的首页有意义
+    uint8_t state;               // enum frame_state
+};
+
+/* 内存池结构,物理页框按伙伴系统管理 */
 struct pool {
-    struct bitmap pool_bitmap; // 本内存池用到的位图结构,用于管理物理内存
-    uint32_t phy_addr_start;   // 本内存池所管理物理内存的起始地址
-    uint32_t pool_size;		   // 本内存池字节容量
-    struct lock lock;          // 申请内存时互斥
+    struct page_frame* frames;                   // 本内存池每个页框的信息
+    struct list free_area[BUDDY_MAX_ORDER + 1];  // 各阶空闲块的链表
+    struct list hot_frames;                      // 刚释放的单页,分配单页时先从这里拿,不和伙伴合并
+    uint32_t hot_cnt;                            // hot_frames中的页数
+    uint32_t pg_cnt;                             // 本内存池的页框数
+    uint32_t free_pages;                         // 空闲的页框数,包括hot_frames中的
+    uint32_t phy_addr_start;                     // 本内存池所管理物理内存的起始地址
+    uint32_t pool_size;		                     // 本内存池字节容量
+    struct lock lock;                            // 申请内存时互斥
 };
 
 // 拿到addr的前10bit，也就是页目录的索引
@@ -25,9 +50,10 @@ struct pool {
 struct mem_block_desc k_block_descs[DESC_CNT];	// 内核内存块描述符数组,其中规格，最小16Byte
 struct pool kernel_pool, user_pool;             // 生成内核内存池和用户内存池
 struct virtual_addr kernel_vaddr;	            // 此结构是用来给内核分配虚拟地址
+static uint8_t* cow_buf;                        // 写时复制时中转页内容的缓冲区
 
 /* 在pf表示的虚拟地址池中同时取出pg_cnt个连续的页，成功返回虚拟地址，失败返回NULL */
-static void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt) {
+void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt) {
     int vaddr_start = 0, bit_idx_start = -1;
     uint32_t cnt = 0;
     if (pf == PF_KERNEL) {
@@ -75,19 +101,110 @@ uint32_t* pde_ptr(uint32_t vaddr) {
     return pde;
 }
 
+/* vaddr所在的页是否已经映射,页目录项不存在时不能再去访问页表项 */
+bool page_present(uint32_t vaddr) {
+    return (*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & PG_P_1);
+}
+
+/* 把从pg_idx起的2^order页作为空闲块挂到对应阶的链表上 */
+static void buddy_block_add(struct pool* m_pool, uint32_t pg_idx, uint32_t order) {
+    struct page_frame* frame = &m_pool->frames[pg_idx];
+    frame->order = order;
+    frame->state = FRAME_FREE;
+    list_push(&m_pool->free_area[order], &frame->free_elem);
+}
+
+/* 释放从pg_idx起的2^order页,伙伴也空闲时合并成高一阶的块,一直合并上去 */
+static void buddy_free(struct pool* m_pool, uint32_t pg_idx, uint32_t order) {
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy_idx = pg_idx ^ (1 << order);
+        if (buddy_idx >= m_pool->pg_cnt) break;
+        struct page_frame* buddy = &m_pool->frames[buddy_idx];
+        if (buddy->state != FRAME_FREE || buddy->order != order) break;
+        list_remove(&buddy->free_elem);
+        buddy->state = FRAME_USED;
+        pg_idx &= ~(1 << order);
+        order++;
+    }
+    buddy_block_add(m_pool, pg_idx, order);
+}
+
+/* 释放页号在[start, end)中的页,按能对齐的最大块逐块释放 */
+static void buddy_free_range(struct pool* m_pool, uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = BUDDY_MAX_ORDER;
+        while ((start & ((1 << order) - 1)) != 0 || start + (1 << order) > end) order--;
+        buddy_free(m_pool, start, order);
+        start += 1 << order;
+    }
+}
+
+/* 分配2^order页的连续块,从够大的最低阶拆起,拆下的后一半挂回低一阶,成功返回首页页号,失败返回-1 */
+static int32_t buddy_alloc(struct pool* m_pool, uint32_t order) {
+    uint32_t cur_order = order;
+    while (cur_order <= BUDDY_MAX_ORDER && list_empty(&m_pool->free_area[cur_order])) cur_order++;
+    if (cur_order > BUDDY_MAX_ORDER) return -1;
+    struct page_frame* frame = elem2entry(struct page_frame, free_elem, list_pop(&m_pool->free_area[cur_order]));
+    frame->state = FRAME_USED;
+    uint32_t pg_idx = frame - m_pool->frames;
+    while (cur_order > order) {
+        cur_order--;
+        buddy_block_add(m_pool, pg_idx + (1 << cur_order), cur_order);
+    }
+    return pg_idx;
+}
+
+/* 初始化内存池的伙伴系统,页号小于first_free的页留作它用 */
+static void buddy_init(struct pool* m_pool, uint32_t first_free) {
+    for (uint32_t order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        list_init(&m_pool->free_area[order]);
+    }
+    list_init(&m_pool->hot_frames);
+    m_pool->hot_cnt = 0;
+    buddy_free_range(m_pool, first_free, m_pool->pg_cnt);
+    m_pool->free_pages = m_pool->pg_cnt - first_free;
+}
+
 /**
- * @description: 在m_pool指向的物理内存池中分配1个物理页,成功则返回页框的物理地址,失败则返回NULL
+ * @description: 在m_pool指向的物理内存池中分配1个物理页,先从单页空闲链表中拿,没有再找伙伴系统
  * @param {pool*} m_pool 内存池（内核内存池，用户内存池）
- * @return {*}
+ * @return {*} 成功则返回页框的物理地址,失败则返回NULL
  */
 static void* palloc(struct pool* m_pool) {
-    int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);    // 找一个物理页面
-    if (bit_idx == -1) {
-        return NULL;
+    enum intr_status old_status = intr_disable();
+    int32_t pg_idx = -1;
+    if (!list_empty(&m_pool->hot_frames)) {
+        struct page_frame* frame = elem2entry(struct page_frame, free_elem, list_pop(&m_pool->hot_frames));
+        frame->state = FRAME_USED;
+        m_pool->hot_cnt--;
+        pg_idx = frame - m_pool->frames;
     }
-    bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);	      // 将此位bit_idx置1
-    uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
-    return (void*)page_phyaddr;
+    else {
+        pg_idx = buddy_alloc(m_pool, 0);
+    }
+    if (pg_idx != -1) m_pool->free_pages--;
+    intr_set_status(old_status);
+    return pg_idx == -1 ? NULL : (void*)(m_pool->phy_addr_start + pg_idx * PG_SIZE);
+}
+
+/**
+ * @description: 在m_pool中分配pg_cnt个物理地址连续的页,取能装下的最小的块,多出的尾部还回伙伴系统
+ * @param {pool*} m_pool 内存池
+ * @param {uint32_t} pg_cnt 页数
+ * @return {*} 成功则返回第一页的物理地址,没有这么大的连续空闲块返回NULL
+ */
+static void* palloc_contig(struct pool* m_pool, uint32_t pg_cnt) {
+    uint32_t order = 0;
+    while ((1u << order) < pg_cnt) order++;
+    if (order > BUDDY_MAX_ORDER) return NULL;
+    enum intr_status old_status = intr_disable();
+    int32_t pg_idx = buddy_alloc(m_pool, order);
+    if (pg_idx != -1) {
+        buddy_free_range(m_pool, pg_idx + pg_cnt, pg_idx + (1 << order));
+        m_pool->free_pages -= pg_cnt;
+    }
+    intr_set_status(old_status);
+    return pg_idx == -1 ? NULL : (void*)(m_pool->phy_addr_start + pg_idx * PG_SIZE);
 }
 
 /**
@@ -132,7 +249,20 @@ void* malloc_page(enum pool_flags pf, uint32_t pg_cnt) {
     uint32_t vaddr = (uint32_t)vaddr_start, cnt = pg_cnt;
     struct pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
 
-    /* 因为虚拟地址是连续的,但物理地址可以是不连续的,所以逐个做映射*/
+    /* 多页时先向伙伴系统要一整块连续的物理页,一次拿到 */
+    if (pg_cnt > 1) {
+        uint32_t page_phyaddr = (uint32_t)palloc_contig(mem_pool, pg_cnt);
+        if (page_phyaddr != 0) {
+            while (cnt-- > 0) {
+                page_table_add((void*)vaddr, (void*)page_phyaddr);
+                vaddr += PG_SIZE;
+                page_phyaddr += PG_SIZE;
+            }
+            return vaddr_start;
+        }
+    }
+
+    /* 虚拟地址是连续的,但物理地址可以是不连续的,没有足够大的连续块时逐页做映射*/
     while (cnt-- > 0) {
         void* page_phyaddr = palloc(mem_pool);
         // 失败时要将曾经已申请的虚拟地址和物理页全部回滚 #TODO
@@ -246,8 +376,7 @@ static void mem_pool_init(uint32_t all_mem) {
     uint16_t all_free_pages = free_mem / PG_SIZE;     // 空闲了多少页 
     uint16_t kernel_free_pages = all_free_pages / 2;                  // 内核空间拿一半空闲的页
     uint16_t user_free_pages = all_free_pages - kernel_free_pages;    // 用户空间拿一半空闲的页
-    uint32_t kbm_length = kernel_free_pages / 8;		  // 内核空间bitmap的长度
-    uint32_t ubm_length = user_free_pages / 8;			  // 用户空间bitmap的长度
+    uint32_t kbm_length = kernel_free_pages / 8;		  // 内核虚拟地址bitmap的长度
     uint32_t kp_start = used_mem;			        	  // 内核空间的起始地址
     uint32_t up_start = kp_start + kernel_free_pages * PG_SIZE;	  // 用户空间的起始地址
 
@@ -257,29 +386,38 @@ static void mem_pool_init(uint32_t all_mem) {
     kernel_pool.pool_size = kernel_free_pages * PG_SIZE;  // 内核内存池的大小
     user_pool.pool_size = user_free_pages * PG_SIZE;     // 用户内存池的大小
 
-    kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length;  // 内核内存池位图的长度
-    user_pool.pool_bitmap.btmp_bytes_len = ubm_length;    // 用户内存池位图的长度
-
-    kernel_pool.pool_bitmap.bits = (void*)MEM_BITMAP_BASE;               // 内核内存池位图的起始地址
-    user_pool.pool_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length);  // 用户内存池位图的起始地址
-
-    bitmap_init(&kernel_pool.pool_bitmap);  // 内核内存池位图初始化
-    bitmap_init(&user_pool.pool_bitmap);    // 用户内存池位图初始化
-
-    /******************** 输出内核内存池和用户内存池信息(物理地址) **********************/
-    put_str("--------kernel_pool_bitmap_start:");put_hex((int)kernel_pool.pool_bitmap.bits);put_str("\n");
-    put_str("--------kernel_pool_phy_addr_start:");put_hex(kernel_pool.phy_addr_start);put_str("\n");
-    put_str("--------user_pool_bitmap_start:");put_hex((int)user_pool.pool_bitmap.bits);put_str("\n");
-    put_str("--------user_pool_phy_addr_start:");put_hex(user_pool.phy_addr_start);put_str("\n");
+    kernel_pool.pg_cnt = kernel_free_pages;    // 内核内存池的页框数
+    user_pool.pg_cnt = user_free_pages;        // 用户内存池的页框数
 
     /* 下面初始化内核虚拟地址的位图,按实际物理内存大小生成数组。*/
     kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length;
-    /* 位图的数组指向一块未使用的内存,目前定位在内核内存池和用户内存池之外*/
-    kernel_vaddr.vaddr_bitmap.bits = (void*)(MEM_BITMAP_BASE + kbm_length + ubm_length);
+    /* 位图的数组指向一块未使用的内存 */
+    kernel_vaddr.vaddr_bitmap.bits = (void*)MEM_BITMAP_BASE;
     /* 虚拟地址跨过低端的1MB以及页表的128KB */
     kernel_vaddr.vaddr_start = K_HEAP_START;
     bitmap_init(&kernel_vaddr.vaddr_bitmap);
-    bitmap_init(&user_pool.pool_bitmap);
+
+    /* 两个内存池的页框信息放在内核内存池开头的几页中,映射到内核堆的开头,这几页不归伙伴系统管 */
+    uint32_t frames_pages = DIV_ROUND_UP(all_free_pages * sizeof(struct page_frame), PG_SIZE);
+    for (uint32_t pg_idx = 0; pg_idx < frames_pages; pg_idx++) {
+        uint32_t vaddr = K_HEAP_START + pg_idx * PG_SIZE;
+        // 伙伴系统还没建好,page_table_add不能再palloc页表,只能用loader建好的内核页表
+        ASSERT(*pde_ptr(vaddr) & PG_P_1);
+        page_table_add((void*)vaddr, (void*)(kp_start + pg_idx * PG_SIZE));
+        bitmap_set(&kernel_vaddr.vaddr_bitmap, pg_idx, 1);
+    }
+    memset((void*)K_HEAP_START, 0, frames_pages * PG_SIZE);
+    kernel_pool.frames = (struct page_frame*)K_HEAP_START;
+    user_pool.frames = kernel_pool.frames + kernel_free_pages;
+
+    buddy_init(&kernel_pool, frames_pages);
+    buddy_init(&user_pool, 0);
+
+    /******************** 输出内核内存池和用户内存池信息(物理地址) **********************/
+    put_str("--------kernel_pool_frames:");put_hex((int)kernel_pool.frames);put_str("\n");
+    put_str("--------kernel_pool_phy_addr_start:");put_hex(kernel_pool.phy_addr_start);put_str("\n");
+    put_str("--------user_pool_frames:");put_hex((int)user_pool.frames);put_str("\n");
+    put_str("--------user_pool_phy_addr_start:");put_hex(user_pool.phy_addr_start);put_str("\n");
 
     lock_init(&kernel_pool.lock);
     lock_init(&user_pool.lock);
@@ -349,10 +487,16 @@ void* sys_malloc(uint32_t size) {
         // 超过最大内存块1024, 就分配页框，需要的页框数为申请内存大小+内存块元信息
         uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE);
 
-        a = malloc_page(PF, page_cnt);
+        if (PF == PF_USER) {
+            // 用户进程只分配虚拟地址,页在第一次访问时由缺页处理映射,映射时已经清0
+            a = vaddr_get(PF_USER, page_cnt);
+        }
+        else {
+            a = malloc_page(PF, page_cnt);
+            if (a != NULL) memset(a, 0, page_cnt * PG_SIZE);	 // 将分配的内存清0
+        }
 
         if (a != NULL) {
-            memset(a, 0, page_cnt * PG_SIZE);	 // 将分配的内存清0  
 
             /* 对于分配的大块页框,将desc置为NULL, cnt置为页框数,large置为true */
             a->desc = NULL;
@@ -417,17 +561,73 @@ void* sys_malloc(uint32_t size) {
 
 /* 将物理地址pg_phy_addr回收到物理内存池,这里的回收以页为单位 */
 void pfree(uint32_t pg_phy_addr) {
-    struct pool* mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phy_addr >= user_pool.phy_addr_start) {         // 用户物理内存池
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
+    struct pool* mem_pool = pg_phy_addr >= user_pool.phy_addr_start ? &user_pool : &kernel_pool;
+    uint32_t pg_idx = (pg_phy_addr - mem_pool->phy_addr_start) / PG_SIZE;
+    struct page_frame* frame = &mem_pool->frames[pg_idx];
+    enum intr_status old_status = intr_disable();
+    // 用户页还有其它进程共享时只减少共享者个数
+    if (frame->refs > 0) {
+        frame->refs--;
+        intr_set_status(old_status);
+        return;
+    }
+    ASSERT(frame->state == FRAME_USED);
+    // 单页先放进单页空闲链表,满了才还给伙伴系统合并
+    if (mem_pool->hot_cnt < FRAME_HOT_MAX) {
+        frame->state = FRAME_HOT;
+        list_push(&mem_pool->hot_frames, &frame->free_elem);
+        mem_pool->hot_cnt++;
     }
-    else {	                                               // 内核物理内存池
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+    else {
+        buddy_free(mem_pool, pg_idx, 0);
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);	 // 将位图中该位清0
+    mem_pool->free_pages++;
+    intr_set_status(old_status);
+}
+
+/* 用户物理页pg_phy_addr多了一个共享者 */
+void page_ref_inc(uint32_t pg_phy_addr) {
+    ASSERT(pg_phy_addr >= user_pool.phy_addr_start);
+    struct page_frame* frame = &user_pool.frames[(pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE];
+    enum intr_status old_status = intr_disable();
+    ASSERT(frame->state == FRAME_USED);
+    frame->refs++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @description: 处理对写时复制页vaddr的写入.还有其它共享者时复制一份物理页再改成可写,否则直接改成可写
+ * @param {uint32_t} vaddr 被写入的虚拟地址,所在的页必须存在
+ * @return {*} 不是写时复制页或者内存不足时返回false
+ */
+bool page_cow_break(uint32_t vaddr) {
+    vaddr &= 0xfffff000;
+    uint32_t* pte = pte_ptr(vaddr);
+    if (!(*pte & PG_COW)) return false;
+    uint32_t pg_phy_addr = *pte & 0xfffff000;
+    struct page_frame* frame = &user_pool.frames[(pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE];
+    // 共享者可能同时在pfree或者fork,refs的检查和修改要在同一段关中断中完成,palloc不会睡眠
+    enum intr_status old_status = intr_disable();
+    if (frame->refs == 0) {
+        // 其它共享者都已经复制走或者释放了,这一页归自己独有
+        *pte = (*pte | PG_RW_W) & ~PG_COW;
+        asm volatile ("invlpg %0"::"m" (*(uint8_t*)vaddr) : "memory");
+    }
+    else {
+        void* page_phyaddr = palloc(&user_pool);
+        if (page_phyaddr == NULL) {
+            intr_set_status(old_status);
+            return false;
+        }
+        frame->refs--;
+        // 旧页经缓冲区复制到新页,关着中断缓冲区不会被别人同时使用
+        memcpy(cow_buf, (void*)vaddr, PG_SIZE);
+        *pte = (uint32_t)page_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+        asm volatile ("invlpg %0"::"m" (*(uint8_t*)vaddr) : "memory");
+        memcpy((void*)vaddr, cow_buf, PG_SIZE);
+    }
+    intr_set_status(old_status);
+    return true;
 }
 
 /* 去掉页表中虚拟地址vaddr的映射,只去掉vaddr对应的pte */
@@ -437,8 +637,16 @@ static void page_table_pte_remove(uint32_t vaddr) {
     asm volatile ("invlpg %0"::"m" (vaddr) : "memory");    // 更新tlb
 }
 
+/* 去掉内核虚拟页vaddr的映射并归还虚拟地址,物理页不释放,返回它的物理地址,比如挂到别的进程页目录中的页表 */
+uint32_t kernel_page_detach(void* vaddr) {
+    uint32_t pg_phy_addr = addr_v2p((uint32_t)vaddr);
+    page_table_pte_remove((uint32_t)vaddr);
+    vaddr_remove(PF_KERNEL, vaddr, 1);
+    return pg_phy_addr;
+}
+
 /* 在虚拟地址池中释放以_vaddr起始的连续pg_cnt个虚拟页地址 */
-static void vaddr_remove(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
+void vaddr_remove(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
     uint32_t bit_idx_start = 0;
     uint32_t vaddr = (uint32_t)_vaddr;
     uint32_t cnt = 0;
@@ -480,6 +688,8 @@ void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
         // 位于user_pool内存池,要释放的是用户内存
         for (page_cnt = 0; page_cnt < pg_cnt; page_cnt++) {
             vaddr = (int)_vaddr + PG_SIZE * page_cnt;
+            // 按需映射的页从没被访问过时没有物理页,只需归还虚拟地址
+            if (!page_present(vaddr)) continue;
             pg_phy_addr = addr_v2p(vaddr);
             // 确保物理地址属于用户物理内存池 
             ASSERT((pg_phy_addr % PG_SIZE) == 0);
@@ -570,5 +780,9 @@ void mem_init() {
     put_str("mem_bytes_total:"); put_int(mem_bytes_total); put_str("Byte = "); put_int(mem_bytes_total / 1024 / 1024);  put_str("MB\n");
     mem_pool_init(mem_bytes_total);	  // 初始化内存池
     arena_init();                     // 初始化arena
+    /* 写时复制的缓冲区 */
+    cow_buf = get_kernel_pages(1);
+    /* 打开cr0的wp位,内核写只读的用户页时也引起缺页,写时复制的页才不会被内核直接改掉 */
+    asm volatile ("movl %%cr0, %%eax; orl $0x10000, %%eax; movl %%eax, %%cr0" : : : "eax", "memory");
     put_str("mem_init done!\n");
 }
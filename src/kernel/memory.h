@@ -18,11 +18,14 @@
 // 一个页框的大小，4KB
 #define PG_SIZE 4096
 // 位图的地址，这里涉及到一点后续的内存规划 
-// 0xc009a000~0xc009dfff 为物理位图
+// 0xc009a000~0xc009dfff 为内核虚拟地址位图
 // 0xc009e000~0xc009efff 为main线程的pcb
 // 0xc009f000 为main线程的栈顶
 #define MEM_BITMAP_BASE 0xc009a000
 
+// 3GB以上是内核空间,所有进程的页表中这部分都相同
+#define KERNEL_SPACE_START 0xc0000000
+
 // 0x100000意指跨过低端1M内存,也就是低端的1MB随我们折腾了
 #define K_HEAP_START 0xc0100000
 
@@ -32,6 +35,7 @@
 #define	 PG_RW_W  2	// R/W 属性位值, 读/写/执行
 #define	 PG_US_S  0	// U/S 属性位值, 系统级
 #define	 PG_US_U  4	// U/S 属性位值, 用户级
+#define	 PG_COW   0x200	// 页表项中留给系统用的第9位,标记fork后共享的写时复制页
 
 #define  DESC_CNT 7	// 内存块描述符个数
 
@@ -68,10 +72,18 @@ struct arena {
 };
 
 
+/* 在pf表示的虚拟地址池中取出pg_cnt个连续的虚拟页,不分配物理页 */
+void* vaddr_get(enum pool_flags pf, uint32_t pg_cnt);
+/* 在虚拟地址池中释放以_vaddr起始的连续pg_cnt个虚拟页地址 */
+void vaddr_remove(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
+/* 去掉内核虚拟页vaddr的映射并归还虚拟地址,返回物理地址,物理页留给调用者 */
+uint32_t kernel_page_detach(void* vaddr);
 /* 得到虚拟地址vaddr对应的pte指针*/
 uint32_t* pte_ptr(uint32_t vaddr);
 /* 得到虚拟地址vaddr对应的pde指针*/
 uint32_t* pde_ptr(uint32_t vaddr);
+/* vaddr所在的页是否已经映射 */
+bool page_present(uint32_t vaddr);
 /* 内存管理部分初始化 */
 void mem_init(void);
 /* 从内核物理内存池中申请pg_cnt页内存,成功则返回其虚拟地址,失败则返回NULL */
@@ -96,5 +108,9 @@ void pfree(uint32_t pg_phy_addr);
 void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
 
 void* get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
+/* 用户物理页pg_phy_addr多了一个共享者 */
+void page_ref_inc(uint32_t pg_phy_addr);
+/* 处理对写时复制页vaddr的写入,成功返回true */
+bool page_cow_break(uint32_t vaddr);
 
 #endif
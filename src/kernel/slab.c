@@ -0,0 +1,165 @@
+#include "slab.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "global.h"
+#include "string.h"
+#include "assert.h"
+
+/* slab头,放在slab的开头,后面紧跟空闲对象的下标栈,对象本身不放任何管理信息 */
+struct slab {
+    struct slab_cache* cache;     // 所属的cache
+    struct list_elem slab_tag;    // 在cache的partial或full链表中的节点
+    uint32_t inuse;               // 分配出去的对象个数,cache的hot中的也算
+    uint32_t free_cnt;            // 下标栈中的空闲对象个数
+    uint16_t free_idx[];          // 空闲对象的下标栈
+};
+
+/* 计算对象在slab中的布局,取浪费不超过1/8的最少页数 */
+static void slab_layout(struct slab_cache* cache) {
+    for (uint32_t pg_cnt = 1; pg_cnt <= SLAB_MAX_PAGES; pg_cnt++) {
+        uint32_t size = pg_cnt * PG_SIZE;
+        if (size < sizeof(struct slab) + sizeof(uint16_t) + cache->obj_size) continue;
+        uint32_t objs = (size - sizeof(struct slab)) / (cache->obj_size + sizeof(uint16_t));
+        uint32_t offset = DIV_ROUND_UP(sizeof(struct slab) + objs * sizeof(uint16_t), 4) * 4;
+        // 下标栈按4字节对齐后可能挤掉一个对象
+        if (offset + objs * cache->obj_size > size) {
+            objs--;
+            offset = DIV_ROUND_UP(sizeof(struct slab) + objs * sizeof(uint16_t), 4) * 4;
+        }
+        cache->pg_cnt = pg_cnt;
+        cache->objs_per_slab = objs;
+        cache->obj_offset = offset;
+        if ((size - offset - objs * cache->obj_size) * 8 <= size) return;
+    }
+    if (cache->objs_per_slab == 0) PANIC("slab_layout: object too large");
+}
+
+/* 返回slab中第idx个对象的地址 */
+static void* slab_obj(struct slab* slab, uint32_t idx) {
+    return (void*)((uint32_t)slab + slab->cache->obj_offset + idx * slab->cache->obj_size);
+}
+
+/* 找到对象所在的slab,单页的slab直接取页首,多页的slab数量少,在cache的链表中找 */
+static struct slab* obj2slab(struct slab_cache* cache, void* obj) {
+    if (cache->pg_cnt == 1) return (struct slab*)((uint32_t)obj & 0xfffff000);
+    struct list* lists[2] = {&cache->partial, &cache->full};
+    for (uint32_t list_idx = 0; list_idx < 2; list_idx++) {
+        struct list_elem* elem = lists[list_idx]->head.next;
+        while (elem != &lists[list_idx]->tail) {
+            struct slab* slab = elem2entry(struct slab, slab_tag, elem);
+            if ((uint32_t)obj - (uint32_t)slab < cache->pg_cnt * PG_SIZE) return slab;
+            elem = elem->next;
+        }
+    }
+    PANIC("obj2slab: object not in cache");
+    return NULL;
+}
+
+/* 新建一个slab,对每个对象调用一次构造函数,下标栈按地址从低到高弹出 */
+static struct slab* slab_new(struct slab_cache* cache) {
+    struct slab* slab = get_kernel_pages(cache->pg_cnt);
+    if (slab == NULL) return NULL;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_cnt = cache->objs_per_slab;
+    for (uint32_t idx = 0; idx < cache->objs_per_slab; idx++) {
+        slab->free_idx[idx] = cache->objs_per_slab - 1 - idx;
+        if (cache->ctor != NULL) cache->ctor(slab_obj(slab, idx));
+    }
+    return slab;
+}
+
+/**
+ * @description: 初始化一个cache,对象所在的页在第一次分配时才申请
+ * @param {slab_cache*} cache 要初始化的cache
+ * @param {char*} name cache名字
+ * @param {uint32_t} obj_size 对象大小
+ * @param {void*} ctor 构造函数,为NULL时对象第一次分配出去时是清0的
+ * @return {*}
+ */
+void slab_cache_init(struct slab_cache* cache, const char* name, uint32_t obj_size, void (*ctor)(void*)) {
+    ASSERT(obj_size > 0);
+    memset(cache, 0, sizeof(struct slab_cache));
+    cache->name = name;
+    cache->obj_size = DIV_ROUND_UP(obj_size, 4) * 4;
+    cache->ctor = ctor;
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    slab_layout(cache);
+}
+
+/**
+ * @description: 从cache中分配一个对象.先拿最近释放的对象,再从有空闲对象的slab中拿,都没有才向内核内存池申请新的slab.
+ *               对象不清0,释放时是什么样分配出去就是什么样
+ * @param {slab_cache*} cache
+ * @return {*} 成功返回对象地址,失败返回NULL
+ */
+void* slab_alloc(struct slab_cache* cache) {
+    enum intr_status old_status = intr_disable();
+    if (cache->hot_cnt > 0) {
+        void* obj = cache->hot[--cache->hot_cnt];
+        intr_set_status(old_status);
+        return obj;
+    }
+    if (list_empty(&cache->partial)) {
+        if (cache->empty != NULL) {
+            list_push(&cache->partial, &cache->empty->slab_tag);
+            cache->empty = NULL;
+        }
+        else {
+            // 申请页时可能阻塞,先恢复中断
+            intr_set_status(old_status);
+            struct slab* slab = slab_new(cache);
+            if (slab == NULL) return NULL;
+            old_status = intr_disable();
+            list_push(&cache->partial, &slab->slab_tag);
+            cache->slab_cnt++;
+        }
+    }
+    struct slab* slab = elem2entry(struct slab, slab_tag, cache->partial.head.next);
+    void* obj = slab_obj(slab, slab->free_idx[--slab->free_cnt]);
+    slab->inuse++;
+    if (slab->free_cnt == 0) {
+        list_remove(&slab->slab_tag);
+        list_append(&cache->full, &slab->slab_tag);
+    }
+    intr_set_status(old_status);
+    return obj;
+}
+
+/**
+ * @description: 把对象还给cache.hot没满时直接放进hot,否则放回所在的slab,slab全空时留一个,多的把页还给内核内存池
+ * @param {slab_cache*} cache 对象所属的cache
+ * @param {void*} obj 对象,要处于构造好的状态
+ * @return {*}
+ */
+void slab_free(struct slab_cache* cache, void* obj) {
+    ASSERT(obj != NULL);
+    enum intr_status old_status = intr_disable();
+    if (cache->hot_cnt < SLAB_HOT_CNT) {
+        cache->hot[cache->hot_cnt++] = obj;
+        intr_set_status(old_status);
+        return;
+    }
+    struct slab* slab = obj2slab(cache, obj);
+    ASSERT(slab->cache == cache && slab->inuse > 0);
+    if (slab->free_cnt == 0) {
+        list_remove(&slab->slab_tag);
+        list_push(&cache->partial, &slab->slab_tag);
+    }
+    slab->free_idx[slab->free_cnt++] = ((uint32_t)obj - (uint32_t)slab - cache->obj_offset) / cache->obj_size;
+    slab->inuse--;
+    struct slab* slab_release = NULL;
+    if (slab->inuse == 0) {
+        list_remove(&slab->slab_tag);
+        if (cache->empty == NULL) {
+            cache->empty = slab;
+        }
+        else {
+            slab_release = slab;
+            cache->slab_cnt--;
+        }
+    }
+    intr_set_status(old_status);
+    if (slab_release != NULL) mfree_page(PF_KERNEL, slab_release, cache->pg_cnt);
+}
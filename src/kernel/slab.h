@@ -0,0 +1,35 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+
+#include "stdin.h"
+#include "list.h"
+
+#define SLAB_HOT_CNT    8     // 每个cache留着的刚释放的对象个数
+#define SLAB_MAX_PAGES  8     // 一个slab最多占的页数
+
+struct slab;
+
+/* 一种内核对象的缓存,对象按slab成批从内核内存池申请,释放后保持原样留着重用 */
+struct slab_cache {
+    const char* name;             // cache名字
+    uint32_t obj_size;            // 对象大小,按4字节对齐
+    uint32_t pg_cnt;              // 一个slab占的页数
+    uint32_t objs_per_slab;       // 一个slab中的对象个数
+    uint32_t obj_offset;          // 第一个对象在slab中的偏移,前面是slab头和空闲对象下标栈
+    void (*ctor)(void* obj);      // 构造函数,只在新建slab时对每个对象调用一次,可以为NULL
+    struct list partial;          // 还有空闲对象的slab
+    struct list full;             // 对象全都分配出去了的slab
+    struct slab* empty;           // 留一个全空的slab,免得在边界上反复申请释放页
+    uint32_t hot_cnt;             // hot中的对象个数
+    void* hot[SLAB_HOT_CNT];      // 最近释放的对象,分配时先从这里拿,不用动slab
+    uint32_t slab_cnt;            // 现有的slab个数
+};
+
+/* 初始化对象大小为obj_size的cache,ctor为NULL时对象第一次分配出去时是清0的 */
+void slab_cache_init(struct slab_cache* cache, const char* name, uint32_t obj_size, void (*ctor)(void*));
+/* 从cache中分配一个对象,失败返回NULL */
+void* slab_alloc(struct slab_cache* cache);
+/* 把对象还给cache,对象要处于构造好的状态 */
+void slab_free(struct slab_cache* cache, void* obj);
+
+#endif
@@ -8,6 +8,7 @@
 
 void bitmap_init(struct bitmap* btmp) {
     memset(btmp->bits, 0, btmp->btmp_bytes_len);   
+    btmp->hint = 0;
 }
 
 bool bitmap_scan_test(struct bitmap* btmp, uint32_t bit_idx) {
@@ -17,50 +18,60 @@ bool bitmap_scan_test(struct bitmap* btmp, uint32_t bit_idx) {
 }
 
 
-int bitmap_scan(struct bitmap* btmp, uint32_t cnt) {
-	uint32_t idx_byte = 0;	 // 用于记录空闲位所在的字节
-	/* 先逐字节比较,蛮力法 */
-	while (( 0xff == btmp->bits[idx_byte]) && (idx_byte < btmp->btmp_bytes_len)) {
-	/* 1表示该位已分配,所以若为0xff,则表示该字节内已无空闲位,向下一字节继续找 */
-		idx_byte++;
-	}
-
-	ASSERT(idx_byte < btmp->btmp_bytes_len);
-	if (idx_byte == btmp->btmp_bytes_len) {  // 若该内存池找不到可用空间		
-		return -1;
+/* 返回位图的第word_idx个32位字,超出位图的字节当作全1 */
+static uint32_t bitmap_word(struct bitmap* btmp, uint32_t word_idx) {
+	uint32_t byte_idx = word_idx * 4;
+	if (byte_idx + 4 <= btmp->btmp_bytes_len) {
+		return ((uint32_t*)btmp->bits)[word_idx];
 	}
-
-	/* 若在位图数组范围内的某字节内找到了空闲位，在该字节内逐位比对,返回空闲位的索引。*/
-	int idx_bit = 0;
-	while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte]) { 
-		idx_bit++;
-	}
-		
-	int bit_idx_start = idx_byte * 8 + idx_bit;    // 空闲位在位图内的下标
-	if (cnt == 1) {
-		return bit_idx_start;
+	uint32_t word = 0xffffffff;
+	for (uint32_t idx = 0; byte_idx + idx < btmp->btmp_bytes_len; idx++) {
+		word &= ~(0xff << (idx * 8)) | (btmp->bits[byte_idx + idx] << (idx * 8));
 	}
+	return word;
+}
 
-	uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start);   // 记录还有多少位可以判断
-	uint32_t next_bit = bit_idx_start + 1;
-	uint32_t count = 1;	      // 用于记录找到的空闲位的个数
+/* 不为0的word中最低的1所在的位 */
+static uint32_t bit_ctz(uint32_t word) {
+	uint32_t bit_idx;
+	asm ("bsfl %1, %0" : "=r" (bit_idx) : "rm" (word));
+	return bit_idx;
+}
 
-	bit_idx_start = -1;	      // 先将其置为-1,若找不到连续的位就直接返回
-	while (bit_left-- > 0) {
-		if (!(bitmap_scan_test(btmp, next_bit))) {	 // 若next_bit为0
-		count++;
-		} else {
-		count = 0;
-		}
-		if (count == cnt) {	    // 若找到连续的cnt个空位
-		bit_idx_start = next_bit - cnt + 1;
-		break;
+/* 从bit_idx起找第一个值为value的位,一次看32位,找不到返回位图的总位数 */
+static uint32_t bitmap_find(struct bitmap* btmp, uint32_t bit_idx, bool value) {
+	uint32_t bit_len = btmp->btmp_bytes_len * 8;
+	while (bit_idx < bit_len) {
+		uint32_t word_idx = bit_idx / 32;
+		uint32_t word = bitmap_word(btmp, word_idx);
+		// 找0时取反,再去掉bit_idx之前的位
+		if (!value) word = ~word;
+		word &= 0xffffffff << (bit_idx % 32);
+		if (word != 0) {
+			bit_idx = word_idx * 32 + bit_ctz(word);
+			return bit_idx < bit_len ? bit_idx : bit_len;
 		}
-		next_bit++;          
+		bit_idx = (word_idx + 1) * 32;
 	}
-	return bit_idx_start;
+	return bit_len;
 }
 
+int bitmap_scan(struct bitmap* btmp, uint32_t cnt) {
+	uint32_t bit_len = btmp->btmp_bytes_len * 8;
+	if (cnt == 0 || cnt > bit_len) return -1;
+	if (btmp->hint >= bit_len) btmp->hint = 0;
+
+	/* hint之前全是已分配的位,从hint开始找第一个空闲位,它就是新的hint */
+	uint32_t start = bitmap_find(btmp, btmp->hint, false);
+	btmp->hint = start;
+	/* 整段整段地跳:找到空闲段的开头,再找它的结尾,段够长就返回 */
+	while (start < bit_len) {
+		uint32_t end = cnt == 1 ? start + 1 : bitmap_find(btmp, start + 1, true);
+		if (end - start >= cnt) return start;
+		start = bitmap_find(btmp, end, false);
+	}
+	return -1;
+}
 
 void bitmap_set(struct bitmap* btmp, uint32_t bit_idx, int8_t value) {
 	ASSERT((value == 0) || (value == 1));
@@ -73,6 +84,8 @@ void bitmap_set(struct bitmap* btmp, uint32_t bit_idx, int8_t value) {
 		btmp->bits[byte_idx] |= (BITMAP_MASK << bit_odd);
 	} else {
 		btmp->bits[byte_idx] &= ~(BITMAP_MASK << bit_odd);
+		// 空出来的位在hint之前时,hint退到这里
+		if (bit_idx < btmp->hint) btmp->hint = bit_idx;
 	}
 }
 
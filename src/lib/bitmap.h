@@ -9,13 +9,14 @@
 struct bitmap {
    uint32_t btmp_bytes_len;
    uint8_t* bits;
+   uint32_t hint;      // 这一位之前全是1,扫描从这里开始
 };
 
 /* 将位图btmp初始化 */
 void bitmap_init(struct bitmap* btmp);
 /* 判断bit_idx位是否为1,若为1则返回true，否则返回false */
 bool bitmap_scan_test(struct bitmap* btmp, uint32_t bit_idx);
-/* 在位图中申请连续cnt个位,返回其起始位下标 */
+/* 在位图中找连续cnt个为0的位,返回其起始位下标,找不到返回-1 */
 int bitmap_scan(struct bitmap* btmp, uint32_t cnt);
 /* 将位图btmp的bit_idx位设置为value */
 void bitmap_set(struct bitmap* btmp, uint32_t bit_idx, int8_t value);
@@ -157,3 +157,38 @@ int32_t chdir(const char* path) {
 void ps(void) {
    _syscall0(SYS_PS);
 }
+
+/* 把文件描述符fd对应文件的修改写回硬盘 */
+int32_t fsync(int32_t fd) {
+   return _syscall1(SYS_FSYNC, fd);
+}
+
+/* 把文件fd从offset起的length字节映射到用户空间 */
+void* mmap(int32_t fd, uint32_t offset, uint32_t length) {
+   return (void*)_syscall3(SYS_MMAP, fd, offset, length);
+}
+
+/* 解除起始于addr的映射 */
+int32_t munmap(void* addr, uint32_t length) {
+   return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+/* 用path指向的程序替换当前进程,成功时不返回 */
+int32_t execv(const char* path, const char* argv[]) {
+   return _syscall2(SYS_EXECV, path, argv);
+}
+
+/* 以status结束当前进程,不返回 */
+void exit(int32_t status) {
+   _syscall1(SYS_EXIT, status);
+}
+
+/* 等待一个子进程退出,返回它的pid,退出状态存入status */
+int32_t wait(int32_t* status) {
+   return _syscall1(SYS_WAIT, status);
+}
+
+/* 显示文件系统各个缓存的命中统计 */
+void cachestat(void) {
+   _syscall0(SYS_CACHESTAT);
+}
@@ -37,7 +37,14 @@ enum SYSCALL_NR {
     SYS_READDIR,
     SYS_REWINDDIR,
     SYS_STAT,
-    SYS_PS
+    SYS_PS,
+    SYS_FSYNC,
+    SYS_MMAP,
+    SYS_MUNMAP,
+    SYS_EXECV,
+    SYS_EXIT,
+    SYS_WAIT,
+    SYS_CACHESTAT
 };
 
 uint32_t getpid(void);
@@ -62,6 +69,13 @@ void rewinddir(struct dir* dir);
 int32_t stat(const char* path, struct stat* buf);
 int32_t chdir(const char* path);
 void ps(void);
+int32_t fsync(int32_t fd);
+void* mmap(int32_t fd, uint32_t offset, uint32_t length);
+int32_t munmap(void* addr, uint32_t length);
+int32_t execv(const char* path, const char* argv[]);
+void exit(int32_t status);
+int32_t wait(int32_t* status);
+void cachestat(void);
 
 #endif
 
@@ -285,6 +285,20 @@ void buildin_clear(uint32_t argc, char** argv UNUSED) {
     clear();
 }
 
+/**
+ * @description: cachestat命令内建函数
+ * @param {uint32_t} argc
+ * @param {char** argv} UNUSED
+ * @return {*}
+ */
+void buildin_cachestat(uint32_t argc, char** argv UNUSED) {
+    if (argc != 1) {
+        printf("cachestat: no argument support!\n");
+        return;
+    }
+    cachestat();
+}
+
 /**
  * @description: mkdir命令内建函数
  * @param {uint32_t} argc
@@ -23,5 +23,6 @@ int32_t buildin_rm(uint32_t argc, char** argv);
 void buildin_touch(uint32_t argc, char** argv);
 void buildin_ps(uint32_t argc, char** argv);
 void buildin_clear(uint32_t argc, char** argv);
+void buildin_cachestat(uint32_t argc, char** argv);
 
 #endif
@@ -183,6 +183,9 @@ void my_shell(void) {
         else if (!strcmp("clear", argv[0])) {
             buildin_clear(argc, argv);
         }
+        else if (!strcmp("cachestat", argv[0])) {
+            buildin_cachestat(argc, argv);
+        }
         else if (!strcmp("mkdir", argv[0])) {
             buildin_mkdir(argc, argv);
         }
@@ -196,7 +199,22 @@ void my_shell(void) {
             buildin_touch(argc, argv);
         }
         else {
-            printf("external command\n");
+            // 外部命令由子进程加载执行,shell等它结束后再读下一条命令
+            int32_t pid = fork();
+            if (pid == 0) {
+                make_clear_abs_path(argv[0], final_path);
+                argv[0] = final_path;
+                execv(argv[0], (const char**)argv);
+                printf("my_shell: cannot access %s\n", argv[0]);
+                exit(-1);
+            }
+            else if (pid == -1) {
+                printf("my_shell: fork failed\n");
+            }
+            else {
+                int32_t status;
+                wait(&status);
+            }
         }
     }
 }
@@ -9,24 +9,40 @@
 #include "print.h"
 #include "interrupt.h"
 
-struct list thread_ready_list4;	    // 就绪队列4
-struct list thread_ready_list8;	    // 就绪队列8
-struct list thread_ready_list16;	// 就绪队列16
-struct list thread_ready_list32;	// 就绪队列32
-struct list thread_all_list;	    // 所有任务队列
+// 第level级就绪队列的优先级和时间片都是4 << level,即4、8、16、32
+#define MLFQ_PRIO(level) (4 << (level))
+
+static struct list ready_lists[MLFQ_LEVELS];  // 各级就绪队列
+static uint32_t ready_bitmap;                 // 第level位为1表示第level级就绪队列不为空
+static uint32_t ready_cnt;                    // 就绪队列中的线程总数
+struct list thread_all_list;	              // 所有任务队列
+
+/* 优先级对应的就绪队列级别,不认识的优先级返回-1 */
+static int32_t mlfq_prio2level(uint8_t priority) {
+    for (int32_t level = 0; level < MLFQ_LEVELS; level++) {
+        if (priority == MLFQ_PRIO(level)) return level;
+    }
+    return -1;
+}
+
+/* 把线程挂到第level级就绪队列的末尾,调用者关中断 */
+static void mlfq_enqueue(struct task_struct* pthread, int32_t level) {
+    pthread->status = TASK_READY;
+    pthread->mlfq_level = level;
+    list_append(&ready_lists[level], &pthread->general_tag);
+    ready_bitmap |= 1 << level;
+    ready_cnt++;
+}
 
 /* 多级反馈优先队列新插入一个线程 */
 void mlfq_new(struct task_struct* pthread) {
     // 关闭中断
     enum intr_status pop = intr_disable();
-    // 修改线程可用时间片
-    pthread->ticks = 4;
-    // 修改线程优先级
-    pthread->priority = 4;
-    // 修改线程状态为就绪态
-    pthread->status = TASK_READY;
-    // 最低层队列插入
-    list_append(&thread_ready_list4, &pthread->general_tag);
+    // 修改线程可用时间片和优先级
+    pthread->ticks = MLFQ_PRIO(0);
+    pthread->priority = MLFQ_PRIO(0);
+    // 最高一级队列插入
+    mlfq_enqueue(pthread, 0);
     // 所有任务队列插入
     list_append(&thread_all_list, &pthread->all_tag);
     // 开启中断
@@ -37,8 +53,8 @@ void mlfq_new(struct task_struct* pthread) {
 void all_push_back(struct task_struct* pthread) {
     // 关闭中断
     enum intr_status pop = intr_disable();
-    // 所有线程队列中没有新插入的线程
-    if (!elem_find(&thread_all_list, &pthread->all_tag)) {
+    // init_thread把pcb清0过,节点的指针为空说明还不在所有线程队列中
+    if (pthread->all_tag.next == NULL) {
         // 所有任务队列插入
         list_append(&thread_all_list, &pthread->all_tag);
     }
@@ -49,38 +65,20 @@ void all_push_back(struct task_struct* pthread) {
 /* 多级反馈优先队列插入一个线程, 优先级降低，时间片变多*/
 void mlfq_push(struct task_struct* pthread) {
     if (pthread == NULL) return;
-    if (mlfq_find(pthread)) return;
-    // 修改状态为就绪态
-    pthread->status = TASK_READY;
     // 关闭中断
     enum intr_status mlqf = intr_disable();
-    // 线程优先级,高优先级的先降级，但是时间片变多
-    // 不知道什么优先级的，就先按照4来。
-    if (pthread->priority == 4) {
-        pthread->priority = 8;
-        pthread->ticks = 8;
-        list_append(&thread_ready_list8, &pthread->general_tag);
-    }
-    else if (pthread->priority == 8) {
-        pthread->priority = 16;
-        pthread->ticks = 16;
-        list_append(&thread_ready_list16, &pthread->general_tag);
-    }
-    else if (pthread->priority == 16) {
-        pthread->priority = 32;
-        pthread->ticks = 32;
-        list_append(&thread_ready_list32, &pthread->general_tag);
-    }
-    else if (pthread->priority == 32) {
-        pthread->priority = 32;
-        pthread->ticks = 32;
-        list_append(&thread_ready_list32, &pthread->general_tag);
-    }
-    else {
-        pthread->priority = 4;
-        pthread->ticks = 4;
-        list_append(&thread_ready_list4, &pthread->general_tag);
+    if (mlfq_find(pthread)) {
+        intr_set_status(mlqf);
+        return;
     }
+    // 高优先级的先降一级，但是时间片变多,最低一级的不再降
+    // 不知道什么优先级的，就先按照4来。
+    int32_t level = mlfq_prio2level(pthread->priority);
+    if (level == -1) level = 0;
+    else if (level < MLFQ_LEVELS - 1) level++;
+    pthread->priority = MLFQ_PRIO(level);
+    pthread->ticks = MLFQ_PRIO(level);
+    mlfq_enqueue(pthread, level);
     // 开启中断
     intr_set_status(mlqf);
 }
@@ -88,55 +86,39 @@ void mlfq_push(struct task_struct* pthread) {
 /* 多级反馈优先队列插入一个线程, 优先级不变，时间片不变,with same priority and timeslice*/
 void mlfq_push_wspt(struct task_struct* pthread) {
     if (pthread == NULL) return;
-    if (mlfq_find(pthread)) return;
-    // 修改线程状态
-    pthread->status = TASK_READY;
     // 关闭中断
     enum intr_status mlqf = intr_disable();
-    // 线程优先级,高优先级的先降级，但是时间片变多
-    // 不知道什么优先级的，就先按照4来。
-    if (pthread->priority == 4) {
-        list_append(&thread_ready_list8, &pthread->general_tag);
-    }
-    else if (pthread->priority == 8) {
-        list_append(&thread_ready_list16, &pthread->general_tag);
-    }
-    else if (pthread->priority == 16) {
-        list_append(&thread_ready_list32, &pthread->general_tag);
-    }
-    else if (pthread->priority == 32) {
-        list_append(&thread_ready_list32, &pthread->general_tag);
+    if (mlfq_find(pthread)) {
+        intr_set_status(mlqf);
+        return;
     }
-    else {
-        pthread->priority = 4;
-        pthread->ticks = 4;
-        list_append(&thread_ready_list4, &pthread->general_tag);
+    // 不知道什么优先级的，就先按照4来。
+    int32_t level = mlfq_prio2level(pthread->priority);
+    if (level == -1) {
+        level = 0;
+        pthread->priority = MLFQ_PRIO(0);
+        pthread->ticks = MLFQ_PRIO(0);
     }
+    mlfq_enqueue(pthread, level);
     // 开启中断
     intr_set_status(mlqf);
 }
 
 /* 多级反馈优先队列弹出一个线程,队列全为空则返回NULL */
 struct task_struct* mlfq_pop(void) {
-    if (mlfq_is_empty()) return NULL;
     // 关闭中断
     enum intr_status mlfq = intr_disable();
-    struct task_struct* pthread = NULL;
-    struct list_elem* pelem = NULL;
-    if (!list_empty(&thread_ready_list4)) {
-        pelem = list_pop(&thread_ready_list4);
-
-    }
-    else if (!list_empty(&thread_ready_list8)) {
-        pelem = list_pop(&thread_ready_list8);
-    }
-    else if (!list_empty(&thread_ready_list16)) {
-        pelem = list_pop(&thread_ready_list16);
-    }
-    else if (!list_empty(&thread_ready_list32)) {
-        pelem = list_pop(&thread_ready_list32);
-    }
-    pthread = elem2entry(struct task_struct, general_tag, pelem);
+    if (ready_bitmap == 0) {
+        intr_set_status(mlfq);
+        return NULL;
+    }
+    // 位图中最低的1就是不为空的最高一级队列
+    uint32_t level;
+    asm ("bsfl %1, %0" : "=r" (level) : "rm" (ready_bitmap));
+    struct task_struct* pthread = elem2entry(struct task_struct, general_tag, list_pop(&ready_lists[level]));
+    if (list_empty(&ready_lists[level])) ready_bitmap &= ~(1 << level);
+    ready_cnt--;
+    pthread->mlfq_level = -1;
     // 开启中断
     intr_set_status(mlfq);
     return pthread;
@@ -144,43 +126,33 @@ struct task_struct* mlfq_pop(void) {
 
 /* 多级反馈优先队列判断是否为空，是返回true */
 bool mlfq_is_empty(void) {
-    return (list_empty(&thread_ready_list4) && list_empty(&thread_ready_list8) \
-        && list_empty(&thread_ready_list16) && list_empty(&thread_ready_list32));
+    return ready_bitmap == 0;
 }
 
 /* 多级返回优先队列查找，找到返回true */
 bool mlfq_find(struct task_struct* pthread) {
-    if (elem_find(&thread_ready_list4, &pthread->general_tag)) return true;
-    else if (elem_find(&thread_ready_list4, &pthread->general_tag)) return true;
-    else if (elem_find(&thread_ready_list4, &pthread->general_tag)) return true;
-    else if (elem_find(&thread_ready_list4, &pthread->general_tag)) return true;
-    return false;
+    return pthread->mlfq_level != -1;
 }
 
 /* 多级返回优先队列长度 */
 uint32_t mlfq_len(void) {
-    return list_len(&thread_ready_list4) + list_len(&thread_ready_list8) \
-        + list_len(&thread_ready_list16) + list_len(&thread_ready_list32);
+    return ready_cnt;
 }
 
-/* 多级反馈优先队列刷新,将低优先级线程往上提 */
+/* 多级反馈优先队列刷新,将低优先级线程都提到最高一级,恢复最少的时间片 */
 void mlfq_flash(void) {
     // 关闭中断
     enum intr_status mlfq = intr_disable();
-
-    struct list_elem* temp = NULL;
-    while (!list_empty(&thread_ready_list8)) {
-        temp = list_pop(&thread_ready_list8);
-        list_append(&thread_ready_list8, temp);
-    }
-    while (!list_empty(&thread_ready_list16)) {
-        temp = list_pop(&thread_ready_list16);
-        list_append(&thread_ready_list16, temp);
-    }
-    while (!list_empty(&thread_ready_list32)) {
-        temp = list_pop(&thread_ready_list32);
-        list_append(&thread_ready_list32, temp);
-    }
+    for (int32_t level = 1; level < MLFQ_LEVELS; level++) {
+        while (!list_empty(&ready_lists[level])) {
+            struct task_struct* pthread = elem2entry(struct task_struct, general_tag, list_pop(&ready_lists[level]));
+            pthread->priority = MLFQ_PRIO(0);
+            pthread->ticks = MLFQ_PRIO(0);
+            pthread->mlfq_level = 0;
+            list_append(&ready_lists[0], &pthread->general_tag);
+        }
+    }
+    if (ready_bitmap != 0) ready_bitmap = 1;
     // 开启中断
     intr_set_status(mlfq);
 }
@@ -188,10 +160,11 @@ void mlfq_flash(void) {
 /* 多级反馈优先队列初始化 */
 void mlfq_init(void) {
     put_str("mlfq_init start!\n");
-    list_init(&thread_ready_list4);
-    list_init(&thread_ready_list8);
-    list_init(&thread_ready_list16);
-    list_init(&thread_ready_list32);
+    for (int32_t level = 0; level < MLFQ_LEVELS; level++) {
+        list_init(&ready_lists[level]);
+    }
+    ready_bitmap = 0;
+    ready_cnt = 0;
     list_init(&thread_all_list);
     put_str("mlfq_init done!\n");
-}
\ No newline at end of file
+}
@@ -13,6 +13,9 @@
 
 #include "thread.h"
 
+// 就绪队列的级数
+#define MLFQ_LEVELS 4
+
 extern struct list thread_all_list;	    // 所有任务队列
 
 /* 多级反馈优先队列新插入一个线程 */
@@ -3,6 +3,7 @@
 #include "global.h"
 #include "interrupt.h"
 #include "assert.h"
+#include "timer.h"
 
 /* 初始化信号量 */
 void sema_init(struct semaphore* psema, uint8_t value) {
@@ -28,6 +29,35 @@ void sema_down(struct semaphore* psema) {
     intr_set_status(old_status);
 }
 
+/**
+ * @description: 带超时的信号量down操作,超过timeout_ticks个嘀嗒仍未获得信号量就返回
+ * @param {semaphore*} psema 信号量
+ * @param {uint32_t} timeout_ticks 最多等待的嘀嗒数
+ * @return {*} 获得信号量返回true,超时返回false
+ */
+bool sema_down_timeout(struct semaphore* psema, uint32_t timeout_ticks) {
+    enum intr_status old_status = intr_disable();
+    struct task_struct* cur = running_thread();
+    uint64_t wakeup_us = timer_now_us() + (uint64_t)timeout_ticks * TICK_US;
+
+    while (psema->value == 0) {
+        if (timer_now_us() >= wakeup_us) {
+            intr_set_status(old_status);
+            return false;
+        }
+        ASSERT(!elem_find(&psema->waiters, &cur->general_tag));
+        // 挂在等待队列上并设好超时定时器,谁先到就被谁唤醒
+        list_append(&psema->waiters, &cur->general_tag);
+        timer_timeout_add(cur, wakeup_us);
+        thread_block(TASK_BLOCKED);
+        timer_timeout_del(cur);
+    }
+    psema->value--;
+
+    intr_set_status(old_status);
+    return true;
+}
+
 /* 信号量的up操作 */
 void sema_up(struct semaphore* psema) {
     enum intr_status old_status = intr_disable();
@@ -22,6 +22,8 @@ struct lock {
 void sema_init(struct semaphore* psema, uint8_t value);
 /* 信号down操作 */
 void sema_down(struct semaphore* psema);
+/* 带超时的信号down操作,超时返回false */
+bool sema_down_timeout(struct semaphore* psema, uint32_t timeout_ticks);
 /* 信号up操作 */
 void sema_up(struct semaphore* psema);
 /* 锁的初始化 */
@@ -18,6 +18,7 @@
 #include "assert.h"
 #include "process.h"
 #include "sync.h"
+#include "timer.h"
 #include "syscall.h"
 #include "stdio.h"
 #include "shell.h"
@@ -27,6 +28,7 @@
 
 struct task_struct* main_thread;    // 主线程PCB，也就是我们刚进内核的程序，现在运行的程序
 struct task_struct* idle_thread;    // idle线程PCB，空闲线程，不空转浪费CPU
+struct task_struct* init_proc;      // init进程PCB,父进程先退出的进程都过继给它
 struct lock pid_lock;               // 分配pid锁
 
 /* 线程转换从cur到next */
@@ -99,10 +101,15 @@ void init_thread(struct task_struct* pthread, char* name) {
     }
     // 文件优先级
     pthread->priority = 4;
+    // 还不在就绪队列中
+    pthread->mlfq_level = -1;
     // 用户进程在进程初始化时处理，内核线程为NULL
     pthread->pgdir = NULL;
+    pthread->vm_areas = NULL;
     // 线程pid
     pthread->pid = pid_allocate();
+    // 没有父进程,fork出来的进程会改掉
+    pthread->parent_pid = -1;
     // 线程栈顶
     pthread->self_kstack = (uint32_t*)((uint32_t)pthread + PG_SIZE);
     // 以根目录作为默认工作路径
@@ -195,6 +202,39 @@ void thread_yield(void) {
     intr_set_status(old_status);
 }
 
+/* list_traversal的回调,找pid为pid的任务 */
+static bool pid_check(struct list_elem* pelem, int32_t pid) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_tag, pelem);
+    return pthread->pid == pid;
+}
+
+/**
+ * @description: 根据pid找任务的pcb
+ * @param {int32_t} pid
+ * @return {*} 找不到返回NULL
+ */
+struct task_struct* pid2thread(int32_t pid) {
+    struct list_elem* pelem = list_traversal(&thread_all_list, pid_check, pid);
+    return pelem == NULL ? NULL : elem2entry(struct task_struct, all_tag, pelem);
+}
+
+/**
+ * @description: 回收已经退出挂起的任务over的页目录和pcb,任务不能回收自己,由父进程在wait中调用
+ * @param {task_struct*} over 状态为TASK_HANGING的任务
+ * @return {*}
+ */
+void thread_exit(struct task_struct* over) {
+    ASSERT(over != running_thread() && over->status == TASK_HANGING && over->mlfq_level == -1);
+    enum intr_status old_status = intr_disable();
+    over->status = TASK_DIED;
+    list_remove(&over->all_tag);
+    if (over->pgdir != NULL) {
+        mfree_page(PF_KERNEL, over->pgdir, 1);
+    }
+    mfree_page(PF_KERNEL, over, 1);
+    intr_set_status(old_status);
+}
+
 /**
  * @description: 以填充空格的方式输出buf
  * @param {char*} buf 
@@ -292,8 +332,15 @@ void sys_ps(void) {
 static void idle(void* arg UNUSED) {
     while (1) {
         thread_block(TASK_BLOCKED);
+        // 没有别的任务可运行,停掉周期时钟中断,到最近的超时时刻再醒来
+        intr_disable();
+        timer_nohz_start();
         //执行hlt时必须要保证目前处在开中断的情况下
         asm volatile ("sti; hlt" : : : "memory");
+        // 可能是别的中断唤醒的,先把时钟恢复了再去调度
+        intr_disable();
+        timer_nohz_stop();
+        intr_enable();
     }
 }
 
@@ -304,10 +351,14 @@ static void idle(void* arg UNUSED) {
 static void init_th(void) {
     uint32_t ret_pid = fork();
     if (ret_pid) {
-        // init父线程
+        // init父进程,回收shell和过继来的退出进程
+        int32_t status;
+        while (1) {
+            wait(&status);
+        }
     }
     else {
-        // 子线程
+        // 子进程
         my_shell();
     }
     while (1);
@@ -329,7 +380,7 @@ void thread_init(void) {
     // 创建idle线程
     idle_thread = thread_start("idle", idle, NULL);
     // 创建第一个用户进程init
-    process_execute(init_th, "init");
+    init_proc = process_execute(init_th, "init");
 
     put_str("thread_init done\n");
 }
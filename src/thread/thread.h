@@ -4,12 +4,15 @@
 #include "stdin.h"
 #include "list.h"
 #include "memory.h"
+#include "timer.h"
 
 /* pcb栈顶的魔数 */
 #define PCB_MAGIC 0x19870916 
 /* 每个线程最多打开的文件数 */
 #define MAX_FILES_OPEN_PER_PROC 8 
 
+struct vm_area;
+
 /* 自定义通用函数类型,它将在很多线程函数中做为形参类型 */
 typedef void thread_func(void*);
 
@@ -83,8 +86,10 @@ struct task_struct {
     char name[16];           // 线程名，最多16个字母
     int32_t pid;            // 线程pid，也就是线程的标识号
     int32_t parent_pid;     // 父进程pid
+    int32_t exit_status;    // 进程退出时的状态,由父进程wait取走
     uint8_t priority;		 // 线程优先级
     uint8_t ticks;	         // 每次在处理器上的执行时间的滴答数
+    int8_t mlfq_level;       // 所在的就绪队列级别,-1表示不在就绪队列中
     uint32_t elapsed_ticks;  // 这个任务总的滴答数
     int32_t fd_table[MAX_FILES_OPEN_PER_PROC];    // 文件描述符数组,里面存放的是文件打开的描述符
     struct list_elem general_tag; // 线程在一段队列中的节点
@@ -92,11 +97,16 @@ struct task_struct {
     uint32_t* pgdir;         // 进程自己页表的虚拟地址
     struct virtual_addr userprog_vaddr;           // 用户进程虚拟地址池
     struct mem_block_desc u_block_desc[DESC_CNT]; // 用户进程内存块描述符
+    struct vm_area* vm_areas; // 用户进程的文件映射区表,第一次mmap时分配
     uint32_t cwd_inode_nr;   // 进程所在的工作目录的inode编号
+    struct timer timeout_timer; // 带超时阻塞时的定时器,到期时把任务唤醒
+    bool timed_out;          // 是否因为超时被唤醒
     uint32_t stack_magic;	 // 用这串数字做栈的边界标记,用于检测栈的溢出
 };
 
 
+extern struct task_struct* init_proc;
+
 int32_t pid_allocate(void);
 struct task_struct* running_thread(void);
 void thread_create(struct task_struct* pthread, thread_func function, void* func_arg);
@@ -106,6 +116,8 @@ void schedule(void);
 void thread_block(enum task_status stat);
 void thread_unblock(struct task_struct* pthread);
 void thread_yield(void);
+struct task_struct* pid2thread(int32_t pid);
+void thread_exit(struct task_struct* over);
 void thread_init(void);
 void sys_ps(void);
 
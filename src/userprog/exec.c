@@ -0,0 +1,236 @@
+#include "exec.h"
+#include "thread.h"
+#include "process.h"
+#include "memory.h"
+#include "mmap.h"
+#include "fs.h"
+#include "global.h"
+#include "string.h"
+#include "stdio.h"
+#include "assert.h"
+#include "syscall.h"
+
+extern void intr_exit(void);
+
+typedef uint32_t Elf32_Word, Elf32_Addr, Elf32_Off;
+typedef uint16_t Elf32_Half;
+
+/* 32位elf头 */
+struct Elf32_Ehdr {
+    unsigned char e_ident[16];
+    Elf32_Half    e_type;
+    Elf32_Half    e_machine;
+    Elf32_Word    e_version;
+    Elf32_Addr    e_entry;
+    Elf32_Off     e_phoff;
+    Elf32_Off     e_shoff;
+    Elf32_Word    e_flags;
+    Elf32_Half    e_ehsize;
+    Elf32_Half    e_phentsize;
+    Elf32_Half    e_phnum;
+    Elf32_Half    e_shentsize;
+    Elf32_Half    e_shnum;
+    Elf32_Half    e_shstrndx;
+};
+
+/* 程序头表Program header,也就是段描述头 */
+struct Elf32_Phdr {
+    Elf32_Word p_type;
+    Elf32_Off  p_offset;
+    Elf32_Addr p_vaddr;
+    Elf32_Addr p_paddr;
+    Elf32_Word p_filesz;
+    Elf32_Word p_memsz;
+    Elf32_Word p_flags;
+    Elf32_Word p_align;
+};
+
+#define PT_LOAD       1       // 可加载的段
+#define PF_W          2       // 段可写
+
+#define ET_EXEC       2       // 可执行文件
+#define EM_386        3       // 80386
+#define ELFCLASS32    1       // 32位
+#define ELFDATA2LSB   1       // 小端
+
+// 参数和程序头表共用一页内核缓冲区,各占一半
+#define EXEC_ARGS_SIZE  (PG_SIZE / 2)
+#define EXEC_MAX_PHNUM  ((PG_SIZE / 2) / sizeof(struct Elf32_Phdr))
+
+// 放在用户栈顶的退出代码,main返回到这里后以返回值调用exit
+static const uint8_t exec_exit_stub[] = {
+    0x89, 0xc3,                    // mov ebx, eax
+    0xb8, SYS_EXIT, 0, 0, 0,       // mov eax, SYS_EXIT
+    0xcd, 0x80                     // int 0x80
+};
+
+#define PAGE_DOWN(addr) ((addr) & 0xfffff000)
+#define PAGE_UP(addr)   (((addr) + PG_SIZE - 1) & 0xfffff000)
+
+/* 把argv中的参数依次拷贝到buf中,以0分隔,最多取EXEC_MAX_ARGS个,返回参数个数,总长度超过缓冲区返回-1 */
+static int32_t exec_copy_args(const char* argv[], char* buf, uint32_t* args_len) {
+    uint32_t argc = 0, len = 0;
+    // 数组装满时可以没有结尾的NULL,shell的参数数组就是这样
+    while (argv != NULL && argc < EXEC_MAX_ARGS && argv[argc] != NULL) {
+        uint32_t arg_len = strlen(argv[argc]) + 1;
+        if (len + arg_len > EXEC_ARGS_SIZE) return -1;
+        memcpy(buf + len, argv[argc], arg_len);
+        len += arg_len;
+        argc++;
+    }
+    *args_len = len;
+    return argc;
+}
+
+/* 检查elf头和程序头表,可加载的段必须按地址递增、互不共页,且文件偏移和虚拟地址的页内偏移相同 */
+static bool exec_check(struct Elf32_Ehdr* ehdr, struct Elf32_Phdr* phdrs) {
+    uint32_t last_end = USER_VADDR_START;
+    for (uint32_t idx = 0; idx < ehdr->e_phnum; idx++) {
+        struct Elf32_Phdr* ph = &phdrs[idx];
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) continue;
+        if (ph->p_filesz > ph->p_memsz || (ph->p_vaddr & 0xfff) != (ph->p_offset & 0xfff)) return false;
+        if (PAGE_DOWN(ph->p_vaddr) < last_end) return false;
+        last_end = PAGE_UP(ph->p_vaddr + ph->p_memsz);
+        if (last_end < ph->p_vaddr || last_end > 0xc0000000 - USER_STACK_SIZE) return false;
+    }
+    return true;
+}
+
+/* 释放当前进程的整个用户空间,映射区已经去掉,页表留着给新程序用,fork时共享的页只减少共享者个数 */
+static void exec_release_user_space(struct task_struct* cur) {
+    for (uint32_t pde_idx = 0; pde_idx < 0x300; pde_idx++) {
+        if (!(cur->pgdir[pde_idx] & PG_P_1)) continue;
+        uint32_t* pt = pte_ptr(pde_idx << 22);
+        for (uint32_t pte_idx = 0; pte_idx < 1024; pte_idx++) {
+            if (pt[pte_idx] & PG_P_1) pfree(pt[pte_idx] & 0xfffff000);
+            pt[pte_idx] = 0;
+        }
+    }
+    // 重新加载cr3刷新tlb
+    page_dir_activate(cur);
+    user_vaddr_bitmap_reset(cur);
+    block_desc_init(cur->u_block_desc);
+}
+
+/* 建立可加载段的映射,文件中的部分映射成文件映射区,多出来的bss只预留虚拟地址,都在第一次访问时才调入 */
+static void exec_map_segments(struct task_struct* cur, uint32_t i_no, struct Elf32_Ehdr* ehdr, struct Elf32_Phdr* phdrs) {
+    struct virtual_addr* vaddr_pool = &cur->userprog_vaddr;
+    for (uint32_t idx = 0; idx < ehdr->e_phnum; idx++) {
+        struct Elf32_Phdr* ph = &phdrs[idx];
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) continue;
+        uint32_t start = PAGE_DOWN(ph->p_vaddr);
+        uint32_t end = PAGE_UP(ph->p_vaddr + ph->p_memsz);
+        for (uint32_t vaddr = start; vaddr < end; vaddr += PG_SIZE) {
+            bitmap_set(&vaddr_pool->vaddr_bitmap, (vaddr - vaddr_pool->vaddr_start) / PG_SIZE, 1);
+        }
+        if (ph->p_filesz > 0) {
+            // 映射区表在释放用户空间之前已经分配好,段数又不超过表项数,不会失败
+            vm_area_map(start, i_no, PAGE_DOWN(ph->p_offset), (ph->p_vaddr & 0xfff) + ph->p_filesz, (ph->p_flags & PF_W) != 0);
+        }
+    }
+}
+
+/* 在新的用户栈顶放好退出代码和参数,返回栈指针,栈上依次是返回地址、argc、argv,与c函数main(argc, argv)的调用约定一致,
+ * 返回地址指向退出代码,main返回时进程正常退出 */
+static uint32_t exec_build_stack(char* args, uint32_t args_len, uint32_t argc, uint32_t* argv_addr) {
+    // 栈已经预留,这里写入时由缺页处理映射
+    uint32_t stub = USER_STACK3_VADDR + PG_SIZE - sizeof(exec_exit_stub);
+    memcpy((void*)stub, exec_exit_stub, sizeof(exec_exit_stub));
+    uint32_t sp = stub - args_len;
+    memcpy((void*)sp, args, args_len);
+    uint32_t str = sp;
+    sp = (sp & ~3) - (argc + 1) * 4;
+    char** argv = (char**)sp;
+    for (uint32_t idx = 0; idx < argc; idx++) {
+        argv[idx] = (char*)str;
+        str += strlen((char*)str) + 1;
+    }
+    argv[argc] = NULL;
+    *argv_addr = sp;
+    sp -= 12;
+    ((uint32_t*)sp)[0] = stub;
+    ((uint32_t*)sp)[1] = argc;
+    ((uint32_t*)sp)[2] = *argv_addr;
+    return sp;
+}
+
+/**
+ * @description: 用path指向的elf可执行文件替换当前进程.先检查文件,再释放旧的用户空间,可加载段映射成按需调入的文件映射区,
+ *               页目录沿用当前进程的.新程序入口处ebx为argv,ecx为argc,栈顶与调用main(argc, argv)时一样
+ * @param {char*} path 可执行文件路径
+ * @param {char**} argv 以NULL结尾的参数数组,最多EXEC_MAX_ARGS项,可以为NULL
+ * @return {*} 成功时直接从中断返回到新程序,不返回;失败返回-1,此时当前进程不受影响
+ */
+int32_t sys_execv(const char* path, const char* argv[]) {
+    struct task_struct* cur = running_thread();
+    if (cur->pgdir == NULL) return -1;
+    // 参数和程序头表要先拷贝到内核中,旧的用户空间马上就要释放了
+    char* buf = get_kernel_pages(1);
+    if (buf == NULL) return -1;
+    struct Elf32_Phdr* phdrs = (struct Elf32_Phdr*)(buf + EXEC_ARGS_SIZE);
+    uint32_t args_len = 0;
+    int32_t argc = exec_copy_args(argv, buf, &args_len);
+    if (argc == -1) {
+        printk("sys_execv: arguments too long\n");
+        mfree_page(PF_KERNEL, buf, 1);
+        return -1;
+    }
+
+    // 1 读入并检查elf头和程序头表
+    int32_t fd = sys_open(path, O_RDONLY);
+    if (fd == -1) {
+        mfree_page(PF_KERNEL, buf, 1);
+        return -1;
+    }
+    struct Elf32_Ehdr ehdr;
+    memset(&ehdr, 0, sizeof(struct Elf32_Ehdr));
+    bool valid = sys_read(fd, &ehdr, sizeof(struct Elf32_Ehdr)) == sizeof(struct Elf32_Ehdr) && \
+        !memcmp(ehdr.e_ident, "\177ELF", 4) && ehdr.e_ident[4] == ELFCLASS32 && ehdr.e_ident[5] == ELFDATA2LSB && \
+        ehdr.e_type == ET_EXEC && ehdr.e_machine == EM_386 && ehdr.e_version == 1 && \
+        ehdr.e_phentsize == sizeof(struct Elf32_Phdr) && ehdr.e_phnum > 0 && ehdr.e_phnum <= EXEC_MAX_PHNUM;
+    if (valid) {
+        uint32_t phdrs_size = ehdr.e_phnum * sizeof(struct Elf32_Phdr);
+        valid = sys_lseek(fd, ehdr.e_phoff, SEEK_SET) != -1 && \
+            sys_read(fd, phdrs, phdrs_size) == (int32_t)phdrs_size && exec_check(&ehdr, phdrs);
+    }
+    // 顺便去掉旧的映射区并准备好映射区表,过了这一步就不会再失败
+    if (!valid || vm_area_reset(cur) == -1) {
+        printk("sys_execv: %s is not a valid executable\n", path);
+        sys_close(fd);
+        mfree_page(PF_KERNEL, buf, 1);
+        return -1;
+    }
+
+    // 2 新的进程名取路径的最后一项,path在用户空间中,要在释放之前取
+    const char* name = strrchr(path, '/');
+    name = name == NULL ? path : name + 1;
+    memset(cur->name, 0, sizeof(cur->name));
+    memcpy(cur->name, name, strlen(name) < sizeof(cur->name) - 1 ? strlen(name) : sizeof(cur->name) - 1);
+
+    // 3 释放旧的用户空间,建立新程序的映射
+    uint32_t i_no = file_table[cur->fd_table[fd]].fd_inode->i_no;
+    exec_release_user_space(cur);
+    exec_map_segments(cur, i_no, &ehdr, phdrs);
+    // 映射区各自持有inode,文件可以关闭了
+    sys_close(fd);
+
+    // 4 在用户栈上放好参数,改写中断栈后从中断返回到新程序的入口
+    uint32_t argv_addr = 0;
+    uint32_t sp = exec_build_stack(buf, args_len, argc, &argv_addr);
+    mfree_page(PF_KERNEL, buf, 1);
+    struct intr_stack* intr_0_stack = (struct intr_stack*)((uint32_t)cur + PG_SIZE - sizeof(struct intr_stack));
+    memset(intr_0_stack, 0, sizeof(struct intr_stack));
+    intr_0_stack->ebx = argv_addr;
+    intr_0_stack->ecx = argc;
+    intr_0_stack->ds = SELECTOR_U_DATA;
+    intr_0_stack->es = SELECTOR_U_DATA;
+    intr_0_stack->fs = SELECTOR_U_DATA;
+    intr_0_stack->gs = 0;
+    intr_0_stack->eip = (void (*)(void))ehdr.e_entry;
+    intr_0_stack->cs = SELECTOR_U_CODE;
+    intr_0_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
+    intr_0_stack->esp = (void*)sp;
+    intr_0_stack->ss = SELECTOR_U_DATA;
+    asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (intr_0_stack) : "memory");
+    return 0;
+}
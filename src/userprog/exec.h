@@ -0,0 +1,11 @@
+#ifndef __USERPROG_EXEC_H
+#define __USERPROG_EXEC_H
+
+#include "stdin.h"
+
+#define EXEC_MAX_ARGS 16      // execv最多传递的参数个数
+
+/* 用path指向的elf程序替换当前进程,成功时不返回,失败返回-1 */
+int32_t sys_execv(const char* path, const char* argv[]);
+
+#endif
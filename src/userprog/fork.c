@@ -7,6 +7,7 @@
 #include "string.h"
 #include "file.h"
 #include "mlfq.h"
+#include "mmap.h"
 
 extern void intr_exit(void);
 
@@ -42,38 +43,37 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, str
 }
 
 /**
- * @description: 复制子进程的进程体(代码和数据)及用户栈
+ * @description: 把父进程用户空间的页表复制给子进程,物理页不复制而是共享,可写的页在双方都改成只读并标记写时复制,
+ *               谁先写就由缺页处理给谁复制一份.耗时只和页表的大小有关,和进程占用的内存无关
  * @param {task_struct*} child_thread 子进程
- * @param {task_struct*} parent_thread 父进程
- * @param {void*} buf_page 
- * @return {*}
+ * @param {task_struct*} parent_thread 父进程,必须是当前运行的进程
+ * @return {*} 成功返回0,失败返回-1
  */
-static void copy_body_stack3(struct task_struct* child_thread, struct task_struct* parent_thread, void* buf_page) {
-    uint8_t* vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
-    
-    /* 在父进程的用户空间中查找已有数据的页 */
-    for (uint32_t idx_byte = 0; idx_byte < btmp_bytes_len; idx_byte++) {
-        if (vaddr_btmp[idx_byte]) {
-            for (uint32_t idx_bit = 0; idx_bit < 8; idx_bit++) {
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte]) {
-                    uint32_t prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
-                    // 下面的操作是将父进程用户空间中的数据通过内核空间做中转,最终复制到子进程的用户空间
-                    // a 将父进程在用户空间中的数据复制到内核缓冲区buf_page,目的是下面切换到子进程的页表后,还能访问到父进程的数据
-                    memcpy(buf_page, (void*)prog_vaddr, PG_SIZE);
-                    // b 将页表切换到子进程,目的是避免下面申请内存的函数将pte及pde安装在父进程的页表中
-                    page_dir_activate(child_thread);
-                    // c 申请虚拟地址prog_vaddr
-                    get_a_page_without_opvaddrbitmap(PF_USER, prog_vaddr);
-                    // d 从内核缓冲区中将父进程数据复制到子进程的用户空间
-                    memcpy((void*)prog_vaddr, buf_page, PG_SIZE);
-                    // e 恢复父进程页表
-                    page_dir_activate(parent_thread);
-                }
+static int32_t copy_page_tables(struct task_struct* child_thread, struct task_struct* parent_thread) {
+    // 0x300之前的页目录项对应3GB以下的用户空间
+    for (uint32_t pde_idx = 0; pde_idx < 0x300; pde_idx++) {
+        if (!(parent_thread->pgdir[pde_idx] & PG_P_1)) continue;
+        uint32_t* child_pt = get_kernel_pages(1);
+        if (child_pt == NULL) return -1;
+        // 父进程的页表正在使用,通过页目录的自映射就能访问到它的页表
+        uint32_t* parent_pt = pte_ptr(pde_idx << 22);
+        for (uint32_t pte_idx = 0; pte_idx < 1024; pte_idx++) {
+            uint32_t pte = parent_pt[pte_idx];
+            if (!(pte & PG_P_1)) continue;
+            // 只读的页本来就不会被写,直接共享
+            if (pte & PG_RW_W) {
+                pte = (pte & ~PG_RW_W) | PG_COW;
+                parent_pt[pte_idx] = pte;
             }
+            child_pt[pte_idx] = pte;
+            page_ref_inc(pte & 0xfffff000);
         }
+        // 用户页表和缺页时建立的一样只占物理页,不占内核虚拟地址,进程退出时按物理页释放
+        child_thread->pgdir[pde_idx] = kernel_page_detach(child_pt) | PG_US_U | PG_RW_W | PG_P_1;
     }
+    // 父进程的页表项改成了只读,重新加载cr3刷新tlb
+    page_dir_activate(parent_thread);
+    return 0;
 }
 
 /**
@@ -132,10 +132,6 @@ static void update_inode_open_cnts(struct task_struct* thread) {
  * @return {*}
  */
 static int32_t copy_process(struct task_struct* child_thread, struct task_struct* parent_thread) {
-    // 内核缓冲区,作为父进程用户空间的数据复制到子进程用户空间的中转
-    void* buf_page = get_kernel_pages(1);
-    if (buf_page == NULL) return -1;
-
     // a 复制父进程的pcb、虚拟地址位图、内核栈到子进程
     if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1) return -1;
 
@@ -143,17 +139,17 @@ static int32_t copy_process(struct task_struct* child_thread, struct task_struct
     child_thread->pgdir = create_page_dir();
     if (child_thread->pgdir == NULL) return -1;
 
-    // c 复制父进程进程体及用户栈给子进程
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    // c 复制父进程的映射区表
+    if (vm_area_fork(child_thread, parent_thread) == -1) return -1;
+
+    // d 子进程与父进程写时复制地共享进程体及用户栈
+    if (copy_page_tables(child_thread, parent_thread) == -1) return -1;
 
-    // d 构建子进程thread_stack和修改返回值pid
+    // e 构建子进程thread_stack和修改返回值pid
     build_child_stack(child_thread);
 
-    // e 更新文件inode的打开数
+    // f 更新文件inode的打开数
     update_inode_open_cnts(child_thread);
-
-    // 释放内核缓冲区
-    mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
 }
 
@@ -0,0 +1,242 @@
+#include "mmap.h"
+#include "memory.h"
+#include "inode.h"
+#include "fs.h"
+#include "super_block.h"
+#include "string.h"
+#include "stdio.h"
+#include "assert.h"
+
+/* 在进程的映射区表中查找包含vaddr的映射区,找不到返回NULL */
+static struct vm_area* vm_area_find(struct task_struct* pthread, uint32_t vaddr) {
+    if (pthread->vm_areas == NULL) return NULL;
+    for (uint32_t idx = 0; idx < VM_AREA_CNT; idx++) {
+        struct vm_area* area = &pthread->vm_areas[idx];
+        if (area->used && vaddr >= area->start && vaddr - area->start < area->pg_cnt * PG_SIZE) {
+            return area;
+        }
+    }
+    return NULL;
+}
+
+/* 在进程的映射区表中找一个空闲表项,第一次使用时才分配映射区表,失败返回NULL */
+static struct vm_area* vm_area_alloc(struct task_struct* pthread) {
+    if (pthread->vm_areas == NULL) {
+        pthread->vm_areas = get_kernel_pages(1);
+        if (pthread->vm_areas == NULL) return NULL;
+    }
+    for (uint32_t idx = 0; idx < VM_AREA_CNT; idx++) {
+        if (!pthread->vm_areas[idx].used) return &pthread->vm_areas[idx];
+    }
+    return NULL;
+}
+
+/* 填写映射区,映射区自己持有一次inode的打开,关闭文件描述符后映射依然有效 */
+static void vm_area_setup(struct vm_area* area, uint32_t start, uint32_t i_no, uint32_t offset, uint32_t length, bool writable) {
+    memset(area, 0, sizeof(struct vm_area));
+    area->used = true;
+    area->writable = writable;
+    area->start = start;
+    area->pg_cnt = DIV_ROUND_UP(length, PG_SIZE);
+    area->offset = offset;
+    area->length = length;
+    area->file.fd_inode = inode_open(cur_part, i_no);
+    area->file.fd_flag = O_RDONLY;
+    area->file.fd_pos = offset;
+    // 从映射区开头顺序访问时,第一次缺页就开始预读
+    area->file.ra_next = offset / cur_part->sb->block_size;
+}
+
+/**
+ * @description: 把文件fd从offset起的length字节映射到进程的用户空间,只分配虚拟地址,页在第一次访问时由缺页处理读入.
+ *               映射是私有的,以读写方式打开的文件映射成可写,写入不会写回文件
+ * @param {int32_t} fd 文件描述符
+ * @param {uint32_t} offset 文件中的起始偏移,必须页对齐
+ * @param {uint32_t} length 映射的字节数
+ * @return {*} 成功返回映射区的起始地址,失败返回NULL
+ */
+void* sys_mmap(int32_t fd, uint32_t offset, uint32_t length) {
+    struct task_struct* cur = running_thread();
+    if (cur->pgdir == NULL || fd <= stderr_no || fd >= MAX_FILES_OPEN_PER_PROC || cur->fd_table[fd] == -1) {
+        printk("sys_mmap: fd error\n");
+        return NULL;
+    }
+    if (length == 0 || offset % PG_SIZE != 0) {
+        printk("sys_mmap: offset or length error\n");
+        return NULL;
+    }
+    struct file* file = &file_table[cur->fd_table[fd]];
+    if (file->fd_flag & O_WRONLY) {
+        printk("sys_mmap: file opened write only\n");
+        return NULL;
+    }
+    struct vm_area* area = vm_area_alloc(cur);
+    if (area == NULL) {
+        printk("sys_mmap: too many mappings\n");
+        return NULL;
+    }
+    void* start = vaddr_get(PF_USER, DIV_ROUND_UP(length, PG_SIZE));
+    if (start == NULL) return NULL;
+    vm_area_setup(area, (uint32_t)start, file->fd_inode->i_no, offset, length, (file->fd_flag & O_RDWR) != 0);
+    return start;
+}
+
+/**
+ * @description: 把inode编号为i_no的文件从offset起的length字节映射到当前进程从start起的虚拟地址上,虚拟地址由调用者预留
+ * @param {uint32_t} start 起始虚拟地址,页对齐
+ * @param {uint32_t} i_no 文件的inode编号
+ * @param {uint32_t} offset 文件中的起始偏移,页对齐
+ * @param {uint32_t} length 映射的字节数
+ * @param {bool} writable 是否可写
+ * @return {*} 成功返回0,映射区表满了返回-1
+ */
+int32_t vm_area_map(uint32_t start, uint32_t i_no, uint32_t offset, uint32_t length, bool writable) {
+    ASSERT(start % PG_SIZE == 0 && offset % PG_SIZE == 0 && length > 0);
+    struct vm_area* area = vm_area_alloc(running_thread());
+    if (area == NULL) return -1;
+    vm_area_setup(area, start, i_no, offset, length, writable);
+    return 0;
+}
+
+/**
+ * @description: 去掉进程的全部映射区,映射区中已经调入的页由调用者释放.映射区表不存在时顺便分配好
+ * @param {task_struct*} pthread 进程
+ * @return {*} 成功返回0,分配映射区表失败返回-1
+ */
+int32_t vm_area_reset(struct task_struct* pthread) {
+    if (pthread->vm_areas == NULL) {
+        pthread->vm_areas = get_kernel_pages(1);
+        return pthread->vm_areas == NULL ? -1 : 0;
+    }
+    for (uint32_t idx = 0; idx < VM_AREA_CNT; idx++) {
+        struct vm_area* area = &pthread->vm_areas[idx];
+        if (area->used) {
+            inode_close(area->file.fd_inode);
+            area->used = false;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @description: 解除起始于addr的映射,已经调入的页归还给用户内存池,虚拟地址归还给进程
+ * @param {void*} addr mmap返回的起始地址
+ * @param {uint32_t} length 映射的字节数,必须覆盖整个映射区
+ * @return {*} 成功返回0,失败返回-1
+ */
+int32_t sys_munmap(void* addr, uint32_t length) {
+    struct task_struct* cur = running_thread();
+    struct vm_area* area = vm_area_find(cur, (uint32_t)addr);
+    if (area == NULL || area->start != (uint32_t)addr || DIV_ROUND_UP(length, PG_SIZE) != area->pg_cnt) {
+        printk("sys_munmap: no mapping at 0x%x\n", (uint32_t)addr);
+        return -1;
+    }
+    for (uint32_t pg_idx = 0; pg_idx < area->pg_cnt; pg_idx++) {
+        uint32_t vaddr = area->start + pg_idx * PG_SIZE;
+        if (page_present(vaddr)) {
+            mfree_page(PF_USER, (void*)vaddr, 1);
+        }
+        else {
+            vaddr_remove(PF_USER, (void*)vaddr, 1);
+        }
+    }
+    inode_close(area->file.fd_inode);
+    area->used = false;
+    return 0;
+}
+
+/* 堆和栈的页只分配了虚拟地址,第一次访问时映射一个清0的物理页 */
+static bool vm_fault_zero(struct task_struct* cur, uint32_t page) {
+    struct virtual_addr* vaddr_pool = &cur->userprog_vaddr;
+    if (page < vaddr_pool->vaddr_start) return false;
+    // 虚拟地址位图中没有分配出去的页是非法访问
+    if (!bitmap_scan_test(&vaddr_pool->vaddr_bitmap, (page - vaddr_pool->vaddr_start) / PG_SIZE)) return false;
+    if (get_a_page_without_opvaddrbitmap(PF_USER, page) == NULL) {
+        printk("vm_fault: out of memory at 0x%x\n", page);
+        return false;
+    }
+    memset((void*)page, 0, PG_SIZE);
+    return true;
+}
+
+/**
+ * @description: 处理当前进程在vaddr处的缺页.写fork后共享的页时复制一份;vaddr落在映射区内且页还没有调入时,分配一页物理内存并从文件读入;
+ *               落在已分配虚拟地址的堆和栈中时映射一个清0的页
+ * @param {uint32_t} vaddr 引起缺页的地址
+ * @param {bool} write 是否是写操作引起的
+ * @return {*} 缺页已解决返回true,访问了没有分配的虚拟地址或者权限不对返回false
+ */
+bool vm_fault(uint32_t vaddr, bool write) {
+    struct task_struct* cur = running_thread();
+    if (cur->pgdir == NULL) return false;
+    uint32_t page = vaddr & 0xfffff000;
+    // 页已经在内存中却还缺页,说明是权限错误,只有写fork后共享的页是合法的
+    if (page_present(page)) return write && page_cow_break(page);
+    struct vm_area* area = vm_area_find(cur, vaddr);
+    if (area == NULL) return vm_fault_zero(cur, page);
+    if (write && !area->writable) return false;
+    if (get_a_page_without_opvaddrbitmap(PF_USER, page) == NULL) {
+        printk("vm_fault: out of memory at 0x%x\n", vaddr);
+        return false;
+    }
+
+    // 页对齐的偏移也是块对齐的,整页由硬盘直接读入,读不到的部分填0
+    uint32_t pos = area->offset + (page - area->start);
+    uint32_t end = area->offset + area->length;
+    int32_t bytes_read = 0;
+    if (pos < end) {
+        area->file.fd_pos = pos;
+        bytes_read = file_read(&area->file, (void*)page, end - pos < PG_SIZE ? end - pos : PG_SIZE);
+        if (bytes_read < 0) bytes_read = 0;
+    }
+    memset((void*)(page + bytes_read), 0, PG_SIZE - bytes_read);
+
+    if (!area->writable) {
+        *pte_ptr(page) &= ~PG_RW_W;
+        asm volatile ("invlpg %0"::"m" (*(uint8_t*)page) : "memory");
+    }
+    return true;
+}
+
+/**
+ * @description: 内核读写用户缓冲区之前先把其中映射区的页调入,否则硬盘的工作线程会在别的页表中访问到不存在的页
+ * @param {void*} buf 用户缓冲区
+ * @param {uint32_t} len 字节数
+ * @param {bool} write 内核是否要写入缓冲区
+ * @return {*} 缓冲区可访问返回true
+ */
+bool vm_prefault(const void* buf, uint32_t len, bool write) {
+    struct task_struct* cur = running_thread();
+    uint32_t vaddr = (uint32_t)buf;
+    if (cur->pgdir == NULL || len == 0 || vaddr >= KERNEL_SPACE_START) return true;
+    uint32_t end = vaddr + len;
+    if (end < vaddr || end > KERNEL_SPACE_START) return false;
+    for (uint32_t page = vaddr & 0xfffff000; page < end; page += PG_SIZE) {
+        // 写fork后共享的页时先复制一份,否则dma会直接写到共享的物理页上
+        if (!page_present(page) || (write && !(*pte_ptr(page) & PG_RW_W))) {
+            if (!vm_fault(page, write)) return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @description: fork时为子进程复制映射区表,子进程的映射区各自再持有一次inode的打开
+ * @param {task_struct*} child 子进程
+ * @param {task_struct*} parent 父进程
+ * @return {*} 成功返回0,失败返回-1
+ */
+int32_t vm_area_fork(struct task_struct* child, struct task_struct* parent) {
+    child->vm_areas = NULL;
+    if (parent->vm_areas == NULL) return 0;
+    child->vm_areas = get_kernel_pages(1);
+    if (child->vm_areas == NULL) return -1;
+    memcpy(child->vm_areas, parent->vm_areas, PG_SIZE);
+    for (uint32_t idx = 0; idx < VM_AREA_CNT; idx++) {
+        struct vm_area* area = &child->vm_areas[idx];
+        if (area->used) {
+            area->file.fd_inode = inode_open(cur_part, area->file.fd_inode->i_no);
+        }
+    }
+    return 0;
+}
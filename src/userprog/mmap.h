@@ -0,0 +1,37 @@
+#ifndef __USERPROG_MMAP_H
+#define __USERPROG_MMAP_H
+
+#include "stdin.h"
+#include "thread.h"
+#include "file.h"
+
+/* 进程的一段文件映射区,区内的页第一次被访问时才从文件读入 */
+struct vm_area {
+    bool used;                    // 此表项是否在使用
+    bool writable;                // 区内的页是否可写,写入只改进程自己的页,不写回文件
+    uint32_t start;               // 起始虚拟地址,页对齐
+    uint32_t pg_cnt;              // 占用的虚拟页数
+    uint32_t offset;              // 映射的文件起始偏移,页对齐
+    uint32_t length;              // 映射的文件字节数,超出文件末尾的部分读出来是0
+    struct file file;             // 缺页时读文件用,独立的偏移和预读窗口,顺序缺页时能触发预读
+};
+
+// 每个进程的映射区表占一页
+#define VM_AREA_CNT (PG_SIZE / sizeof(struct vm_area))
+
+/* 把文件fd从offset起的length字节映射到进程的用户空间,成功返回起始地址,失败返回NULL */
+void* sys_mmap(int32_t fd, uint32_t offset, uint32_t length);
+/* 解除起始于addr、长length字节的映射,成功返回0,失败返回-1 */
+int32_t sys_munmap(void* addr, uint32_t length);
+/* 把文件i_no从offset起的length字节映射到当前进程从start起已经预留的虚拟地址上,成功返回0 */
+int32_t vm_area_map(uint32_t start, uint32_t i_no, uint32_t offset, uint32_t length, bool writable);
+/* 去掉进程的全部映射区,映射区中的页由调用者释放,成功返回0 */
+int32_t vm_area_reset(struct task_struct* pthread);
+/* 处理当前进程在vaddr处的缺页,能按需调入、清0映射或者写时复制返回true */
+bool vm_fault(uint32_t vaddr, bool write);
+/* 读写用户缓冲区之前先把其中还没有映射的页调入,缓冲区不可访问时返回false */
+bool vm_prefault(const void* buf, uint32_t len, bool write);
+/* fork时为子进程复制映射区表,成功返回0,失败返回-1 */
+int32_t vm_area_fork(struct task_struct* child, struct task_struct* parent);
+
+#endif
@@ -35,7 +35,8 @@ void start_process(void* filename_) {
     proc_stack->eip = function;	 // 待执行的用户程序地址
     proc_stack->cs = SELECTOR_U_CODE;
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
-    proc_stack->esp = (void*)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE) ;
+    // 栈的虚拟地址创建进程时已经预留,压栈时由缺页处理逐页映射
+    proc_stack->esp = (void*)(USER_STACK3_VADDR + PG_SIZE);
     proc_stack->ss = SELECTOR_U_DATA; 
     asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (proc_stack) : "memory");
 }
@@ -86,11 +87,20 @@ void create_user_vaddr_bitmap(struct task_struct* user_prog) {
     uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8 , PG_SIZE);
     user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
     user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
+    user_vaddr_bitmap_reset(user_prog);
+}
+
+/* 清空用户进程虚拟地址位图,只预留用户空间顶部的栈,堆不会分配到这里 */
+void user_vaddr_bitmap_reset(struct task_struct* user_prog) {
     bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+    uint32_t stack_bit_idx = (0xc0000000 - USER_STACK_SIZE - USER_VADDR_START) / PG_SIZE;
+    for (uint32_t idx = 0; idx < USER_STACK_SIZE / PG_SIZE; idx++) {
+        bitmap_set(&user_prog->userprog_vaddr.vaddr_bitmap, stack_bit_idx + idx, 1);
+    }
 }
 
-/* 创建用户进程 */
-void process_execute(void* filename, char* name) { 
+/* 创建用户进程,返回它的pcb */
+struct task_struct* process_execute(void* filename, char* name) { 
     // pcb是操作系统的数据，由操作系统来维护
     struct task_struct* thread = get_kernel_pages(1);
     // 初始化线程
@@ -105,5 +115,6 @@ void process_execute(void* filename, char* name) {
     block_desc_init((struct mem_block_desc*) (&(thread->u_block_desc)));
     // 将当前线程加入多级反馈优先队列
     mlfq_new(thread);
+    return thread;
 }
 
@@ -4,13 +4,15 @@
 #include "stdin.h"
 
 #define USER_STACK3_VADDR  (0xc0000000 - 0x1000)
+#define USER_STACK_SIZE    0x800000   // 用户栈最大8MB,创建进程时预留虚拟地址,页在第一次访问时才映射
 #define USER_VADDR_START 0x8048000
 
-void process_execute(void* filename, char* name);
+struct task_struct* process_execute(void* filename, char* name);
 void start_process(void* filename_);
 void process_activate(struct task_struct* p_thread);
 void page_dir_activate(struct task_struct* p_thread);
 uint32_t* create_page_dir(void);
 void create_user_vaddr_bitmap(struct task_struct* user_prog);
+void user_vaddr_bitmap_reset(struct task_struct* user_prog);
 
 #endif
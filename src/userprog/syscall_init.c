@@ -19,6 +19,9 @@
 #include "memory.h"
 #include "fs.h"
 #include "fork.h"
+#include "mmap.h"
+#include "exec.h"
+#include "wait_exit.h"
 
  // 系统调用总数 
 #define syscall_nr 64
@@ -57,5 +60,12 @@ void syscall_init(void) {
     syscall_table[SYS_REWINDDIR] = sys_rewinddir;
     syscall_table[SYS_STAT] = sys_stat;
     syscall_table[SYS_PS] = sys_ps;
+    syscall_table[SYS_FSYNC] = sys_fsync;
+    syscall_table[SYS_MMAP] = sys_mmap;
+    syscall_table[SYS_MUNMAP] = sys_munmap;
+    syscall_table[SYS_EXECV] = sys_execv;
+    syscall_table[SYS_EXIT] = sys_exit;
+    syscall_table[SYS_WAIT] = sys_wait;
+    syscall_table[SYS_CACHESTAT] = sys_cachestat;
     put_str("syscall_init done!\n");
 }
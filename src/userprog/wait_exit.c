@@ -0,0 +1,109 @@
+#include "wait_exit.h"
+#include "thread.h"
+#include "process.h"
+#include "memory.h"
+#include "mmap.h"
+#include "mlfq.h"
+#include "fs.h"
+#include "interrupt.h"
+#include "assert.h"
+
+/* 释放进程的用户页、页表、映射区、虚拟地址位图并关闭打开的文件,页目录和pcb还在用,留给父进程回收 */
+static void release_prog_resource(struct task_struct* pthread) {
+    // 先关闭文件,关闭时可能还要用到进程自己的堆,用户页释放后就不能再访问了
+    for (int32_t fd = 3; fd < MAX_FILES_OPEN_PER_PROC; fd++) {
+        if (pthread->fd_table[fd] != -1) sys_close(fd);
+    }
+
+    // 0x300之前的页目录项对应3GB以下的用户空间,fork时共享的页只减少共享者个数
+    for (uint32_t pde_idx = 0; pde_idx < 0x300; pde_idx++) {
+        if (!(pthread->pgdir[pde_idx] & PG_P_1)) continue;
+        uint32_t* pt = pte_ptr(pde_idx << 22);
+        for (uint32_t pte_idx = 0; pte_idx < 1024; pte_idx++) {
+            if (pt[pte_idx] & PG_P_1) pfree(pt[pte_idx] & 0xfffff000);
+        }
+        // 用户页表只占内核物理页,没有内核虚拟地址
+        pfree(pthread->pgdir[pde_idx] & 0xfffff000);
+        pthread->pgdir[pde_idx] = 0;
+    }
+    // 重新加载cr3刷新tlb
+    page_dir_activate(pthread);
+
+    if (pthread->vm_areas != NULL) {
+        vm_area_reset(pthread);
+        mfree_page(PF_KERNEL, pthread->vm_areas, 1);
+        pthread->vm_areas = NULL;
+    }
+    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
+    mfree_page(PF_KERNEL, pthread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt);
+}
+
+/* list_traversal的回调,把父进程为ppid的进程过继给init */
+static bool init_adopt_a_child(struct list_elem* pelem, int32_t ppid) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_tag, pelem);
+    if (pthread->parent_pid == ppid) pthread->parent_pid = init_proc->pid;
+    return false;
+}
+
+/* list_traversal的回调,找父进程为ppid且已经退出挂起的进程 */
+static bool find_hanging_child(struct list_elem* pelem, int32_t ppid) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_tag, pelem);
+    return pthread->parent_pid == ppid && pthread->status == TASK_HANGING;
+}
+
+/* list_traversal的回调,找父进程为ppid的进程 */
+static bool find_child(struct list_elem* pelem, int32_t ppid) {
+    struct task_struct* pthread = elem2entry(struct task_struct, all_tag, pelem);
+    return pthread->parent_pid == ppid;
+}
+
+/**
+ * @description: 结束当前进程.释放用户空间,子进程过继给init,唤醒等待的父进程,自己挂起等父进程回收,不返回
+ * @param {int32_t} status 退出状态,父进程wait时取走
+ * @return {*}
+ */
+void sys_exit(int32_t status) {
+    struct task_struct* cur = running_thread();
+    // init负责回收别人,不能退出
+    ASSERT(cur->pgdir != NULL && cur != init_proc);
+    cur->exit_status = status;
+    release_prog_resource(cur);
+
+    // 检查父进程和挂起自己要在同一段关中断中,否则父进程可能错过唤醒
+    intr_disable();
+    list_traversal(&thread_all_list, init_adopt_a_child, cur->pid);
+    // 过继来的子进程可能已经挂起了,init在等待时把它叫醒去回收
+    if (init_proc->status == TASK_WAITING) thread_unblock(init_proc);
+    struct task_struct* parent = pid2thread(cur->parent_pid);
+    if (parent != NULL && parent->status == TASK_WAITING) thread_unblock(parent);
+    thread_block(TASK_HANGING);
+    PANIC("sys_exit: hanging process was scheduled\n");
+}
+
+/**
+ * @description: 等待一个子进程退出并回收它的pcb和页目录
+ * @param {int32_t*} status 子进程的退出状态存到这里,可以为NULL
+ * @return {*} 回收的子进程pid,没有子进程返回-1
+ */
+int32_t sys_wait(int32_t* status) {
+    struct task_struct* cur = running_thread();
+    enum intr_status old_status = intr_disable();
+    while (1) {
+        struct list_elem* child_elem = list_traversal(&thread_all_list, find_hanging_child, cur->pid);
+        if (child_elem != NULL) {
+            struct task_struct* child = elem2entry(struct task_struct, all_tag, child_elem);
+            int32_t child_pid = child->pid;
+            int32_t exit_status = child->exit_status;
+            thread_exit(child);
+            intr_set_status(old_status);
+            if (status != NULL) *status = exit_status;
+            return child_pid;
+        }
+        if (list_traversal(&thread_all_list, find_child, cur->pid) == NULL) {
+            intr_set_status(old_status);
+            return -1;
+        }
+        // 子进程退出时看到父进程在等待就会唤醒它
+        thread_block(TASK_WAITING);
+    }
+}
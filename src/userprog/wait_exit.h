@@ -0,0 +1,9 @@
+#ifndef __USERPROG_WAIT_EXIT_H
+#define __USERPROG_WAIT_EXIT_H
+
+#include "stdin.h"
+
+void sys_exit(int32_t status);
+int32_t sys_wait(int32_t* status);
+
+#endif